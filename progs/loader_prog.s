@@ -4,12 +4,11 @@ align 4                         ; 4-byte aligned code
 global loader                   ; The entry symbol for ELF
 extern main                     ; The user main function
 extern exit
+extern syscall_init
 
 loader:                         ; Entry point defined in link_prog.ld
-  ; Push eventual arguments to the stack, from last to first
-  ; None for the moment
-  nop
-  nop
+  ; The kernel leaves argc then argv on the stack, where main expects them
+  call syscall_init              ; Selects the fastest syscall entry
   call main
 
   ; Now we add an exit syscall to be sure the program exits properly
@@ -0,0 +1,141 @@
+#include <stdarg.h>
+#include "src/lib.h"
+
+/** printf.c:
+ *  Formatting of printf in the process, the characters being written by
+ *  console_write. Linked with every program, next to lib.s.
+ */
+
+#define PRINTF_BUFFER 256
+
+char    printf_buffer[PRINTF_BUFFER];  /* The characters not written yet */
+u_int32 printf_length = 0;
+
+
+/**
+ * @name printf_flush - Writes the characters of the buffer
+ * @return void
+ */
+void printf_flush()
+{
+  u_int32 done = 0;
+  while (done < printf_length) {
+    u_int32 written = console_write(printf_buffer + done, printf_length - done);
+    if (!written) {
+      break;  /* STDOUT has no reader left */
+    }
+    done += written;
+  }
+  printf_length = 0;
+}
+
+/**
+ * @name printf_reserve - Flushes the buffer if some characters do not fit, so
+ * that the console receives them in the same write
+ * @param length        - The number of characters
+ * @return void
+ */
+void printf_reserve(u_int32 length)
+{
+  if (printf_length + length > PRINTF_BUFFER) {
+    printf_flush();
+  }
+}
+
+/**
+ * @name printf_char - Adds a character to the buffer, flushing it when full
+ * The two bytes of the accented characters are kept together.
+ * @param c          - The character
+ * @return void
+ */
+void printf_char(char c)
+{
+  printf_reserve(c == 0xc2 || c == 0xc3 ? 2 : 1);
+  printf_buffer[printf_length++] = c;
+}
+
+/**
+ * @name printf_number - Adds a number to the buffer
+ * @param n            - The number
+ * @param base         - 10 or 16
+ * @return void
+ */
+void printf_number(u_int32 n, u_int32 base)
+{
+  char digits[10];
+  u_int32 nb_digits = 0;
+  do {
+    u_int32 digit = n % base;
+    digits[nb_digits++] = digit < 10 ? '0' + digit : 'a' + digit - 10;
+    n /= base;
+  } while (n);
+
+  while (nb_digits) {
+    printf_char(digits[--nb_digits]);
+  }
+}
+
+void printf(string s, ...)
+{
+  va_list args;
+  va_start(args, s);
+
+  for (u_int32 i = 0; s[i] != '\0'; i++) {
+    if (s[i] != '%') {
+      printf_char(s[i]);
+      continue;
+    }
+
+    i++;
+    switch (s[i]) {
+    case 'd': {  /* Decimal (signed) */
+      s_int32 n = va_arg(args, s_int32);
+      if (n < 0) {
+        printf_char('-');
+        printf_number(-(u_int32)n, 10);
+      } else {
+        printf_number(n, 10);
+      }
+      break;
+    }
+    case 'u':  /* Decimal (unsigned) */
+      printf_number(va_arg(args, u_int32), 10);
+      break;
+    case 'x':  /* Hexadecimal */
+      printf_char('0');
+      printf_char('x');
+      printf_number(va_arg(args, u_int32), 16);
+      break;
+    case 'h':  /* Hexadecimal (without "0x") */
+      printf_number(va_arg(args, u_int32), 16);
+      break;
+    case 'c':  /* Character */
+      printf_char(va_arg(args, int));
+      break;
+    case 's': {  /* String */
+      string str = va_arg(args, string);
+      for (u_int32 j = 0; str[j] != '\0'; j++) {
+        printf_char(str[j]);
+      }
+      break;
+    }
+    case 'f':  /* Foreground color */
+    case 'b':  /* Background color */
+      printf_reserve(3);
+      printf_char(CONSOLE_ESCAPE);
+      printf_char(s[i]);
+      printf_char(va_arg(args, int));
+      break;
+    case '%':
+      printf_char('%');
+      break;
+    default:  /* Invalid format string, the rest is ignored */
+      va_end(args);
+      printf_flush();
+      return;
+    }
+  }
+
+  va_end(args);
+  printf_flush();
+}
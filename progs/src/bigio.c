@@ -0,0 +1,40 @@
+#include "lib.h"
+
+/** bigio.c:
+ *  Writes a file larger than a block with a single write, reads it back with a
+ *  single read, and prints the time taken by each.
+ */
+
+#define SIZE 0x10000
+
+int main()
+{
+  u_int8 *buf = malloc(SIZE);
+  for (u_int32 i = 0; i < SIZE; i++) {
+    buf[i] = i % 251;
+  }
+
+  fd f = open("bigio", O_CREAT | O_RDWR, PERM_ALL);
+  u_int32 start = uptime();
+  u_int32 written = write(f, buf, 0, SIZE);
+  u_int32 write_time = uptime() - start;
+
+  for (u_int32 i = 0; i < SIZE; i++) {
+    buf[i] = 0;
+  }
+  lseek(f, 0, SEEK_SET);
+  start = uptime();
+  u_int32 read_bytes = read(f, buf, 0, SIZE);
+  u_int32 read_time = uptime() - start;
+  close(f);
+
+  u_int32 errors = 0;
+  for (u_int32 i = 0; i < read_bytes; i++) {
+    errors += buf[i] != i % 251;
+  }
+  printf("Wrote %d bytes in %d ms, read %d bytes in %d ms, %d errors\n",
+         written, write_time, read_bytes, read_time, errors);
+
+  free(buf);
+  return 0;
+}
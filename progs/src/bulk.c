@@ -0,0 +1,60 @@
+#include "lib.h"
+
+/** bulk.c:
+ *  Streams bytes from a producer to a consumer process through a bulk channel,
+ *  and prints the throughput seen by the consumer.
+ */
+
+#define TOTAL 1048576  /* Bytes to stream */
+#define CHUNK 1024     /* Bytes per send */
+
+u_int8 buffer[CHUNK];
+
+int main()
+{
+  u_int32 pid;
+  s_int32 chan = new_bulk();
+  if (chan < 0) {
+    printf("No bulk channel left\n");
+    return 1;
+  }
+
+  u_int32 ret = fork(1, &pid);
+  if (!ret) {
+    printf("Fork failed\n");
+    return 1;
+  }
+
+  if (ret == 1) {
+    /* Producer: the channel is closed when it exits */
+    for (u_int32 i = 0; i < CHUNK; i++) {
+      buffer[i] = i;
+    }
+    for (u_int32 sent = 0; sent < TOTAL; ) {
+      u_int32 done = bulk_send(chan, buffer + sent % CHUNK, CHUNK - sent % CHUNK);
+      if (!done) {
+        break;
+      }
+      sent += done;
+    }
+    return 0;
+  }
+
+  /* Consumer */
+  u_int32 start = uptime();
+  u_int32 received = 0, sum = 0, done;
+  while ((done = bulk_receive(chan, buffer, CHUNK))) {
+    for (u_int32 i = 0; i < done; i++) {
+      sum += buffer[i];
+    }
+    received += done;
+  }
+  u_int32 elapsed = uptime() - start;
+  if (!elapsed) {
+    elapsed = 1;
+  }
+
+  printf("Received %d bytes (checksum %d) in %d ms: %d KiB/s\n", received, sum,
+         elapsed, received / elapsed * 1000 / 1024);
+  return 0;
+}
@@ -0,0 +1,31 @@
+#include "lib.h"
+
+/** exec.c:
+ *  Prints its arguments, then replaces itself by exec with one more argument,
+ *  three times. The process keeps its pid all along.
+ */
+
+int main(int argc, string *argv)
+{
+  printf("%s (%d args):", argv[0], argc);
+  for (int i = 1; i < argc; i++) {
+    printf(" %s", argv[i]);
+  }
+  printf("\n");
+
+  if (argc > 3) {
+    return 0;
+  }
+
+  string counts[3] = { "one", "two", "three" };
+  string next[5];
+  for (int i = 0; i < argc; i++) {
+    next[i] = argv[i];
+  }
+  next[argc]     = counts[argc - 1];
+  next[argc + 1] = NULL;
+
+  exec("exec", next);
+  printf("exec failed\n");
+  return 1;
+}
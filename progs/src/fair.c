@@ -0,0 +1,32 @@
+#include "lib.h"
+
+/** fair.c:
+ *  Forks CPU-bound children in the Fair class, with different weights, and
+ *  prints how much work each one could do in the same amount of time.
+ */
+
+#define NB_CHILDREN 2  /* Run-launched programs have a priority of 1 */
+#define DURATION    2000  /* In ms */
+
+int main()
+{
+  u_int32 pid;
+
+  for (u_int32 i = 0; i < NB_CHILDREN; i++) {
+    u_int32 prio = i;  /* The weight of a fair process is its priority + 1 */
+    if (fork(prio | SCHED_FAIR, &pid) == 2) {
+      u_int32 end = uptime() + DURATION;
+      u_int32 loops = 0;
+      while (uptime() < end) {
+        loops++;
+      }
+      printf("Weight %d: %d loops\n", prio + 1, loops);
+      exit(0);
+    }
+  }
+
+  u_int32 return_value;
+  while (scwait(&pid, &return_value));
+
+  return 0;
+}
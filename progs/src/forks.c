@@ -0,0 +1,37 @@
+#include "lib.h"
+
+/** forks.c:
+ *  Keeps more children alive at once than the initial process table holds
+ *  (NUM_PROCESSES), then waits for all of them, and prints the time taken by
+ *  the forks and by the waits.
+ */
+
+#define NB_CHILDREN 200
+
+int main()
+{
+  u_int32 pid, return_value;
+  u_int32 start = uptime();
+
+  u_int32 forked = 0;
+  for (; forked < NB_CHILDREN; forked++) {
+    u_int32 ret = fork(1, &pid);  /* Run-launched programs have a priority of 1 */
+    if (!ret) {
+      printf("Fork %d failed\n", forked);
+      break;
+    }
+    if (ret == 2) {
+      sleep(1000);  /* Alive until every child is forked */
+      exit(0);
+    }
+  }
+  u_int32 fork_time = uptime() - start;
+
+  for (u_int32 i = 0; i < forked; i++) {
+    scwait(&pid, &return_value);
+  }
+  u_int32 wait_time = uptime() - start - fork_time;
+
+  printf("%d children: forked in %d ms, waited in %d ms\n", forked, fork_time, wait_time);
+  return 0;
+}
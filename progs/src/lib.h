@@ -51,6 +51,40 @@ typedef struct stats {
 
 typedef u_int32* fd;
 
+#define IOV_MAX 64  /* Maximal number of buffers of readv and writev */
+
+/* A buffer of readv and writev */
+typedef struct iovec {
+  u_int8* base;
+  u_int32 length;
+} iovec_t;
+
+/* The pipe ends given by the shell to the stages of a pipeline ("a | b").
+ * printf also writes to STDOUT when it is set. */
+#define STDIN  ((fd) 1)
+#define STDOUT ((fd) 2)
+
+
+/* Processor usage of a process */
+typedef struct proc_stats {
+  u_int32 run_time;        /* Time spent running, in ms */
+  u_int32 wait_time;       /* Time spent Runnable but not running, in ms */
+  u_int32 switches;        /* Number of times the process was given the processor */
+  u_int32 voluntary;       /* Number of times it gave it back through a syscall */
+  u_int32 involuntary;     /* Number of times it was preempted by the timer */
+} proc_stats_t;
+
+/* Logarithmic histogram of durations, in processor cycles */
+#define HIST_BUCKETS 32
+typedef struct histogram {
+  u_int32 count;
+  u_int32 min, max;
+  u_int32 buckets[HIST_BUCKETS];  /* buckets[i] counts the measures in [2^i, 2^(i+1)[ */
+} histogram_t;
+
+#define HIST_TIMER   0  /* Durations of the timer handler */
+#define HIST_SYSCALL 1  /* Durations of the syscall handler */
+
 typedef unsigned char bool;
 #define FALSE 0
 #define TRUE  1
@@ -59,6 +93,11 @@ typedef unsigned char bool;
 typedef char* string;
 
 
+/* Fork flags, to be or-ed with the priority */
+#define SCHED_FAIR   0x100  /* The child shares the processor fairly, according to its vruntime */
+#define SCHED_STRICT 0x200  /* The child is scheduled by strict priority */
+
+
 void *malloc(u_int32 size);
 
 void free(void *ptr);
@@ -92,6 +131,7 @@ void close(fd f);
  *  @return       - The number of bytes actually read or
  *                  -1: Invalid file descriptor
  *                  -2: File is not opened with the read flag
+ *                  -4: The buffer is not in the memory of the process (pipes)
  */
 u_int32 read(fd f, u_int8* buffer, u_int32 offset, u_int32 length);
 
@@ -107,9 +147,70 @@ u_int32 read(fd f, u_int8* buffer, u_int32 offset, u_int32 length);
  *                  -1: Invalid file descriptor
  *                  -2: File is not opened with the written flag
  *                  -3: The block allocation failed
+ *                  -4: The buffer is not in the memory of the process (pipes)
  */
 u_int32 write(fd f, u_int8* buffer, u_int32 offset, u_int32 length);
 
+/**
+ *  @name readv   - Reads from a file into several buffers, in order
+ *
+ *  @param f      - The file descriptor, which must not be a pipe end
+ *  @param iov    - The buffers
+ *  @param count  - Their number, at most IOV_MAX
+ *
+ *  @return       - The number of bytes actually read, less than the total
+ *                  length at the end of the file
+ */
+u_int32 readv(fd f, iovec_t* iov, u_int32 count);
+
+/**
+ *  @name writev  - Writes several buffers to a file, in order
+ *
+ *  @param f      - The file descriptor, which must not be a pipe end
+ *  @param iov    - The buffers
+ *  @param count  - Their number, at most IOV_MAX
+ *
+ *  @return       - The number of bytes actually written
+ */
+u_int32 writev(fd f, iovec_t* iov, u_int32 count);
+
+/**
+ *  @name pread   - Reads from a file at a given position, without moving the
+ *  position of the file descriptor
+ *
+ *  @param f      - The file descriptor, which must not be a pipe end
+ *  @param buffer - The output buffer
+ *  @param length - The number of bytes to read
+ *  @param pos    - The position in the file
+ *
+ *  @return       - The number of bytes actually read
+ */
+u_int32 pread(fd f, u_int8* buffer, u_int32 length, u_int32 pos);
+
+/**
+ *  @name pwrite  - Writes to a file at a given position, without moving the
+ *  position of the file descriptor
+ *
+ *  @param f      - The file descriptor, which must not be a pipe end
+ *  @param buffer - The input buffer
+ *  @param length - The number of bytes to write
+ *  @param pos    - The position in the file, at most its size
+ *
+ *  @return       - The number of bytes actually written
+ */
+u_int32 pwrite(fd f, u_int8* buffer, u_int32 length, u_int32 pos);
+
+/**
+ *  @name pipe       - Creates a pipe
+ *  Reading an empty pipe blocks until bytes are written, and returns 0 once no
+ *  write end is open. Writing a full pipe blocks until bytes are read, and
+ *  returns 0 once no read end is open. Both may transfer less than length.
+ *  @param read_end  - Will contain the file descriptor of the read end
+ *  @param write_end - Will contain the file descriptor of the write end
+ *  @return bool     - 0 if no pipe is left
+ */
+bool pipe(fd *read_end, fd *write_end);
+
 /**
  *  @name lseek   - Set the current position for a file descriptor
  *
@@ -130,7 +231,8 @@ void fstat(fd f, stats* s);
 
 /**
  *  @name fork - Creates a new process with a new, copied context
- *  @param priority    - The priority to give to the child process
+ *  @param priority    - The priority to give to the child process, possibly
+ *                       or-ed with SCHED_FAIR or SCHED_STRICT (default: same class as the parent)
  *  @param pid         - A pointer toward an integer that will be set with a process id
  *  @return u_int32    - 0 if the fork failed (pid has not been modified)
  *                       1 for the parent process, pid contains the id of the child process
@@ -138,6 +240,31 @@ void fstat(fd f, stats* s);
  */
 u_int32 fork(u_int32 priority, u_int32 *pid);
 
+/**
+ *  @name exec - Replaces the program of the process, which keeps its pid,
+ *  children, channels and pipe ends
+ *  @param name     - The name of the program, /progs/name.elf being loaded
+ *  @param argv     - The arguments given to its main, as a NULL-terminated
+ *                    array of at most 32 strings taking at most 1024 bytes,
+ *                    or NULL to only give it its name
+ *  @return u_int32 - 0 if the program does not exist or is not a valid
+ *                    executable, or if the arguments are invalid, otherwise
+ *                    the call does not return
+ */
+u_int32 exec(string name, string *argv);
+
+/**
+ *  @name spawn - Creates a child process running a program, with a fresh
+ *  address space rather than a copy of the current one
+ *  @param name     - The name of the program, as for exec
+ *  @param argv     - Its arguments, as for exec
+ *  @param priority - The priority to give to the child process, as for fork
+ *  @param pid      - A pointer toward an integer that will be set with the
+ *                    pid of the child process
+ *  @return bool    - 0 if the spawn failed (pid has not been modified)
+ */
+bool spawn(string name, string *argv, u_int32 priority, u_int32 *pid);
+
 /**
  *  @name exit  - Terminates the process
  *  The child of the process have their parent replaced by the init process, while
@@ -157,9 +284,236 @@ void exit(u_int32 return_value);
 bool scwait(u_int32 *pid, u_int32 *return_value);
 
 
+/**
+ *  @name new_channel - Creates a synchronous channel, closed when the process exits
+ *  @return s_int32   - The channel, or -1 if no channel is left
+ */
+s_int32 new_channel();
+
+/**
+ *  @name send   - Sends a value on a channel, and blocks until it is received
+ *  @param chan  - The channel
+ *  @param value - The value
+ *  @return bool - 0 if the channel is closed or somebody is already sending on it
+ *                 1 once the value has been received
+ */
+bool send(s_int32 chan, u_int32 value);
+
+/**
+ *  @name receive   - Blocks until a value is sent on one of the given channels
+ *  @param chans    - The channels
+ *  @param nb_chans - The number of channels (at most 4)
+ *  @param chan     - Will contain the channel the value was received on
+ *  @param value    - Will contain the value
+ *  @return bool    - 0 if none of the channels is open (chan and value won't be modified)
+ *                    1 if a value was received
+ */
+bool receive(s_int32 *chans, u_int32 nb_chans, s_int32 *chan, u_int32 *value);
+
+
+/* In the output of console_write, introduces a color change: followed by 'f'
+ * (resp. 'b') and a color, sets the foreground (resp. background) color */
+#define CONSOLE_ESCAPE 0x1B
+
+/**
+ *  @name console_write - Writes characters to the screen, or to STDOUT when it
+ *  is set, in which case the color escapes are dropped
+ *  @param chars        - The characters
+ *  @param length       - Their number, of which at most 2048 are taken
+ *  @return u_int32     - The number of characters taken, 0 if STDOUT has no reader
+ */
+u_int32 console_write(string chars, u_int32 length);
+
+/**
+ *  @name printf - Writes a formatted string through console_write
+ *  The string is formatted in a buffer of the process, and written with a
+ *  single syscall unless it does not fit.
+ *  - %d: a signed integer
+ *  - %u: an unsigned integer
+ *  - %x: an unsigned integer, in hex
+ *  - %h: same as %x, but without the "0x"
+ *  - %c: a char
+ *  - %s: a string
+ *  - %f: sets the foreground color (given as an int)
+ *  - %b: sets the background color (given as an int)
+ *  - %%: a '%'
+ *  @param s - The format string, followed by its arguments
+ */
 void printf(string s, ...);
 
+/**
+ *  @name syscall_init - Makes the syscalls enter the kernel through sysenter
+ *  if the kernel supports it, rather than int 0x80 (called before main)
+ *  @return bool       - Whether sysenter is used
+ */
+bool syscall_init();
+
+/**
+ *  @name null_syscall - Makes the cheapest syscall (uptime)
+ *  @param fast        - Whether to go through the entry selected by syscall_init,
+ *                       rather than int 0x80
+ *  @return u_int32    - The result of uptime
+ */
+u_int32 null_syscall(bool fast);
+
 void hlt();
 
+/**
+ *  @name sleep - Suspends the process without using the processor
+ *  @param ms   - The sleeping time, in milliseconds (0 only yields the processor)
+ *  @return void
+ */
+void sleep(u_int32 ms);
+
+/**
+ *  @name uptime   - Returns the time elapsed since boot
+ *  @return u_int32 - The number of milliseconds since boot
+ */
+u_int32 uptime();
+
+
+/**
+ *  @name pstat - Gets the processor usage of a process
+ *  @param pid   - The process id
+ *  @param stats - The structure to fill
+ *  @return bool - FALSE if there is no such process
+ */
+bool pstat(u_int32 pid, proc_stats_t *stats);
+
+/**
+ *  @name hstat  - Gets a histogram of the kernel handler durations
+ *  @param which - HIST_TIMER or HIST_SYSCALL
+ *  @param h     - The histogram to fill
+ *  @return bool - FALSE if which is invalid
+ */
+bool hstat(u_int32 which, histogram_t *h);
+
+
+/**
+ *  @name new_bulk  - Creates a bulk channel, closed when the process exits
+ *  Bytes sent on it go through a ring buffer of 4096 bytes in the kernel.
+ *  @return s_int32 - The channel, or -1 if no bulk channel is left
+ */
+s_int32 new_bulk();
+
+/**
+ *  @name bulk_send   - Sends bytes on a bulk channel, blocking while its buffer is full
+ *  @param chan       - The channel
+ *  @param buffer     - The bytes
+ *  @param length     - Their number
+ *  @return u_int32   - The number of bytes sent, possibly less than length,
+ *                      0 if the channel is not open, -4 if buffer is not in
+ *                      the memory of the process
+ */
+u_int32 bulk_send(s_int32 chan, void *buffer, u_int32 length);
+
+/**
+ *  @name bulk_receive - Receives bytes from a bulk channel, blocking while its buffer is empty
+ *  @param chan        - The channel
+ *  @param buffer      - Where to put the bytes
+ *  @param length      - The size of buffer
+ *  @return u_int32    - The number of bytes received, 0 once the channel is
+ *                       closed and every byte was received, -4 if buffer is
+ *                       not in the memory of the process
+ */
+u_int32 bulk_receive(s_int32 chan, void *buffer, u_int32 length);
+
+
+/* Syscall ring: syscalls queued with ring_queue are performed in a batch by
+ * ring_enter, or by the kernel when it preempts the process, and their results
+ * are reaped with ring_reap. */
+#define SYS_RING_ENTRIES 32
+#define SYS_RING_INVALID ((u_int32)-1)  /* Result of a syscall which cannot be queued */
+
+/* The syscalls which can be queued, with their registers ebx, ecx, edx, edi
+ * being the params of the functions above */
+#define SYS_MALLOC   4
+#define SYS_FREE     5
+#define SYS_OPEN    15
+#define SYS_CLOSE   16
+#define SYS_READ    17
+#define SYS_WRITE   18
+#define SYS_LSEEK   19
+#define SYS_FSTAT   20
+#define SYS_UPTIME  22
+#define SYS_PSTAT   23
+#define SYS_READV   32
+#define SYS_WRITEV  33
+#define SYS_PREAD   34
+#define SYS_PWRITE  35
+
+typedef struct sys_ring_sqe {
+  u_int32 op;
+  u_int32 ebx, ecx, edx, edi;
+  u_int32 user_data;  /* Copied in the completion */
+} sys_ring_sqe_t;
+
+typedef struct sys_ring_cqe {
+  u_int32 user_data;
+  u_int32 result;     /* What the syscall returns */
+} sys_ring_cqe_t;
+
+typedef struct sys_ring {
+  u_int32 sq_head, sq_tail, cq_head, cq_tail;
+  sys_ring_sqe_t sq[SYS_RING_ENTRIES];
+  sys_ring_cqe_t cq[SYS_RING_ENTRIES];
+} sys_ring_t;
+
+/**
+ *  @name ring_setup - Registers the syscall ring of the process, whose fields must be zeroed
+ *  @param ring      - The ring, or NULL to stop using it
+ *  @return void
+ */
+void ring_setup(sys_ring_t *ring);
+
+/**
+ *  @name ring_enter - Performs the queued syscalls, until the completion queue is full
+ *  Blocks if one of them does (reading an empty pipe for instance).
+ *  @return u_int32  - The number of syscalls performed
+ */
+u_int32 ring_enter();
+
+/**
+ *  @name ring_queue - Queues a syscall in the ring
+ *  @param ring      - The ring
+ *  @param op        - The syscall, one of the SYS_* above
+ *  @param ebx, ecx, edx, edi - Its params
+ *  @param user_data - Given back with the result
+ *  @return bool     - 0 if the submission queue is full
+ */
+static inline bool ring_queue(sys_ring_t *ring, u_int32 op, u_int32 ebx, u_int32 ecx,
+                              u_int32 edx, u_int32 edi, u_int32 user_data)
+{
+  volatile sys_ring_t *r = ring;  /* Also read and written by the kernel */
+  if (r->sq_tail - r->sq_head == SYS_RING_ENTRIES) {
+    return 0;
+  }
+  volatile sys_ring_sqe_t *sqe = &r->sq[r->sq_tail % SYS_RING_ENTRIES];
+  sqe->op  = op;
+  sqe->ebx = ebx;
+  sqe->ecx = ecx;
+  sqe->edx = edx;
+  sqe->edi = edi;
+  sqe->user_data = user_data;
+  r->sq_tail++;  /* Only once the entry is written */
+  return 1;
+}
+
+/**
+ *  @name ring_reap - Takes the oldest completion of the ring
+ *  @param ring     - The ring
+ *  @param cqe      - Will contain the completion
+ *  @return bool    - 0 if there is none
+ */
+static inline bool ring_reap(sys_ring_t *ring, sys_ring_cqe_t *cqe)
+{
+  volatile sys_ring_t *r = ring;
+  if (r->cq_head == r->cq_tail) {
+    return 0;
+  }
+  *cqe = *(sys_ring_cqe_t *)&r->cq[r->cq_head % SYS_RING_ENTRIES];
+  r->cq_head++;
+  return 1;
+}
 
 #endif
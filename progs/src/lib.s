@@ -1,9 +1,56 @@
+; Every syscall goes through SYSCALL, which calls the entry stub selected by
+; syscall_init: sysenter when the kernel supports it, int 0x80 otherwise. Both
+; take and return the same registers.
+
+%macro SYSCALL 0
+  call [syscall_entry]
+%endmacro
+
+section .data
+syscall_entry: dd int_syscall
+
+section .text
+
+int_syscall:
+  int 0x80
+  ret
+
+; The kernel returns to .return, or through iret to the sysenter to restart a
+; blocked syscall. It leaves the results of ecx and edx where they are popped.
+sysenter_syscall:
+  push ecx
+  push edx
+  mov ecx, esp
+  mov edx, .return
+  sysenter
+.return:
+  pop edx
+  pop ecx
+  ret
+
+global syscall_init
+syscall_init:
+  mov eax, 31
+  int 0x80
+  test eax, eax
+  jz .done
+  mov dword [syscall_entry], sysenter_syscall
+.done:
+  ret
+
+global null_syscall
+null_syscall:
+  mov eax, 22                   ; uptime, the cheapest syscall
+  cmp dword [esp+4], 0
+  je int_syscall
+  jmp [syscall_entry]
+
 global exit
 exit:
   push ebx
   mov eax, 0
   mov ebx, [esp+8]
-  int 0x80
+  SYSCALL
   pop ebx
   ret
 
@@ -13,20 +60,54 @@ fork:
   push edi
   mov eax, 1
   mov ebx, [esp+12]
-  int 0x80
+  SYSCALL
   mov edi, [esp+16]
   mov [edi], ebx
   pop edi
   pop ebx
   ret
 
+global exec
+exec:
+  push ebx
+  push ecx
+  mov eax, 36
+  mov ebx, [esp+12]
+  mov ecx, [esp+16]
+  SYSCALL                       ; Only returns on failure
+  pop ecx
+  pop ebx
+  ret
+
+global spawn
+spawn:
+  push ebx
+  push ecx
+  push edx
+  push edi
+  mov eax, 37
+  mov ebx, [esp+20]
+  mov ecx, [esp+24]
+  mov edx, [esp+28]
+  SYSCALL
+  test eax, eax
+  jz .failed
+  mov edi, [esp+32]
+  mov [edi], ebx
+.failed:
+  pop edi
+  pop edx
+  pop ecx
+  pop ebx
+  ret
+
 global scwait
 scwait:
   push ebx
   push ecx
   push edi
   mov eax, 2
-  int 0x80
+  SYSCALL
   mov edi, [esp+16]
   mov [edi], ebx
   mov edi, [esp+20]
@@ -41,7 +122,7 @@ malloc:
   push ebx
   mov eax, 4
   mov ebx, [esp+8]
-  int 0x80
+  SYSCALL
   pop ebx
   ret
 
@@ -50,14 +131,53 @@ free:
   push ebx
   mov eax, 5
   mov ebx, [esp+8]
-  int 0x80
+  SYSCALL
   pop ebx
   ret
 
 global hlt
 hlt:
   mov eax, 11
-  int 0x80
+  SYSCALL
+  ret
+
+global new_channel
+new_channel:
+  mov eax, 12
+  SYSCALL
+  ret
+
+global send
+send:
+  push ebx
+  push ecx
+  mov eax, 13
+  mov ebx, [esp+12]
+  mov ecx, [esp+16]
+  SYSCALL
+  pop ecx
+  pop ebx
+  ret
+
+global receive
+receive:
+  push ebx
+  push ecx
+  push edi
+  mov eax, 14
+  mov ebx, [esp+16]
+  mov ecx, [esp+20]
+  SYSCALL
+  test eax, eax
+  jz .failed
+  mov edi, [esp+24]
+  mov [edi], ebx
+  mov edi, [esp+28]
+  mov [edi], ecx
+.failed:
+  pop edi
+  pop ecx
+  pop ebx
   ret
 
 global open
@@ -71,7 +191,7 @@ open:
   and ecx, 0xff
   mov edx, [esp+24]
   and edx, 0xffff
-  int 0x80
+  SYSCALL
   pop edx
   pop ecx
   pop ebx
@@ -82,7 +202,7 @@ close:
   push ebx
   mov eax, 16
   mov ebx, [esp+8]
-  int 0x80
+  SYSCALL
   pop ebx
   ret
 
@@ -97,7 +217,7 @@ read:
   mov ecx, [esp+24]
   mov edx, [esp+28]
   mov edi, [esp+32]
-  int 0x80
+  SYSCALL
   pop edi
   pop edx
   pop ecx
@@ -115,26 +235,23 @@ write:
   mov ecx, [esp+24]
   mov edx, [esp+28]
   mov edi, [esp+32]
-  int 0x80
+  SYSCALL
   pop edi
   pop edx
   pop ecx
   pop ebx
   ret
 
-global printf
-printf:
-  push   ebp
-  mov    ebp, esp
-  push   ebx
-  mov    eax, [esp]
-  add    eax, 0x1e36
-  mov    edx, [ebp+8]
-  mov    eax, 0x3
-  mov    ebx, edx
-  int    0x80
-  pop    ebx
-  pop    ebp
+global console_write
+console_write:
+  push ebx
+  push ecx
+  mov eax, 3
+  mov ebx, [esp+12]
+  mov ecx, [esp+16]
+  SYSCALL
+  pop ecx
+  pop ebx
   ret
 
 global lseek
@@ -146,7 +263,7 @@ lseek:
     mov ebx, [esp+16]
     mov ecx, [esp+20]
     mov edx, [esp+24]
-    int 0x80
+    SYSCALL
     pop edx
     pop ecx
     pop ebx
@@ -159,7 +276,182 @@ fstat:
     mov eax, 20
     mov ebx, [esp+12]
     mov ecx, [esp+16]
-    int 0x80
+    SYSCALL
     pop ecx
     pop ebx
     ret
+
+global sleep
+sleep:
+  push ebx
+  mov eax, 21
+  mov ebx, [esp+8]
+  SYSCALL
+  pop ebx
+  ret
+
+global uptime
+uptime:
+  mov eax, 22
+  SYSCALL
+  ret
+
+global pstat
+pstat:
+  push ebx
+  push ecx
+  mov eax, 23
+  mov ebx, [esp+12]
+  mov ecx, [esp+16]
+  SYSCALL
+  pop ecx
+  pop ebx
+  ret
+
+global hstat
+hstat:
+  push ebx
+  push ecx
+  mov eax, 24
+  mov ebx, [esp+12]
+  mov ecx, [esp+16]
+  SYSCALL
+  pop ecx
+  pop ebx
+  ret
+
+global new_bulk
+new_bulk:
+  mov eax, 25
+  SYSCALL
+  ret
+
+global bulk_send
+bulk_send:
+  push ebx
+  push ecx
+  push edx
+  mov eax, 26
+  mov ebx, [esp+16]
+  mov ecx, [esp+20]
+  mov edx, [esp+24]
+  SYSCALL
+  pop edx
+  pop ecx
+  pop ebx
+  ret
+
+global bulk_receive
+bulk_receive:
+  push ebx
+  push ecx
+  push edx
+  mov eax, 27
+  mov ebx, [esp+16]
+  mov ecx, [esp+20]
+  mov edx, [esp+24]
+  SYSCALL
+  pop edx
+  pop ecx
+  pop ebx
+  ret
+
+global pipe
+pipe:
+  push ebx
+  push ecx
+  push edi
+  mov eax, 28
+  SYSCALL
+  test eax, eax
+  jz .failed
+  mov edi, [esp+16]
+  mov [edi], ebx
+  mov edi, [esp+20]
+  mov [edi], ecx
+.failed:
+  pop edi
+  pop ecx
+  pop ebx
+  ret
+
+global ring_setup
+ring_setup:
+  push ebx
+  mov eax, 29
+  mov ebx, [esp+8]
+  SYSCALL
+  pop ebx
+  ret
+
+global ring_enter
+ring_enter:
+  mov eax, 30
+  SYSCALL
+  ret
+
+global readv
+readv:
+  push ebx
+  push ecx
+  push edx
+  mov eax, 32
+  mov ebx, [esp+16]
+  mov ecx, [esp+20]
+  mov edx, [esp+24]
+  SYSCALL
+  pop edx
+  pop ecx
+  pop ebx
+  ret
+
+global writev
+writev:
+  push ebx
+  push ecx
+  push edx
+  mov eax, 33
+  mov ebx, [esp+16]
+  mov ecx, [esp+20]
+  mov edx, [esp+24]
+  SYSCALL
+  pop edx
+  pop ecx
+  pop ebx
+  ret
+
+global pread
+pread:
+  push ebx
+  push ecx
+  push edx
+  push edi
+  mov eax, 34
+  mov ebx, [esp+20]
+  mov ecx, [esp+24]
+  mov edx, [esp+28]
+  mov edi, [esp+32]
+  SYSCALL
+  pop edi
+  pop edx
+  pop ecx
+  pop ebx
+  ret
+
+global pwrite
+pwrite:
+  push ebx
+  push ecx
+  push edx
+  push edi
+  mov eax, 35
+  mov ebx, [esp+20]
+  mov ecx, [esp+24]
+  mov edx, [esp+28]
+  mov edi, [esp+32]
+  SYSCALL
+  pop edi
+  pop edx
+  pop ecx
+  pop ebx
+  ret
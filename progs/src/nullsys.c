@@ -0,0 +1,31 @@
+#include "lib.h"
+
+/** nullsys.c:
+ *  Makes the cheapest syscall many times through int 0x80, then through
+ *  sysenter, and prints the time taken by both entry paths.
+ */
+
+#define NB_CALLS 100000
+
+int main()
+{
+  if (!syscall_init()) {
+    printf("sysenter is not supported, only int 0x80 is used\n");
+  }
+
+  u_int32 start = uptime();
+  for (u_int32 i = 0; i < NB_CALLS; i++) {
+    null_syscall(0);
+  }
+  u_int32 slow = uptime() - start;
+
+  start = uptime();
+  for (u_int32 i = 0; i < NB_CALLS; i++) {
+    null_syscall(1);
+  }
+  u_int32 fast = uptime() - start;
+
+  printf("%d null syscalls: %d ms through int 0x80, %d ms through sysenter\n",
+         NB_CALLS, slow, fast);
+  return 0;
+}
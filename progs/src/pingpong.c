@@ -0,0 +1,50 @@
+#include "lib.h"
+
+/** pingpong.c:
+ *  Bounces a value between two processes through two channels, and prints the
+ *  number of round trips per second.
+ */
+
+#define ROUND_TRIPS 10000
+
+int main()
+{
+  u_int32 pid;
+  s_int32 ping = new_channel();
+  s_int32 pong = new_channel();
+  if (ping < 0 || pong < 0) {
+    printf("No channel left\n");
+    return 1;
+  }
+
+  s_int32 chan;
+  u_int32 value = 0;
+  u_int32 ret = fork(1, &pid);  /* Same priority, so that every send hands off */
+  if (!ret) {
+    printf("Fork failed\n");
+    return 1;
+  }
+  if (ret == 2) {
+    /* Echoes the values until the parent exits and closes the channels */
+    while (receive(&ping, 1, &chan, &value) && send(pong, value + 1));
+    exit(0);
+  }
+
+  u_int32 start = uptime();
+  for (u_int32 i = 0; i < ROUND_TRIPS; i++) {
+    send(ping, value);
+    receive(&pong, 1, &chan, &value);
+  }
+  u_int32 elapsed = uptime() - start;
+
+  if (value != ROUND_TRIPS) {
+    printf("Got %d instead of %d\n", value, ROUND_TRIPS);
+  }
+  if (!elapsed) {
+    elapsed = 1;
+  }
+  printf("%d round trips in %d ms: %d per second\n", ROUND_TRIPS, elapsed,
+         ROUND_TRIPS * 1000 / elapsed);
+
+  return 0;  /* Exiting closes the channels, which ends the child */
+}
@@ -0,0 +1,46 @@
+#include "lib.h"
+
+/** ring.c:
+ *  Allocates and frees memory blocks with one syscall each, then in batches
+ *  queued in a syscall ring, and prints the time taken by both.
+ */
+
+#define NB_BLOCKS 4096
+#define BATCH     (SYS_RING_ENTRIES / 2)  /* The completions of a batch must fit */
+
+sys_ring_t ring;  /* Zeroed, as a global */
+void *blocks[BATCH];
+
+int main()
+{
+  u_int32 start = uptime();
+  for (u_int32 i = 0; i < NB_BLOCKS; i++) {
+    free(malloc(16));
+  }
+  u_int32 direct = uptime() - start;
+
+  ring_setup(&ring);
+  start = uptime();
+  sys_ring_cqe_t cqe;
+  for (u_int32 i = 0; i < NB_BLOCKS; i += BATCH) {
+    for (u_int32 j = 0; j < BATCH; j++) {
+      ring_queue(&ring, SYS_MALLOC, 16, 0, 0, 0, j);
+    }
+    ring_enter();
+    while (ring_reap(&ring, &cqe)) {
+      blocks[cqe.user_data] = (void *)cqe.result;
+    }
+
+    for (u_int32 j = 0; j < BATCH; j++) {
+      ring_queue(&ring, SYS_FREE, (u_int32)blocks[j], 0, 0, 0, j);
+    }
+    ring_enter();
+    while (ring_reap(&ring, &cqe));
+  }
+  u_int32 batched = uptime() - start;
+  ring_setup(NULL);
+
+  printf("%d malloc/free pairs: %d ms with int 0x80 each, %d ms in batches of %d\n",
+         NB_BLOCKS, direct, batched, BATCH);
+  return 0;
+}
@@ -0,0 +1,44 @@
+#include "lib.h"
+
+/** scale.c:
+ *  Forks 1, 2, then 4 CPU-bound children, each doing the same amount of work,
+ *  and prints the throughput. It grows with the number of processors (see
+ *  GUEST_CPUS in the Makefile), as the idle ones steal the children.
+ */
+
+#define MAX_CHILDREN 4
+#define WORK 50000000  /* Loop iterations of each child */
+
+int main()
+{
+  for (u_int32 nb_children = 1; nb_children <= MAX_CHILDREN; nb_children *= 2) {
+    u_int32 pid;
+    u_int32 start = uptime();
+
+    for (u_int32 i = 0; i < nb_children; i++) {
+      u_int32 ret = fork(1, &pid);  /* Run-launched programs have a priority of 1 */
+      if (!ret) {
+        printf("The fork failed\n");
+        return 1;
+      }
+      if (ret == 2) {
+        for (volatile u_int32 loops = 0; loops < WORK; loops++);
+        exit(0);
+      }
+    }
+
+    u_int32 return_value;
+    for (u_int32 i = 0; i < nb_children; i++) {
+      scwait(&pid, &return_value);
+    }
+
+    u_int32 elapsed = uptime() - start;
+    if (!elapsed) {
+      elapsed = 1;
+    }
+    printf("%d children: %d ms, %d loops per ms\n", \
+           nb_children, elapsed, nb_children * WORK / elapsed);
+  }
+
+  return 0;
+}
@@ -0,0 +1,11 @@
+#include "lib.h"
+
+int main()
+{
+  u_int32 start = uptime();
+  for (int i = 0; i < 5; i++) {
+    sleep(500);
+    printf("Woke up after %d ms\n", uptime() - start);
+  }
+  return 0;
+}
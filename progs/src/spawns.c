@@ -0,0 +1,58 @@
+#include "lib.h"
+
+/** spawns.c:
+ *  Starts the empty program in many children, first with fork then exec, then
+ *  with spawn, and prints the time taken by each way.
+ */
+
+#define NB_CHILDREN 100
+
+/**
+ * @name wait_children - Waits for a number of children
+ * @param nb           - The number of children
+ * @return void
+ */
+void wait_children(u_int32 nb)
+{
+  u_int32 pid, return_value;
+  for (u_int32 i = 0; i < nb; i++) {
+    scwait(&pid, &return_value);
+  }
+}
+
+int main()
+{
+  u_int32 pid;
+  string argv[2] = { "empty", NULL };
+
+  u_int32 start = uptime();
+  u_int32 forked = 0;
+  for (; forked < NB_CHILDREN; forked++) {
+    u_int32 ret = fork(1, &pid);  /* Run-launched programs have a priority of 1 */
+    if (!ret) {
+      printf("Fork %d failed\n", forked);
+      break;
+    }
+    if (ret == 2) {
+      exec("empty", argv);
+      exit(1);
+    }
+  }
+  wait_children(forked);
+  u_int32 fork_time = uptime() - start;
+
+  start = uptime();
+  u_int32 spawned = 0;
+  for (; spawned < NB_CHILDREN; spawned++) {
+    if (!spawn("empty", argv, 1, &pid)) {
+      printf("Spawn %d failed\n", spawned);
+      break;
+    }
+  }
+  wait_children(spawned);
+  u_int32 spawn_time = uptime() - start;
+
+  printf("fork+exec: %d children in %d ms, spawn: %d children in %d ms\n",
+         forked, fork_time, spawned, spawn_time);
+  return 0;
+}
@@ -0,0 +1,39 @@
+#include "lib.h"
+
+/** switches.c:
+ *  Benchmark of the context switch: a process and its child, at the same
+ *  priority, keep giving the processor to each other with sleep(0).
+ */
+
+#define NB_YIELDS 10000
+
+int main()
+{
+  u_int32 pid;
+  u_int32 start = uptime();
+
+  u_int32 ret = fork(1, &pid);
+  if (!ret) {
+    printf("The fork failed\n");
+    return 1;
+  }
+
+  for (u_int32 i = 0; i < NB_YIELDS; i++) {
+    sleep(0);
+  }
+
+  if (ret == 2) {
+    exit(0);
+  }
+
+  u_int32 return_value;
+  scwait(&pid, &return_value);
+  u_int32 elapsed = uptime() - start;
+  if (!elapsed) {
+    elapsed = 1;
+  }
+
+  printf("%d switches in %d ms: %d switches per second\n", \
+         2 * NB_YIELDS, elapsed, 2 * NB_YIELDS * 1000 / elapsed);
+  return 0;
+}
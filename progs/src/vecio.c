@@ -0,0 +1,33 @@
+#include "lib.h"
+
+/** vecio.c:
+ *  Writes a header and a body with a single writev, updates the header in place
+ *  with pwrite, then scatters the file back with a single readv.
+ */
+
+int main()
+{
+  u_int8 header[4] = {'v', 'e', 'c', '0'};
+  u_int8 body[12]  = "Hello world";
+  iovec_t iov[2] = { { header, sizeof(header) }, { body, sizeof(body) } };
+
+  fd f = open("vecio", O_CREAT | O_RDWR, PERM_ALL);
+  u_int32 written = writev(f, iov, 2);
+
+  u_int8 version = '1';
+  pwrite(f, &version, 1, 3);
+
+  u_int8 in_header[4];
+  u_int8 in_body[12];
+  iovec_t in[2] = { { in_header, sizeof(in_header) }, { in_body, sizeof(in_body) } };
+  lseek(f, 0, SEEK_SET);
+  u_int32 read_bytes = readv(f, in, 2);
+
+  u_int8 last;
+  pread(f, &last, 1, 14);
+  close(f);
+
+  printf("Wrote %d bytes, read %d bytes: version %c, body %s, last %c\n",
+         written, read_bytes, in_header[3], in_body, last);
+  return 0;
+}
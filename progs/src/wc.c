@@ -0,0 +1,33 @@
+#include "lib.h"
+
+/** wc.c:
+ *  Counts the lines, words and bytes read on its standard input, to be used at
+ *  the end of a pipeline such as "hello_world | wc".
+ */
+
+u_int8 buffer[512];
+
+int main()
+{
+  u_int32 lines = 0, words = 0, bytes = 0, done;
+  bool in_word = 0;
+
+  while ((done = read(STDIN, buffer, 0, sizeof(buffer)))) {
+    for (u_int32 i = 0; i < done; i++) {
+      u_int8 c = buffer[i];
+      if (c == '\n') {
+        lines++;
+      }
+      if (c == ' ' || c == '\n' || c == '\t') {
+        in_word = 0;
+      } else if (!in_word) {
+        in_word = 1;
+        words++;
+      }
+    }
+    bytes += done;
+  }
+
+  printf("%d %d %d\n", lines, words, bytes);
+  return 0;
+}
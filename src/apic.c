@@ -0,0 +1,157 @@
+#include "apic.h"
+#include "paging.h"
+#include "timer.h"
+#include "logging.h"
+#include "io.h"
+
+/* Sources: Intel 82093AA I/O APIC datasheet, Intel SDM vol. 3 (10.5.4),
+ * http://wiki.osdev.org/IOAPIC and http://wiki.osdev.org/APIC_timer */
+
+#define CALIBRATION_MS 10  /* Duration (in ms) of the calibration of the local APIC timer */
+#define TIMER_DIVIDE_16 0x3  /* Divide configuration of the local APIC timer */
+
+/* IOAPIC registers, selected through IOREGSEL and accessed through IOWIN */
+#define IOAPIC_IOREGSEL    0x00
+#define IOAPIC_IOWIN       0x10
+#define IOAPIC_VERSION     0x01  /* Bits 16-23: index of the last redirection entry */
+#define IOAPIC_REDIRECTION 0x10  /* Two registers per entry, low then high */
+
+/* Low part of a redirection entry, fixed delivery to a physical destination */
+#define REDIRECTION_ACTIVE_LOW 0x00002000
+#define REDIRECTION_LEVEL      0x00008000
+#define REDIRECTION_MASKED     0x00010000
+
+
+/**
+ * @name ioapic_read - Reads a register of the IOAPIC
+ * @param reg        - The index of the register
+ * @return u_int32
+ */
+u_int32 ioapic_read(u_int32 reg)
+{
+  *(volatile u_int32 *)(ioapic_base + IOAPIC_IOREGSEL) = reg;
+  return *(volatile u_int32 *)(ioapic_base + IOAPIC_IOWIN);
+}
+
+/**
+ * @name ioapic_write - Writes a register of the IOAPIC
+ * @param reg         - The index of the register
+ * @param value       - The value to write
+ * @return void
+ */
+void ioapic_write(u_int32 reg, u_int32 value)
+{
+  *(volatile u_int32 *)(ioapic_base + IOAPIC_IOREGSEL) = reg;
+  *(volatile u_int32 *)(ioapic_base + IOAPIC_IOWIN) = value;
+}
+
+/**
+ * @name ioapic_route - Delivers an ISA IRQ to a processor, with the vector used by the PIC
+ * @param irq         - The IRQ
+ * @param apic_id     - The identifier of the local APIC of the processor
+ * @param nb_entries  - The number of redirection entries of the IOAPIC
+ * @return bool       - Whether the IRQ is connected to the IOAPIC
+ */
+bool ioapic_route(u_int8 irq, u_int8 apic_id, u_int32 nb_entries)
+{
+  u_int32 entry = irq_gsi[irq] - ioapic_gsi_base;
+  if (irq_gsi[irq] < ioapic_gsi_base || entry >= nb_entries) {
+    return FALSE;
+  }
+
+  u_int32 low = 32 + irq;
+  if ((irq_flags[irq] & IRQ_POLARITY_MASK) == IRQ_ACTIVE_LOW) {
+    low |= REDIRECTION_ACTIVE_LOW;
+  }
+  if ((irq_flags[irq] & IRQ_TRIGGER_MASK) == IRQ_LEVEL) {
+    low |= REDIRECTION_LEVEL;
+  }
+
+  /* The destination first, as writing the low part unmasks the entry */
+  ioapic_write(IOAPIC_REDIRECTION + 2 * entry + 1, apic_id << 24);
+  ioapic_write(IOAPIC_REDIRECTION + 2 * entry, low);
+  return TRUE;
+}
+
+/**
+ * @name ioapic_install - Routes the ISA IRQs through the IOAPIC and masks the PIC
+ * @return bool         - Whether the IOAPIC is used
+ */
+bool ioapic_install()
+{
+  if (!ioapic_base || !map_mmio(kernel_directory, ioapic_base)) {
+    return FALSE;
+  }
+
+  u_int32 nb_entries = ((ioapic_read(IOAPIC_VERSION) >> 16) & 0xFF) + 1;
+  for (u_int32 entry = 0; entry < nb_entries; entry++) {
+    ioapic_write(IOAPIC_REDIRECTION + 2 * entry, REDIRECTION_MASKED);
+  }
+
+  /* IRQ2 is the cascade of the slave PIC, and never fires */
+  for (u_int8 irq = 0; irq < ISA_IRQS; irq++) {
+    if (irq != 2 && !ioapic_route(irq, cpus[0].apic_id, nb_entries)) {
+      kloug(100, "IRQ %d is not connected to the IOAPIC\n", irq);
+    }
+  }
+
+  if (imcr_present) {
+    outb(0x22, 0x70);  /* Selects the IMCR */
+    outb(0x23, 0x01);  /* The interruptions go through the APICs */
+  }
+  outb(0x21, 0xFF);    /* Masks every IRQ of both PICs */
+  outb(0xA1, 0xFF);
+  lapic_write(LAPIC_LINT0, LVT_MASKED);
+
+  return TRUE;
+}
+
+
+/**
+ * @name lapic_timer_calibrate - Measures the frequency of the local APIC timer with the PIT
+ * All the processors share the bus clock, so the result holds for each of them.
+ * @return void
+ */
+void lapic_timer_calibrate()
+{
+  lapic_write(LAPIC_TIMER_DIV, TIMER_DIVIDE_16);
+  lapic_write(LAPIC_TIMER, LVT_MASKED | APIC_TIMER_VECTOR);
+  lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+  timer_delay(CALIBRATION_MS);
+  u_int32 elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURR);
+  lapic_write(LAPIC_TIMER_INIT, 0);
+
+  lapic_ticks_per_ms = elapsed / CALIBRATION_MS;
+}
+
+void lapic_timer_periodic(u_int32 hz)
+{
+  lapic_write(LAPIC_TIMER_DIV, TIMER_DIVIDE_16);
+  lapic_write(LAPIC_TIMER, LVT_PERIODIC | APIC_TIMER_VECTOR);
+  lapic_write(LAPIC_TIMER_INIT, lapic_ticks_per_ms * 1000 / hz);
+  cpus[cpu_id()].lapic_ticking = TRUE;
+}
+
+void lapic_timer_stop()
+{
+  lapic_write(LAPIC_TIMER, LVT_MASKED | APIC_TIMER_VECTOR);
+  lapic_write(LAPIC_TIMER_INIT, 0);
+  cpus[cpu_id()].lapic_ticking = FALSE;
+}
+
+
+void apic_install()
+{
+  if (!apic_present) {
+    kloug(100, "No local APIC, using the PIC and the PIT\n");
+    return;
+  }
+
+  lapic_timer_calibrate();
+  kloug(100, "Local APIC timer: %d ticks per ms\n", lapic_ticks_per_ms);
+
+  ioapic_enabled = ioapic_install();
+  if (!ioapic_enabled) {
+    kloug(100, "No IOAPIC, the IRQs go through the PIC\n");
+  }
+}
@@ -0,0 +1,53 @@
+#ifndef APIC_H
+#define APIC_H
+
+/* apic.h:
+ * Timer of the local APICs, and routing of the ISA IRQs through the IOAPIC.
+ * Without them, the PIT and the 8259 PIC are used as before.
+ */
+
+#include "types.h"
+#include "smp.h"
+
+
+#define ISA_IRQS 16  /* Number of IRQs of the 8259 PIC */
+
+/* Flags of the ISA IRQs, as in the MP and ACPI tables */
+#define IRQ_POLARITY_MASK 0x3
+#define IRQ_ACTIVE_LOW    0x3   /* Otherwise active high, the ISA default */
+#define IRQ_TRIGGER_MASK  0xC
+#define IRQ_LEVEL         0xC   /* Otherwise edge triggered, the ISA default */
+
+u_int32 ioapic_base;             /* Physical address of the IOAPIC registers, 0 if none was found */
+u_int32 ioapic_gsi_base;         /* First global system interruption of the IOAPIC */
+u_int32 irq_gsi[ISA_IRQS];       /* Global system interruption of each ISA IRQ */
+u_int16 irq_flags[ISA_IRQS];     /* Polarity and trigger mode of each ISA IRQ */
+bool    imcr_present;            /* Whether the PIC must be disconnected through the IMCR */
+bool    ioapic_enabled;          /* Whether the IRQs go through the IOAPIC rather than the PIC */
+u_int32 lapic_ticks_per_ms;      /* Calibrated frequency of the local APIC timers, 0 if unused */
+
+
+/**
+ * @name apic_install - Calibrates the local APIC timer against the PIT, and
+ * routes the ISA IRQs to the bootstrap processor through the IOAPIC
+ * Must be called after smp_install, which reads the firmware tables. The PIC is
+ * left masked if the IOAPIC is used.
+ * @return void
+ */
+void apic_install();
+
+/**
+ * @name lapic_timer_periodic - Makes the local APIC timer of the current
+ * processor fire APIC_TIMER_VECTOR periodically
+ * @param hz                  - The frequency of the interruptions
+ * @return void
+ */
+void lapic_timer_periodic(u_int32 hz);
+
+/**
+ * @name lapic_timer_stop - Stops the local APIC timer of the current processor
+ * @return void
+ */
+void lapic_timer_stop();
+
+#endif
@@ -0,0 +1,318 @@
+#include "channel.h"
+#include "scheduler.h"
+#include "paging.h"
+#include "memory.h"
+#include "utils.h"
+
+/* Ported from the model of src/kernel.c, with the receivers kept by priority */
+
+extern scheduler_state_t *state;  /* Defined in scheduler.c */
+
+channel_t channels[NUM_CHANNELS];
+u_int32 receive_count = 0;  /* Arrival order of the receivers */
+
+/* The ring buffers are in the kernel image, hence mapped in every address space */
+bulk_channel_t bulk_channels[NUM_BULK_CHANNELS];
+u_int8 bulk_rings[NUM_BULK_CHANNELS][RING_SIZE];
+
+
+/**
+ * @name receiver_key - Returns the key of a receiver in the receivers heaps
+ * The highest priority comes first, then the first arrived.
+ * @param id          - The receiving process
+ * @return u_int32
+ */
+u_int32 receiver_key(pid id)
+{
+  u_int32 rank = MAX_PRIORITY - PROCESS(id).prio;
+  return (rank << 24) | (receive_count++ & 0xFFFFFF);
+}
+
+/**
+ * @name block_on_channels - Blocks a process on channels, out of the runqueues
+ * @param id               - The process
+ * @param chans            - The channels
+ * @param nb_chans         - The number of channels
+ * @return void
+ */
+void block_on_channels(pid id, chanid *chans, u_int32 nb_chans)
+{
+  process_t *proc = &PROCESS(id);
+  proc->state = Blocked;
+  dequeue_process(id);
+
+  for (u_int32 i = 0; i < nb_chans; i++) {
+    proc->chans[i] = chans[i];
+  }
+  proc->nb_chans = nb_chans;
+}
+
+/**
+ * @name unblock - Makes runnable a process blocked on channels
+ * @param id     - The process
+ * @param ret    - The value of its eax register
+ * @return void
+ */
+void unblock(pid id, u_int32 ret)
+{
+  channel_cancel(id);
+  PROCESS(id).context.regs->eax = ret;
+  make_runnable(id);
+}
+
+
+chanid new_channel(pid owner)
+{
+  for (chanid c = 0; c < NUM_CHANNELS; c++) {
+    channel_t *chan = &channels[c];
+    if (chan->tag == Closed) {
+      chan->tag   = Unused;
+      chan->owner = owner;
+      if (!chan->receivers) {
+        chan->receivers = empty_heap();  /* Kept once the channel is closed */
+      }
+      return c;
+    }
+  }
+
+  return -1;
+}
+
+bool channel_send(pid sender, chanid c, u_int32 value)
+{
+  if (c < 0 || c >= NUM_CHANNELS || channels[c].tag == Closed || channels[c].tag == Sender) {
+    return FALSE;
+  }
+
+  channel_t *chan = &channels[c];
+  if (chan->tag == Receivers) {
+    /* There are processes listening to this channel, we pick the most prioritary one */
+    pid receiver = heap_min(chan->receivers).value;
+    process_t *proc = &PROCESS(receiver);
+    proc->context.regs->ebx = c;
+    proc->context.regs->ecx = value;
+    unblock(receiver, 1);  /* Also removes it from the other channels */
+
+    /* The receiver runs at once, without going through the runqueues */
+    handoff_process(receiver);
+  } else {
+    /* Nobody is currently listening to the channel, so we wait */
+    chan->tag    = Sender;
+    chan->sender = sender;
+    chan->value  = value;
+    block_on_channels(sender, &c, 1);
+  }
+
+  return TRUE;
+}
+
+bool channel_receive(pid receiver, chanid *chans, u_int32 nb_chans)
+{
+  /* The open channels, without duplicates */
+  chanid open[RECV_CHANNELS];
+  u_int32 nb_open = 0;
+  for (u_int32 i = 0; i < nb_chans && i < RECV_CHANNELS; i++) {
+    chanid c = chans[i];
+    bool seen = FALSE;
+    for (u_int32 j = 0; j < nb_open; j++) {
+      seen = seen || open[j] == c;
+    }
+    if (c >= 0 && c < NUM_CHANNELS && channels[c].tag != Closed && !seen) {
+      open[nb_open++] = c;
+    }
+  }
+  if (!nb_open) {
+    return FALSE;
+  }
+
+  /* Search for a channel where somebody is sending something */
+  for (u_int32 i = 0; i < nb_open; i++) {
+    channel_t *chan = &channels[open[i]];
+    if (chan->tag == Sender) {
+      regs_t *regs = PROCESS(receiver).context.regs;
+      regs->eax = 1;
+      regs->ebx = open[i];
+      regs->ecx = chan->value;
+      unblock(chan->sender, 1);  /* Also sets the channel as Unused */
+      return TRUE;
+    }
+  }
+
+  /* No sending channel, we wait on all of them */
+  u_int32 key = receiver_key(receiver);
+  for (u_int32 i = 0; i < nb_open; i++) {
+    channel_t *chan = &channels[open[i]];
+    chan->tag = Receivers;
+    heap_insert(chan->receivers, key, receiver);
+  }
+  block_on_channels(receiver, open, nb_open);
+
+  return TRUE;
+}
+
+void channel_cancel(pid id)
+{
+  process_t *proc = &PROCESS(id);
+
+  for (u_int32 i = 0; i < proc->nb_chans; i++) {
+    channel_t *chan = &channels[proc->chans[i]];
+    if (chan->tag == Sender && chan->sender == id) {
+      chan->tag = Unused;
+    } else if (chan->tag == Receivers) {
+      heap_remove(chan->receivers, id);
+      if (is_empty_heap(chan->receivers)) {
+        chan->tag = Unused;
+      }
+    }
+  }
+  proc->nb_chans = 0;
+}
+
+/**
+ * @name ring_copy - Copies bytes between a ring buffer and the address space of a process
+ * @param id       - The process
+ * @param ring     - The ring buffer
+ * @param pos      - The position in the ring buffer
+ * @param buffer   - The address in the process
+ * @param length   - The number of bytes, at most RING_SIZE
+ * @param to_ring  - Whether the bytes go to the ring buffer
+ * @param kernel   - Whether buffer is in the kernel rather than in the process
+ * @return bool    - Whether the buffer is in the pages of the process
+ */
+bool ring_copy(pid id, ring_t *ring, u_int32 pos, u_int8 *buffer, u_int32 length,
+               bool to_ring, bool kernel)
+{
+  u_int32 first = min(length, RING_SIZE - pos);  /* Before wrapping around */
+  page_directory_t *dir = PROCESS(id).context.page_dir;
+  if (kernel && to_ring) {
+    mem_copy(ring->data + pos, buffer, first);
+    mem_copy(ring->data, buffer + first, length - first);
+    return TRUE;
+  } else if (kernel) {
+    mem_copy(buffer, ring->data + pos, first);
+    mem_copy(buffer + first, ring->data, length - first);
+    return TRUE;
+  } else if (to_ring) {
+    return copy_from_user(dir, ring->data + pos, (u_int32)buffer, first)
+      && copy_from_user(dir, ring->data, (u_int32)buffer + first, length - first);
+  } else {
+    return copy_to_user(dir, (u_int32)buffer, ring->data + pos, first)
+      && copy_to_user(dir, (u_int32)buffer + first, ring->data, length - first);
+  }
+}
+
+s_int32 ring_put(ring_t *ring, pid id, u_int8 *buffer, u_int32 length, bool from_kernel)
+{
+  u_int32 done = min(length, RING_SIZE - ring->count);
+  if (!ring_copy(id, ring, (ring->start + ring->count) % RING_SIZE, buffer, done, TRUE,
+                 from_kernel)) {
+    return RING_FAULT;
+  }
+  ring->count += done;
+  return done;
+}
+
+s_int32 ring_get(ring_t *ring, pid id, u_int8 *buffer, u_int32 length)
+{
+  u_int32 done = min(length, ring->count);
+  if (!ring_copy(id, ring, ring->start, buffer, done, FALSE, FALSE)) {
+    return RING_FAULT;
+  }
+  ring->start = (ring->start + done) % RING_SIZE;
+  ring->count -= done;
+  return done;
+}
+
+
+chanid new_bulk_channel(pid owner)
+{
+  for (chanid c = 0; c < NUM_BULK_CHANNELS; c++) {
+    bulk_channel_t *chan = &bulk_channels[c];
+    if (chan->tag == BulkFree) {
+      chan->tag   = BulkOpen;
+      chan->owner = owner;
+      chan->ring.data  = bulk_rings[c];
+      chan->ring.start = 0;
+      chan->ring.count = 0;
+      chan->senders.first   = chan->senders.last   = NO_PID;
+      chan->receivers.first = chan->receivers.last = NO_PID;
+      return c;
+    }
+  }
+
+  return -1;
+}
+
+s_int32 bulk_send(pid sender, chanid c, u_int8 *buffer, u_int32 length)
+{
+  if (c < 0 || c >= NUM_BULK_CHANNELS || bulk_channels[c].tag != BulkOpen || !length) {
+    return 0;
+  }
+
+  bulk_channel_t *chan = &bulk_channels[c];
+  if (chan->ring.count == RING_SIZE) {
+    block_process(&chan->senders, sender, Blocked);
+    return BULK_BLOCKED;
+  }
+
+  s_int32 done = ring_put(&chan->ring, sender, buffer, length, FALSE);
+  if (done > 0) {
+    wake_up_all(&chan->receivers);
+  }
+  return done;
+}
+
+s_int32 bulk_receive(pid receiver, chanid c, u_int8 *buffer, u_int32 length)
+{
+  if (c < 0 || c >= NUM_BULK_CHANNELS || bulk_channels[c].tag == BulkFree || !length) {
+    return 0;
+  }
+
+  bulk_channel_t *chan = &bulk_channels[c];
+  if (!chan->ring.count) {
+    if (chan->tag == BulkClosed) {
+      chan->tag = BulkFree;  /* Drained, nobody can send anymore */
+      return 0;
+    }
+    block_process(&chan->receivers, receiver, Blocked);
+    return BULK_BLOCKED;
+  }
+
+  s_int32 done = ring_get(&chan->ring, receiver, buffer, length);
+  if (done > 0) {
+    wake_up_all(&chan->senders);
+  }
+  return done;
+}
+
+
+void close_channels(pid owner)
+{
+  for (chanid c = 0; c < NUM_CHANNELS; c++) {
+    channel_t *chan = &channels[c];
+    if (chan->tag == Closed || chan->owner != owner) {
+      continue;
+    }
+
+    /* The blocked processes fail */
+    if (chan->tag == Sender) {
+      unblock(chan->sender, 0);
+    }
+    while (chan->tag == Receivers) {
+      unblock(heap_min(chan->receivers).value, 0);
+    }
+    chan->tag = Closed;
+  }
+
+  for (chanid c = 0; c < NUM_BULK_CHANNELS; c++) {
+    bulk_channel_t *chan = &bulk_channels[c];
+    if (chan->tag != BulkOpen || chan->owner != owner) {
+      continue;
+    }
+
+    /* The senders get 0, the receivers get what is left then 0 */
+    chan->tag = chan->ring.count ? BulkClosed : BulkFree;
+    wake_up_all(&chan->senders);
+    wake_up_all(&chan->receivers);
+  }
+}
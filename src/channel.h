@@ -0,0 +1,172 @@
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+/* channel.h:
+ * Synchronous channels: a value is passed from a sender to a receiver when both
+ * are there, the first one to come being blocked until the other one does.
+ * Bulk channels: bytes are passed through a ring buffer, a sender only blocks
+ * when it is full and a receiver when it is empty.
+ */
+
+#include "types.h"
+#include "heap.h"
+#include "process.h"
+
+
+#define NUM_CHANNELS   128
+
+typedef s_int32 chanid;
+
+typedef enum channel_tag {
+  Closed = 0,  /* Not created, or its owner exited */
+  Unused,      /* Nobody is sending nor receiving */
+  Sender,      /* A process is blocked sending a value */
+  Receivers,   /* Processes are blocked receiving */
+} channel_tag_t;
+
+typedef struct channel {
+  channel_tag_t tag;
+  pid      owner;      /* The process which created the channel */
+
+  pid      sender;     /* In Sender mode, the process blocked sending */
+  u_int32  value;      /* and the value it sends */
+
+  heap_t  *receivers;  /* In Receivers mode, the blocked processes, by decreasing
+                        * priority then arrival order */
+} channel_t;
+
+
+#define RING_SIZE  4096
+#define RING_FAULT (-4)  /* The buffer is not in the pages of the process, distinct
+                          * from the error codes of read and write (see lib.h) */
+
+/* A ring buffer of RING_SIZE bytes, also used by the pipes */
+typedef struct ring {
+  u_int8  *data;   /* In the kernel image, hence mapped in every address space */
+  u_int32  start;  /* Position of the first byte */
+  u_int32  count;  /* Number of bytes */
+} ring_t;
+
+
+#define NUM_BULK_CHANNELS 16
+#define BULK_BLOCKED      (-1)  /* The call must be made again once the process is woken up */
+
+typedef enum bulk_tag {
+  BulkFree = 0,  /* Not created */
+  BulkOpen,
+  BulkClosed,    /* Its owner exited, what is left can still be received */
+} bulk_tag_t;
+
+typedef struct bulk_channel {
+  bulk_tag_t   tag;
+  pid          owner;      /* The process which created the channel */
+  ring_t       ring;
+  wait_queue_t senders;    /* The processes waiting for free space */
+  wait_queue_t receivers;  /* The processes waiting for bytes */
+} bulk_channel_t;
+
+
+/**
+ * @name new_channel - Creates a channel
+ * @param owner      - The process creating it, the channel is closed when it exits
+ * @return chanid    - The channel, or -1 if every one is used
+ */
+chanid new_channel(pid owner);
+
+/**
+ * @name channel_send - Sends a value on a channel
+ * The receiver of highest priority gets the value, and the processor is handed
+ * off to it at once if it does not have a lower priority than the sender.
+ * Without receiver, the sender blocks until a process receives the value.
+ * @param sender      - The sending process
+ * @param chan        - The channel
+ * @param value       - The value
+ * @return bool       - FALSE if the channel is closed or already has a sender
+ */
+bool channel_send(pid sender, chanid chan, u_int32 value);
+
+/**
+ * @name channel_receive - Receives a value from one of the given channels
+ * If a sender is blocked on one of them, its value is returned in the ebx (the
+ * channel) and ecx (the value) registers of the receiver. Otherwise the receiver
+ * blocks on all of them, until a process sends a value on one.
+ * @param receiver       - The receiving process
+ * @param chans          - The channels, the invalid ones being ignored
+ * @param nb_chans       - The number of channels, at most RECV_CHANNELS
+ * @return bool          - FALSE if none of the channels is open
+ */
+bool channel_receive(pid receiver, chanid *chans, u_int32 nb_chans);
+
+/**
+ * @name channel_cancel - Removes a blocked process from the channels, when it is killed
+ * @param id            - The process
+ * @return void
+ */
+void channel_cancel(pid id);
+
+/**
+ * @name ring_put - Copies bytes of a process at the end of a ring buffer
+ * @param ring    - The ring buffer
+ * @param id      - The process, whose address space holds the bytes
+ * @param buffer  - The bytes
+ * @param length  - Their number
+ * @param from_kernel - Whether the bytes are in the kernel rather than in the process
+ * @return s_int32 - The number of bytes copied, as many as fit, or RING_FAULT if
+ *                   buffer is not in the pages of the process
+ */
+s_int32 ring_put(ring_t *ring, pid id, u_int8 *buffer, u_int32 length, bool from_kernel);
+
+/**
+ * @name ring_get - Moves bytes from the start of a ring buffer to a process
+ * @param ring    - The ring buffer
+ * @param id      - The process, whose address space holds the buffer
+ * @param buffer  - Where to copy the bytes
+ * @param length  - The size of buffer
+ * @return s_int32 - The number of bytes copied, or RING_FAULT if buffer is not
+ *                   in the writable pages of the process
+ */
+s_int32 ring_get(ring_t *ring, pid id, u_int8 *buffer, u_int32 length);
+
+/**
+ * @name new_bulk_channel - Creates a bulk channel
+ * @param owner           - The process creating it, the channel is closed when it exits
+ * @return chanid         - The channel, or -1 if every one is used
+ */
+chanid new_bulk_channel(pid owner);
+
+/**
+ * @name bulk_send - Copies bytes of a process into the ring buffer of a bulk channel
+ * Only the bytes that fit are copied. If none fits, the process is blocked on
+ * the channel until a receiver frees some space.
+ * @param sender   - The sending process, whose address space holds the buffer
+ * @param chan     - The channel
+ * @param buffer   - The bytes to send
+ * @param length   - Their number
+ * @return s_int32 - The number of bytes sent (0 if the channel is not open),
+ *                   BULK_BLOCKED or RING_FAULT
+ */
+s_int32 bulk_send(pid sender, chanid chan, u_int8 *buffer, u_int32 length);
+
+/**
+ * @name bulk_receive - Copies bytes out of the ring buffer of a bulk channel
+ * If the buffer is empty, the process is blocked on the channel until a sender
+ * fills it. Once the channel is closed and drained, it is freed.
+ * @param receiver    - The receiving process, whose address space holds the buffer
+ * @param chan        - The channel
+ * @param buffer      - Where to copy the bytes
+ * @param length      - The maximal number of bytes to receive
+ * @return s_int32    - The number of bytes received (0 once the channel is closed
+ *                      and drained), BULK_BLOCKED or RING_FAULT
+ */
+s_int32 bulk_receive(pid receiver, chanid chan, u_int8 *buffer, u_int32 length);
+
+/**
+ * @name close_channels - Closes the channels created by a process, when it exits
+ * The processes blocked on synchronous channels return 0, the bytes left in
+ * bulk channels can still be received.
+ * @param owner         - The process
+ * @return void
+ */
+void close_channels(pid owner);
+
+#endif
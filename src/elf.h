@@ -48,6 +48,11 @@ typedef enum segment_type {
   Note = 4,         /* Note section, ignored here */
 } segment_type_t;
 
+/* The flags of a segment */
+#define SEGMENT_X 0x1  /* Executable */
+#define SEGMENT_W 0x2  /* Writable */
+#define SEGMENT_R 0x4  /* Readable */
+
 
 typedef struct section_header_entry {
   u_int32 section_name;  /* Index in the string table */
@@ -89,13 +94,21 @@ typedef enum section_type {
 
 
 /**
- * @name check_and_load - Checks if the ELF file is valid, and loads everything in memory
- * The current page directory must be the process', to be able to reach the virtual load address
- * @param elf_file      - A pointer towards the ELF file, loaded in memory
- * @param virtuals      - An array of virtual addresses of the pages where to load the code
- * @return              - The entry point address
+ * @name check_elf - Checks if the header of an ELF file is the one of a valid
+ * executable
+ * @param elf_header - The header, at the start of the file
+ * @return bool
+ */
+bool check_elf(elf_header_t *elf_header);
+
+/**
+ * @name program_header_offset - Returns the offset of an entry of the program
+ * header table in the ELF file
+ * @param elf_header           - The header of the file
+ * @param index                - The index of the entry, less than pht_entry_nb
+ * @return u_int32
  */
-u_int32 check_and_load(void *elf_file, u_int32 virtuals[]);
+u_int32 program_header_offset(elf_header_t *elf_header, u_int16 index);
 
 
 
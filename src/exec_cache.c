@@ -0,0 +1,358 @@
+#include "exec_cache.h"
+#include "elf.h"
+#include "filesystem.h"
+#include "malloc.h"
+#include "memory.h"
+#include "utils.h"
+
+exec_image_t exec_cache[EXEC_CACHE_ENTRIES];
+u_int32 exec_clock = 0;  /* Incremented at each load, to find the least recently used image */
+
+
+/**
+ * @name last_page - Returns the address of the last page of a segment
+ * @param segment  - The segment, of non-zero size
+ * @return u_int32
+ */
+u_int32 last_page(exec_segment_t *segment)
+{
+  return (segment->address + segment->mem_size - 1) & 0xFFFFF000;
+}
+
+/**
+ * @name can_share - Whether a segment can be kept in frames shared by the processes
+ * It must be read-only, and no other segment must be on its pages.
+ * @param image    - The image
+ * @param index    - The index of the segment
+ * @return bool
+ */
+bool can_share(exec_image_t *image, u_int32 index)
+{
+  exec_segment_t *segment = &image->segments[index];
+  if (segment->writable) {
+    return FALSE;
+  }
+
+  u_int32 first = segment->address & 0xFFFFF000;
+  u_int32 last  = last_page(segment);
+  for (u_int32 i = 0; i < image->nb_segments; i++) {
+    exec_segment_t *other = &image->segments[i];
+    if (i != index && (other->address & 0xFFFFF000) <= last && first <= last_page(other)) {
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+/**
+ * @name read_file - Reads bytes of an executable, at most one block at a time
+ * straight into their destination
+ * @param inode    - The inode of the executable
+ * @param dest     - Where to copy the bytes
+ * @param offset   - Their offset in the file
+ * @param length   - Their number
+ * @return bool    - Whether every byte was read
+ */
+bool read_file(u_int32 inode, u_int8 *dest, u_int32 offset, u_int32 length)
+{
+  u_int32 done = 0;
+  while (done < length) {
+    u_int32 read = read_inode_data(inode, dest + done, offset + done, length - done);
+    if (!read) {
+      return FALSE;
+    }
+    done += read;
+  }
+  return TRUE;
+}
+
+/**
+ * @name fill_frames - Reads a segment into new frames, zeroing what follows its bytes
+ * @param segment    - The segment, whose frames field is set
+ * @param inode      - The inode of the executable
+ * @return bool      - FALSE if a frame could not be allocated or read, the
+ *                     frames already taken being left for free_image
+ */
+bool fill_frames(exec_segment_t *segment, u_int32 inode)
+{
+  u_int32 nb_pages = (last_page(segment) - (segment->address & 0xFFFFF000)) / 0x1000 + 1;
+  u_int32 start = segment->address % 0x1000;  /* Offset of the segment in its first page */
+  segment->frames = (u_int32 *)mem_alloc(nb_pages * sizeof(u_int32));
+  mem_set(segment->frames, 0, nb_pages * sizeof(u_int32));  /* Frame 0 is never used */
+
+  for (u_int32 page = 0; page < nb_pages; page++) {
+    u_int32 frame = first_false_bit(frames);
+    if (frame == (u_int32)-1) {
+      return FALSE;  /* No frame left for the executable cache */
+    }
+    set_bit(frames, frame, TRUE);
+    segment->frames[page] = frame;
+
+    u_int8 *virtual = (u_int8 *)request_physical_space(current_directory, frame * 0x1000, TRUE, FALSE);
+    if (!virtual) {
+      return FALSE;
+    }
+    mem_set(virtual, 0, 0x1000);
+    /* The bytes of the file on this page, from pos in the segment */
+    u_int32 pos = page ? page * 0x1000 - start : 0;
+    u_int32 dest = page ? 0 : start;
+    bool read = pos >= segment->file_size
+      || read_file(inode, virtual + dest, segment->offset + pos,
+                   min(segment->file_size - pos, 0x1000 - dest));
+    free_virtual_space(current_directory, (u_int32)virtual, FALSE);  /* The frame is kept */
+    if (!read) {
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+/**
+ * @name free_image - Frees the frames and the bytes of an image, and its entry
+ * @param image     - The image, possibly read in part
+ * @return void
+ */
+void free_image(exec_image_t *image)
+{
+  for (u_int32 i = 0; i < image->nb_segments; i++) {
+    exec_segment_t *segment = &image->segments[i];
+    if (segment->shared && segment->frames) {
+      u_int32 nb_pages = (last_page(segment) - (segment->address & 0xFFFFF000)) / 0x1000 + 1;
+      for (u_int32 page = 0; page < nb_pages; page++) {
+        if (segment->frames[page]) {
+          set_bit(frames, segment->frames[page], FALSE);
+        }
+      }
+      mem_free(segment->frames);
+    } else if (!segment->shared && segment->data) {
+      mem_free(segment->data);
+    }
+  }
+  image->nb_segments = 0;
+  image->inode = 0;
+}
+
+/**
+ * @name read_image - Reads the program headers of an executable into an image,
+ * then its segments if it is cached
+ * @param image     - The image, whose inode and cached fields are set
+ * @param size      - The size of the executable
+ * @return bool     - FALSE if the file is not a valid executable or could not be
+ *                    read, what was read being left for free_image
+ */
+bool read_image(exec_image_t *image, u_int32 size)
+{
+  image->nb_segments = 0;
+
+  elf_header_t elf_header;
+  if (size < sizeof(elf_header_t)
+      || !read_file(image->inode, (u_int8 *)&elf_header, 0, sizeof(elf_header_t))
+      || !check_elf(&elf_header)) {
+    return FALSE;
+  }
+  image->entry_point = elf_header.entry_point;
+
+  /* The whole table must be in the file */
+  if (elf_header.program_header_table > size
+      || (size - elf_header.program_header_table) / elf_header.pht_entry_size
+         < elf_header.pht_entry_nb) {
+    return FALSE;
+  }
+
+  for (u_int16 index = 0; index < elf_header.pht_entry_nb; index++) {
+    program_header_entry_t header;
+    if (!read_file(image->inode, (u_int8 *)&header, program_header_offset(&elf_header, index),
+                   sizeof(program_header_entry_t))) {
+      return FALSE;
+    }
+    if (header.segment_type != Load || !header.segment_size_in_memory) {
+      continue;
+    }
+    u_int32 address = header.segment_virtual_address;
+    u_int32 end     = address + header.segment_size_in_memory;  /* 0 at the end of memory */
+    if (address < START_OF_USER_CODE || (end && end < address)
+        || header.segment_size_in_file > header.segment_size_in_memory
+        || header.segment_offset + header.segment_size_in_file > size
+        || header.segment_offset + header.segment_size_in_file < header.segment_offset
+        || image->nb_segments == EXEC_SEGMENTS) {
+      return FALSE;
+    }
+
+    exec_segment_t *segment = &image->segments[image->nb_segments];
+    segment->address   = address;
+    segment->mem_size  = header.segment_size_in_memory;
+    segment->offset    = header.segment_offset;
+    segment->file_size = header.segment_size_in_file;
+    segment->writable  = !!(header.flags & SEGMENT_W);
+    segment->shared    = FALSE;
+    segment->frames    = NULL;
+    segment->data      = NULL;
+    image->nb_segments++;
+  }
+
+  /* Without cache, the bytes are read when the segments are mapped */
+  for (u_int32 i = 0; i < image->nb_segments && image->cached; i++) {
+    exec_segment_t *segment = &image->segments[i];
+    segment->shared = can_share(image, i);
+    if (segment->shared) {
+      if (!fill_frames(segment, image->inode)) {
+        return FALSE;
+      }
+    } else {
+      segment->data = (u_int8 *)mem_alloc(segment->file_size);
+      if (!read_file(image->inode, segment->data, segment->offset, segment->file_size)) {
+        return FALSE;
+      }
+    }
+  }
+  return TRUE;
+}
+
+/**
+ * @name map_segment - Maps the pages of a segment which is not shared, copying
+ * its bytes one page at a time, from the image or else from the file
+ * The pages after its bytes are left lazy if it is writable, and if the
+ * directory has no lazy pages yet; they are zeroed otherwise.
+ * @param segment    - The segment
+ * @param inode      - The inode of the executable
+ * @param dir        - The page directory of the process
+ * @return bool      - FALSE if a page could not be allocated or read
+ */
+bool map_segment(exec_segment_t *segment, u_int32 inode, page_directory_t *dir)
+{
+  u_int32 first    = segment->address & 0xFFFFF000;
+  u_int32 nb_pages = (last_page(segment) - first) / 0x1000 + 1;
+  for (u_int32 page = 0; page < nb_pages; page++) {
+    /* The part of the segment on this page */
+    u_int32 start = page ? first + page * 0x1000 - segment->address : 0;
+    u_int32 end   = min(first + (page + 1) * 0x1000 - segment->address, segment->mem_size);
+
+    if (start >= segment->file_size && segment->writable && !dir->lazy_pages) {
+      /* Only zeroes until the end of the segment: mapped on the first access */
+      dir->lazy_start = first + page * 0x1000;
+      dir->lazy_pages = nb_pages - page;
+      return TRUE;
+    }
+
+    u_int32 length = start < segment->file_size ? min(end, segment->file_size) - start : 0;
+    const u_int8 *bytes = segment->data ? segment->data + start : NULL;
+    if (!fill_user_page(dir, segment->address + start, bytes, bytes ? length : 0,
+                        segment->writable)) {
+      return FALSE;
+    }
+    /* The window of the kernel is writable, whatever the rights of the process */
+    if (!bytes && length
+        && !read_file(inode, map_user_page(dir, segment->address + start, FALSE),
+                      segment->offset + start, length)) {
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+/**
+ * @name cache_entry - Returns a free entry of the cache, evicting the least
+ * recently used image which no process maps if needed
+ * @return exec_image_t* - The entry, or NULL if every image is mapped
+ */
+exec_image_t *cache_entry()
+{
+  exec_image_t *lru = NULL;
+  for (u_int32 i = 0; i < EXEC_CACHE_ENTRIES; i++) {
+    exec_image_t *image = &exec_cache[i];
+    if (!image->inode) {
+      return image;
+    }
+    if (!image->users && (!lru || image->last_use < lru->last_use)) {
+      lru = image;
+    }
+  }
+
+  if (lru) {
+    free_image(lru);
+  }
+  return lru;
+}
+
+
+exec_image_t *open_exec_image(u_int32 inode)
+{
+  if (!inode) {
+    return NULL;
+  }
+  inode_t inode_buffer;
+  set_inode(inode, &inode_buffer);
+
+  exec_image_t *image = NULL;
+  for (u_int32 i = 0; i < EXEC_CACHE_ENTRIES; i++) {
+    exec_image_t *entry = &exec_cache[i];
+    if (entry->inode == inode && entry->generation == inode_buffer.generation) {
+      image = entry;
+    } else if (entry->inode == inode && !entry->users) {
+      free_image(entry);  /* An older version of the file */
+    }
+  }
+
+  if (!image) {
+    image = cache_entry();
+    bool cached = image != NULL;
+    if (!cached) {
+      /* Every image is mapped: this one is freed once its processes are gone */
+      image = (exec_image_t *)mem_alloc(sizeof(exec_image_t));
+      image->nb_segments = 0;
+    }
+    image->inode      = inode;
+    image->generation = inode_buffer.generation;
+    image->cached     = cached;
+    image->users      = 0;
+    if (!read_image(image, inode_buffer.size_low)) {
+      free_image(image);
+      if (!cached) {
+        mem_free(image);
+      }
+      return NULL;
+    }
+  }
+
+  image->last_use = exec_clock++;
+  image->users++;
+  return image;
+}
+
+bool map_exec_image(exec_image_t *image, page_directory_t *dir)
+{
+  for (u_int32 i = 0; i < image->nb_segments; i++) {
+    exec_segment_t *segment = &image->segments[i];
+    if (!segment->shared) {
+      if (!map_segment(segment, image->inode, dir)) {
+        return FALSE;
+      }
+      continue;
+    }
+
+    u_int32 first    = segment->address & 0xFFFFF000;
+    u_int32 nb_pages = (last_page(segment) - first) / 0x1000 + 1;
+    for (u_int32 page = 0; page < nb_pages; page++) {
+      map_shared_frame(dir, first + page * 0x1000, segment->frames[page]);
+    }
+  }
+  return TRUE;
+}
+
+void retain_exec_image(exec_image_t *image)
+{
+  if (image) {
+    image->users++;
+  }
+}
+
+void release_exec_image(exec_image_t *image)
+{
+  if (image) {
+    image->users--;
+    if (!image->cached && !image->users) {
+      free_image(image);
+      mem_free(image);
+    }
+  }
+}
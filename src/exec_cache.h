@@ -0,0 +1,86 @@
+#ifndef EXEC_CACHE_H
+#define EXEC_CACHE_H
+
+/* exec_cache.h:
+ * Cache of the executables started by run, exec and spawn, keyed by inode and
+ * generation. An image holds the loaded segments of an executable: the
+ * read-only ones in frames shared by every process running it, mapped
+ * read-only, and the bytes of the others, copied into each process. Starting a
+ * cached program reads its inode but none of its data blocks. When the cache is
+ * full, the least recently started image which no process maps is evicted, and
+ * if every one is mapped the executable gets an image of its own, freed once no
+ * process maps it. Executables are read block by block into their destination,
+ * never as a whole.
+ */
+
+#include "types.h"
+#include "paging.h"
+
+
+#define EXEC_CACHE_ENTRIES 8
+#define EXEC_SEGMENTS      8  /* Maximal number of loaded segments of an executable */
+
+typedef struct exec_segment {
+  u_int32  address;    /* Virtual address in the processes */
+  u_int32  mem_size;
+  u_int32  offset;     /* Of its bytes in the file */
+  u_int32  file_size;  /* The bytes after it are zeroed */
+  bool     writable;   /* Otherwise its pages are mapped read-only */
+  bool     shared;     /* Read-only and alone on its pages, hence kept in frames */
+  u_int32 *frames;     /* If shared, the frames of its pages */
+  u_int8  *data;       /* Otherwise its file_size bytes, or NULL if the image is
+                        * not cached: they are then read from the file */
+} exec_segment_t;
+
+typedef struct exec_image {
+  u_int32 inode;       /* 0 if the entry is free */
+  u_int32 generation;  /* Of the inode when it was read */
+  u_int32 entry_point;
+  u_int32 nb_segments;
+  exec_segment_t segments[EXEC_SEGMENTS];
+  bool    cached;      /* Otherwise allocated for one load (see open_exec_image) */
+  u_int32 users;       /* Number of processes mapping its frames */
+  u_int32 last_use;    /* Value of exec_clock when it was last loaded */
+} exec_image_t;
+
+exec_image_t exec_cache[EXEC_CACHE_ENTRIES];
+
+
+/**
+ * @name open_exec_image - Returns the image of an executable, from the cache if
+ * it holds the current generation of the inode
+ * The executable is read and checked here, so that nothing of a process has to
+ * change before it is known to be valid.
+ * @param inode          - The inode of the executable
+ * @return exec_image_t* - The image, to be released once no process maps it,
+ *                         or NULL if the file is not a valid executable, or
+ *                         could not be read
+ */
+exec_image_t *open_exec_image(u_int32 inode);
+
+/**
+ * @name map_exec_image - Maps the segments of an image in the code pages of a process
+ * @param image         - The image
+ * @param dir           - The page directory of the process, without code pages
+ * @return bool         - FALSE if the memory was lacking, only part of the
+ *                        segments being mapped then
+ */
+bool map_exec_image(exec_image_t *image, page_directory_t *dir);
+
+/**
+ * @name retain_exec_image - Counts one more process mapping an image, which
+ * got the pages of another one
+ * @param image            - The image, or NULL
+ * @return void
+ */
+void retain_exec_image(exec_image_t *image);
+
+/**
+ * @name release_exec_image - Counts one process less mapping an image, which
+ * can then be evicted once no process maps it, or is freed if it is not cached
+ * @param image             - The image, or NULL
+ * @return void
+ */
+void release_exec_image(exec_image_t *image);
+
+#endif
@@ -1,4 +1,5 @@
 #include "filesystem.h"
+#include "utils.h"
 
 /* lba n means sector n, with sector_size = 0x200 = 512 bytes. The volume starts
  * at 1M = 0x10000 in memory. Thus, lba n is the address 512 * n from the 
@@ -310,6 +311,46 @@ u_int32 write_inode_data(u_int32 inode, u_int8* buffer, u_int32 offset, \
   return width;
 }
 
+/* The user buffers are mapped one page at a time, and read_inode_data and
+ * write_inode_data stop at the end of a block, hence pieces within both */
+u_int32 read_inode_user(u_int32 inode, page_directory_t *dir, u_int32 buffer, \
+                        u_int32 offset, u_int32 length)
+{
+  u_int32 done = 0;
+  while(done != length) {
+    u_int8* dest = map_user_page(dir, buffer + done, TRUE);
+    if(!dest) {
+      break; // Not a writable page of the process
+    }
+    u_int32 width = min(length - done, 0x1000 - (buffer + done) % 0x1000);
+    u_int32 read = read_inode_data(inode, dest, offset + done, width);
+    if(!read) {
+      break;
+    }
+    done += read;
+  }
+  return done;
+}
+
+u_int32 write_inode_user(u_int32 inode, page_directory_t *dir, u_int32 buffer, \
+                         u_int32 offset, u_int32 length)
+{
+  u_int32 done = 0;
+  while(done != length) {
+    u_int8* src = map_user_page(dir, buffer + done, FALSE);
+    if(!src) {
+      break; // Not a page of the process
+    }
+    u_int32 width = min(length - done, 0x1000 - (buffer + done) % 0x1000);
+    u_int32 written = write_inode_data(inode, src, offset + done, width);
+    if(!written) { // No data was written this time, so it won't evolve
+      break;
+    }
+    done += written;
+  }
+  return done;
+}
+
 u_int32 find_inode(string str_path, u_int32 root)
 {
   list_t path = str_split(str_path + !!(str_path[0]=='/'), '/', TRUE);
@@ -532,6 +573,7 @@ void erase_file_data(u_int32 inode)
 
   u_int32 blocks = 1 + (std_inode->size_low - 1) / block_size;
   std_inode->size_low = 0;
+  std_inode->generation++;
   update_inode(inode, std_inode);
 
   if(blocks <= 12) {
@@ -758,6 +800,40 @@ u_int32 prepare_blocks(u_int32 inode, u_int32 used, u_int32 to_use)
   return count;
 }
 
+u_int32 max_file_size()
+{
+  u_int64 addr_per_block = block_size / 4;
+  u_int64 blocks = 12 + addr_per_block + addr_per_block * addr_per_block + \
+    addr_per_block * addr_per_block * addr_per_block;
+  u_int64 size = blocks * block_size;
+  if(size > 0xFFFFFFFF) {
+    return 0xFFFFFFFF; // The size is kept on 32 bits
+  }
+  return size;
+}
+
+bool prepare_file(u_int32 inode, u_int32 size, u_int32 end)
+{
+  u_int32 to_use = 1 + (end - 1) / block_size;
+  u_int32 used;
+  if(size) {
+    used = 1 + (size - 1) / block_size;
+  } else {
+    used = 0;
+  }
+
+  u_int32 alloc = prepare_blocks(inode, used, to_use);
+  return to_use <= used || alloc == to_use - used;
+}
+
+void set_file_size(u_int32 inode, u_int32 size)
+{
+  set_inode(inode, std_inode);
+  std_inode->size_low = size;
+  std_inode->generation++;  // The executable cache must not serve the old data
+  update_inode(inode, std_inode);
+}
+
 u_int8 delete_file(u_int32 dir, u_int32 inode)
 {
   u_int8 error = remove_file(dir, inode);
@@ -781,6 +857,8 @@ u_int32 create_file(u_int32 father, string name, u_int16 type, u_int8 ftype)
   if(!num) {
     return 0;
   }
+  inode_t previous; // A deleted file may have had this inode
+  set_inode(num, &previous);
   u_int8 error = add_file(father, num, ftype, name);
   if(error) {
     unallocate_inode(num);
@@ -795,6 +873,7 @@ u_int32 create_file(u_int32 father, string name, u_int16 type, u_int8 ftype)
     std_inode->dbp[i] = 0;
   }
   std_inode->sibp = 0; std_inode->dibp = 0; std_inode->tibp = 0;
+  std_inode->generation = previous.generation + 1;
 
   if(is_a_dir) {
     u_int32 block = allocate_block(1);
@@ -4,6 +4,7 @@
 #include "malloc.h"
 #include "logging.h"
 #include "fs_types.h"
+#include "paging.h"
 
 /**
  *  @name std_buf - The standard buffer, one block wide, used by most functions
@@ -100,6 +101,39 @@ u_int32 write_inode_data(u_int32 inode, u_int8* buffer, u_int32 offset, \
                          u_int32 length);
 
 
+/**
+ *  @name read_inode_user - Copies data from the disk to the memory of a process
+ *  The buffer is reached page by page through map_user_page, without switching
+ *  directories, and the copy stops before a page which is not a writable page
+ *  of the process.
+ *
+ *  @param inode  - The inode number of the file to read
+ *  @param dir    - The page directory of the process
+ *  @param buffer - The output buffer, in the process
+ *  @param offset - Offset within the file, in bytes
+ *  @param length - The length of the data to copy, in bytes
+ *
+ *  @return       - The actually read length of data
+ */
+u_int32 read_inode_user(u_int32 inode, page_directory_t *dir, u_int32 buffer, \
+                        u_int32 offset, u_int32 length);
+
+/**
+ *  @name write_inode_user - Writes data of a process to the disk
+ *  The blocks must have been allocated by prepare_file. The copy stops before a
+ *  page which is not a page of the process.
+ *
+ *  @param inode  - The inode number of the file to write
+ *  @param dir    - The page directory of the process
+ *  @param buffer - The input buffer, in the process
+ *  @param offset - Offset within the file, in bytes
+ *  @param length - The length of the data to copy, in bytes
+ *
+ *  @return       - The actually written length of data
+ */
+u_int32 write_inode_user(u_int32 inode, page_directory_t *dir, u_int32 buffer, \
+                         u_int32 offset, u_int32 length);
+
 /**
  *  @name find_inode - Opens a file
  *
@@ -149,7 +183,8 @@ u_int8 add_file(u_int32 dir, u_int32 inode, u_int8 file_type, string name);
 u_int8 remove_file(u_int32 dir, u_int32 inode);
 
 /**
- *  @name erase_file_data - Unallocates all the blocks used by a file
+ *  @name erase_file_data - Unallocates all the blocks used by a file, and
+ *  changes its generation
  *  @param inode          - The inode number of the file to erase
  *  NOTE : the inode will not be unallocated
  */
@@ -197,6 +232,34 @@ u_int32 create_dir(u_int32 father, string name);
  */
 u_int32 prepare_blocks(u_int32 inode, u_int32 used, u_int32 to_use);
 
+/**
+ *  @name max_file_size - Returns the largest size a file can have, with every
+ *  level of indirect blocks used
+ *
+ *  @return            - The size, in bytes
+ */
+u_int32 max_file_size();
+
+/**
+ *  @name prepare_file - Allocates the data blocks a file needs to hold some bytes
+ *
+ *  @param inode       - The inode number of the file
+ *  @param size        - The current size of the file
+ *  @param end         - The offset, in bytes, up to which data will be written
+ *
+ *  @return            - Whether every block up to end is allocated
+ */
+bool prepare_file(u_int32 inode, u_int32 size, u_int32 end);
+
+/**
+ *  @name set_file_size - Updates the size of a file on the disk, after a write
+ *  Its generation is also changed (see exec_cache.h).
+ *  @param inode        - The inode number of the file
+ *  @param size         - The new size
+ *  @return void
+ */
+void set_file_size(u_int32 inode, u_int32 size);
+
 /**
  *  @name  ls_dir - Prints to the screen the contents of a directory
  *  @param inode  - The inode number of the directory
@@ -1,22 +1,18 @@
 #include "fs_inter.h"
+#include "pipe.h"
 
 fdt_e* fdt = 0;
 u_int32 fdt_size = 0;
 u_int32 fdt_num = 0;
 
 
-fd openfile(string path, u_int8 oflag, u_int16 fperm)
+/**
+ *  @name new_fd - Allocates a file descriptor
+ *  The caller must set the inode of its entry in the fdt, to mark it as used.
+ *  @return      - The file descriptor
+ */
+fd new_fd()
 {
-  u_int32 inode = find_inode(path, 2);
-  if(!( (oflag & O_CREAT) || inode) ) {
-    /* kloug(100, "File %s does not exist\n", path); */
-    return 0;
-  }
-  if((oflag & O_EXCL) && inode) {
-    /* kloug(100, "File %s already exists\n", path); */
-    return 0;
-  }
-
   u_int32 i;
   for(i = 0; i < fdt_size && fdt[i].inode; i++);
   if(i == fdt_size) { // fdt is full, so it shall double in size
@@ -36,6 +32,24 @@ fd openfile(string path, u_int8 oflag, u_int16 fperm)
   fd f = (void*) mem_alloc(sizeof(void*));
   *f = i;
   fdt_num++;
+  fdt[i].this = f;
+  fdt[i].pipe = -1;
+  return f;
+}
+
+fd openfile(string path, u_int8 oflag, u_int16 fperm)
+{
+  u_int32 inode = find_inode(path, 2);
+  if(!( (oflag & O_CREAT) || inode) ) {
+    /* kloug(100, "File %s does not exist\n", path); */
+    return 0;
+  }
+  if((oflag & O_EXCL) && inode) {
+    /* kloug(100, "File %s already exists\n", path); */
+    return 0;
+  }
+
+  fd f = new_fd();
 
   if(!inode) { // O_CREAT flag is set because of the first test
     /* std_buf has been set by find_inode to the content of the data block of
@@ -83,6 +97,26 @@ fd openker(string path)
   return openfile(path, O_RDWR, 0xffff);
 }
 
+fd openpipe(u_int32 p, u_int8 oflag)
+{
+  fd f = new_fd();
+  fdt[*f].inode = PIPE_INODE;
+  fdt[*f].pos   = 0;
+  fdt[*f].size  = 0;
+  fdt[*f].mode  = oflag & 0x3;
+  fdt[*f].pipe  = p;
+  pipe_open(p, oflag & O_WRONLY);
+  return f;
+}
+
+fd dup(fd f)
+{
+  if(!f || fdt[*f].pipe < 0) {
+    return 0;
+  }
+  return openpipe(fdt[*f].pipe, fdt[*f].mode);
+}
+
 u_int32 read(fd f, u_int8* buffer, u_int32 offset, u_int32 length)
 {
   if(!f || *f > fdt_size || fdt[*f].this != f || !fdt[*f].inode) {
@@ -115,7 +149,7 @@ u_int32 write(fd f, u_int8* buffer, u_int32 offset, u_int32 length)
     writef("Could not write on file without the appropriate flag\n");
     return -2; // No permission
   }
-  if(!length) {
+  if(!length || fdt[*f].pipe >= 0) { // Pipes are written by the processes only
     return 0;
   }
   u_int32 to_use = 1 + (fdt[*f].pos + length - 1) / block_size;
@@ -144,10 +178,13 @@ u_int32 write(fd f, u_int8* buffer, u_int32 offset, u_int32 length)
     fdt[*f].pos += done;
     written += done;
   }
-  if(fdt[*f].pos > fdt[*f].size) {
-    fdt[*f].size = fdt[*f].pos;
+  if(written) {
+    if(fdt[*f].pos > fdt[*f].size) {
+      fdt[*f].size = fdt[*f].pos;
+    }
     // std_inode was set by write_inode_data or by prepare_block
     std_inode->size_low = fdt[*f].size;
+    std_inode->generation++; // The executable cache must not serve the old data
     update_inode(fdt[*f].inode, std_inode);
   }
 
@@ -159,6 +196,11 @@ void fstat(fd f, stats* s)
   if(!f) {
     writef("Invalid file descriptor\n");
   }
+  if(fdt[*f].pipe >= 0) { // A pipe has no inode
+    s->st_ino = 0; s->st_kind = 0; s->st_perm = 0; s->st_nlink = 0;
+    s->st_size = 0;
+    return;
+  }
   set_inode(fdt[*f].inode, std_inode);
   s->st_ino = fdt[*f].inode;
   s->st_kind = std_inode->type >> 12;
@@ -173,6 +215,9 @@ u_int32 lseek(fd f, s_int32 offset, u_int8 seek)
     writef("Invalid seek command\n");
     return 0;
   }
+  if(fdt[*f].pipe >= 0) { // Pipes cannot seek
+    return 0;
+  }
   if(seek & SEEK_SET) {
     if(offset < 0) {
       fdt[*f].pos = 0;
@@ -206,6 +251,9 @@ void close(fd f)
   if(!f || !fdt[*f].inode) {
     return;
   }
+  if(fdt[*f].pipe >= 0) {
+    pipe_close(fdt[*f].pipe, fdt[*f].mode & O_WRONLY);
+  }
   fdt[*f].inode = 0;
   fdt[*f].this = 0;
   mem_free(f);
@@ -19,16 +19,31 @@
 
 typedef u_int32* fd;
 
+#define PIPE_INODE 0xFFFFFFFF // Inode of the pipe ends, never used by a file
+
+/* The standard input and output of a process, only valid for read and write */
+#define STDIN_FD  ((fd) 1)
+#define STDOUT_FD ((fd) 2)
+
 struct file_description {
   u_int32 inode;
   u_int32 pos;
   u_int32 size;
   u_int16 mode;
   fd      this; // Its own file descriptor
+  s_int32 pipe; // The pipe (see pipe.h) if it is an end of one, -1 otherwise
 } __attribute__((packed));
 
 typedef struct file_description fdt_e;
 
+#define IOV_MAX 64 // Maximal number of buffers of readv and writev
+
+/* A buffer of readv and writev */
+typedef struct iovec {
+  u_int8* base;
+  u_int32 length;
+} iovec_t;
+
 
 u_int32 fdt_size;
 fdt_e* fdt;
@@ -59,6 +74,21 @@ fd openfile(string path, u_int8 oflag, u_int16 fperm);
  *  @return       - Same as openfile
  */
 fd openker(string path);
+
+/**
+ *  @name openpipe - Opens an end of a pipe
+ *  @param p       - The pipe
+ *  @param oflag   - O_RDONLY for the read end, O_WRONLY for the write end
+ *  @return        - The file descriptor for the end
+ */
+fd openpipe(u_int32 p, u_int8 oflag);
+
+/**
+ *  @name dup - Opens a new file descriptor for the same pipe end
+ *  @param f  - The file descriptor of a pipe end
+ *  @return   - The new file descriptor, or 0 if f is not a pipe end
+ */
+fd dup(fd f);
   
 /**
  *  @name read    - Reads from a file
@@ -86,6 +116,7 @@ u_int32 read(fd f, u_int8* buffer, u_int32 offset, u_int32 length);
  *                  -1: Invalid file descriptor
  *                  -2: File is not opened with the written flag
  *                  -3: The block allocation failed
+ *                  Pipes are written through the write syscall only.
  */
 u_int32 write(fd f, u_int8* buffer, u_int32 offset, u_int32 length);
 
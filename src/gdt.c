@@ -6,7 +6,7 @@
 
 /* Source : http://www.osdever.net/bkerndev/Docs/gdt.htm */
 
-#define GDT_SIZE 8
+#define GDT_SIZE (7 + MAX_CPUS)  /* The segments, then a TSS per processor */
 int current_entry = 0;
 
 /* Our GDT, with 6 entries, and finally our special GDT pointer */
@@ -64,11 +64,17 @@ void add_segment(u_int32 *address, u_int32 base, u_int32 limit, bool code, int r
   current_entry++;
 }
 
-void write_tss(gdt_entry_t* g)
+/**
+ * @name write_tss - Adds the TSS of a processor in the GDT
+ * @param g        - The GDT entry
+ * @param cpu      - The index of the processor
+ * @return void
+ */
+void write_tss(gdt_entry_t* g, u_int32 cpu)
 {
    // Firstly, let's compute the base and limit of our entry into the GDT.
-   u_int32 base = (u_int32) &TSS_ENTRY;
-   u_int32 limit = sizeof(TSS_ENTRY);
+   u_int32 base = (u_int32) &TSS_ENTRIES[cpu];
+   u_int32 limit = sizeof(tss_t);
    u_int8  ring = 0; /* According to OSdev, other have said 3 */
 
    // Now, add our TSS descriptor's address to the GDT.
@@ -90,11 +96,11 @@ void write_tss(gdt_entry_t* g)
    g->base_high = (base >> 24) & 0xFF; //isolate top byte.
 
    // Ensure the TSS is initially zero'd.
-   mem_set(&TSS_ENTRY, 0, sizeof(TSS_ENTRY));
-   TSS_SEGMENT = (current_entry * sizeof(gdt_entry_t)) | ring;
+   mem_set(&TSS_ENTRIES[cpu], 0, sizeof(tss_t));
+   TSS_SEGMENTS[cpu] = (current_entry * sizeof(gdt_entry_t)) | ring;
 
-   TSS_ENTRY.ss0  = KERNEL_STACK_SEGMENT;  // Set the kernel stack segment.
-   TSS_ENTRY.esp0 = START_OF_KERNEL_STACK; // Set the kernel stack pointer.
+   TSS_ENTRIES[cpu].ss0  = KERNEL_STACK_SEGMENT;  // Set the kernel stack segment.
+   TSS_ENTRIES[cpu].esp0 = START_OF_KERNEL_STACK; // Set the kernel stack pointer.
    //note that CS is loaded from the IDT entry and should be the regular kernel code segment
    current_entry++;
 }
@@ -102,7 +108,7 @@ void write_tss(gdt_entry_t* g)
 /* This will update the ESP0 stack used when an interrupt occurs */
 void set_kernel_stack(u_int32 stack)
 {
-   TSS_ENTRY.esp0 = stack;
+   TSS_ENTRIES[cpu_id()].esp0 = stack;
 }
 
 /* Should be called by main. This will setup the special GDT
@@ -131,20 +137,24 @@ void gdt_install()
    * this entry's access byte says it's a Data Segment */
   add_segment(&KERNEL_DATA_SEGMENT,  0, 0xFFFFF, FALSE, 0);
 
-  add_segment(&KERNEL_STACK_SEGMENT, 0, 0xFFFFF, FALSE, 0);
-  /* gdt[KERNEL_STACK_SEGMENT].dir_conform = 1; */
-
-  /* Now the user segments - just the same as the kernel ones */
+  /* Now the user segments - just the same as the kernel ones. sysexit expects
+   * the user code and data segments right after the kernel ones */
   add_segment(&USER_CODE_SEGMENT,  0, 0xFFFFF, TRUE,  3);
   add_segment(&USER_DATA_SEGMENT,  0, 0xFFFFF, FALSE, 3);
+
+  add_segment(&KERNEL_STACK_SEGMENT, 0, 0xFFFFF, FALSE, 0);
+  /* gdt[KERNEL_STACK_SEGMENT].dir_conform = 1; */
   add_segment(&USER_STACK_SEGMENT, 0, 0xFFFFF, FALSE, 3);
   /* gdt[USER_STACK_SEGMENT].dir_conform = 1; */
 
-  write_tss(&gdt[current_entry]);
+  /* The TSS of every processor follow, they are loaded by tss_flush */
+  for (u_int32 cpu = 0; cpu < MAX_CPUS; cpu++) {
+    write_tss(&gdt[current_entry], cpu);
+  }
   /* Flush out the old GDT and install the new changes! */
   gdt_flush();
 
-  tss_flush();
+  tss_flush(TSS_SEGMENTS[0]);
 
   /* kloug(100, "GTD installed\n"); */
 }
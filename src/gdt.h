@@ -3,6 +3,7 @@
 
 #include "gdt_asm.h"
 #include "types.h"
+#include "smp.h"
 
 
 u_int32 NULL_SEGMENT;
@@ -12,8 +13,7 @@ u_int32 KERNEL_STACK_SEGMENT;
 u_int32 USER_CODE_SEGMENT;
 u_int32 USER_DATA_SEGMENT;
 u_int32 USER_STACK_SEGMENT;
-u_int32 TSS_SEGMENT;
-struct tss TSS_ENTRY;
+u_int32 TSS_SEGMENTS[MAX_CPUS];  /* One task state segment per processor */
 
 
 /* Defines a GDT entry. We say packed, because it prevents the
@@ -70,6 +70,8 @@ typedef struct tss {
   u_int16 debug_flag, io_map;
 } __attribute__ ((packed)) tss_t;
 
+tss_t TSS_ENTRIES[MAX_CPUS];
+
 /**
  *  @name gdt_install - Sets up the GDT.
  */
@@ -77,5 +79,12 @@ void gdt_install();
 
 void init_pic();
 
+/**
+ *  @name set_kernel_stack - Sets the stack used by interruptions from user mode
+ *  on the current processor
+ *  @param stack           - The top of the stack
+ */
+void set_kernel_stack(u_int32 stack);
+
 
 #endif
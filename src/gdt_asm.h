@@ -1,7 +1,8 @@
 #ifndef GDT_ASM_H
 #define GDT_ASM_H
 
-void tss_flush();
+/* Loads the task register with the given TSS selector */
+void tss_flush(unsigned int selector);
 void gdt_flush();
 
 #endif
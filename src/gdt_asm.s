@@ -4,10 +4,9 @@
 ; This is declared in C as 'extern void gdt_flush();'
 
 global tss_flush
-extern TSS_SEGMENT
 
 tss_flush:
-  mov ax, 0x38
+  mov ax, [esp+4]               ; The selector of the TSS of the processor
   ltr ax
   ret
 
@@ -24,7 +23,7 @@ gdt_flush:
   mov es, ax
   mov fs, ax
   mov gs, ax
-  mov ax, 0x18
+  mov ax, [KERNEL_STACK_SEGMENT]
   mov ss, ax
   jmp 0x8:flush2 ; Far jump!
 
@@ -0,0 +1,123 @@
+#include "heap.h"
+#include "malloc.h"
+#include "memory.h"
+
+#define HEAP_INITIAL_CAPACITY 16
+
+
+heap_t *empty_heap()
+{
+  heap_t *h = mem_alloc(sizeof(heap_t));
+  h->size = 0;
+  h->capacity = HEAP_INITIAL_CAPACITY;
+  h->elts = mem_alloc(HEAP_INITIAL_CAPACITY * sizeof(heap_elt_t));
+  return h;
+}
+
+bool is_empty_heap(heap_t *h)
+{
+  return h->size == 0;
+}
+
+
+/**
+ * @name sift_up - Moves an element up until its parent has a smaller key
+ * @param h      - The heap
+ * @param i      - The index of the element
+ * @return void
+ */
+void sift_up(heap_t *h, u_int32 i)
+{
+  heap_elt_t elt = h->elts[i];
+  while (i > 0 && h->elts[(i - 1) / 2].key > elt.key) {
+    h->elts[i] = h->elts[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  h->elts[i] = elt;
+}
+
+/**
+ * @name sift_down - Moves an element down until its children have greater keys
+ * @param h        - The heap
+ * @param i        - The index of the element
+ * @return void
+ */
+void sift_down(heap_t *h, u_int32 i)
+{
+  heap_elt_t elt = h->elts[i];
+  for (;;) {
+    u_int32 child = 2 * i + 1;
+    if (child >= h->size) {
+      break;
+    }
+    if (child + 1 < h->size && h->elts[child + 1].key < h->elts[child].key) {
+      child++;
+    }
+    if (h->elts[child].key >= elt.key) {
+      break;
+    }
+    h->elts[i] = h->elts[child];
+    i = child;
+  }
+  h->elts[i] = elt;
+}
+
+
+void heap_insert(heap_t *h, u_int32 key, u_int32 value)
+{
+  if (h->size == h->capacity) {
+    /* Doubles the capacity */
+    heap_elt_t *elts = mem_alloc(2 * h->capacity * sizeof(heap_elt_t));
+    mem_copy(elts, h->elts, h->size * sizeof(heap_elt_t));
+    mem_free(h->elts);
+    h->elts = elts;
+    h->capacity *= 2;
+  }
+
+  h->elts[h->size].key   = key;
+  h->elts[h->size].value = value;
+  h->size++;
+  sift_up(h, h->size - 1);
+}
+
+heap_elt_t heap_min(heap_t *h)
+{
+  return h->elts[0];  /* We assume h->size > 0 */
+}
+
+heap_elt_t heap_pop(heap_t *h)
+{
+  heap_elt_t min = h->elts[0];  /* We assume h->size > 0 */
+
+  h->size--;
+  if (h->size) {
+    h->elts[0] = h->elts[h->size];
+    sift_down(h, 0);
+  }
+
+  return min;
+}
+
+bool heap_remove(heap_t *h, u_int32 value)
+{
+  for (u_int32 i = 0; i < h->size; i++) {
+    if (h->elts[i].value == value) {
+      h->size--;
+      if (i < h->size) {
+        h->elts[i] = h->elts[h->size];
+        sift_down(h, i);
+        sift_up(h, i);
+      }
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+
+void delete_heap(heap_t *h)
+{
+  mem_free(h->elts);
+  mem_free(h);
+}
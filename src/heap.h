@@ -0,0 +1,68 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include "types.h"
+
+
+/**
+ * A binary min-heap of (key, value) pairs, stored in a growable array.
+ */
+typedef struct heap_elt {
+  u_int32 key;
+  u_int32 value;
+} heap_elt_t;
+
+typedef struct heap {
+  u_int32     size;      /* Number of elements */
+  u_int32     capacity;  /* Number of allocated elements */
+  heap_elt_t *elts;
+} heap_t;
+
+/**
+ * @name empty_heap - Allocates a new, empty heap
+ * @return An empty heap, which will need to be eventually freed with delete_heap
+ */
+heap_t *empty_heap();
+/**
+ * @name is_empty_heap - Tests whether the given heap is empty
+ * @param h            - A non-null pointer to the heap
+ * @return TRUE if the heap is empty, FALSE otherwise
+ */
+bool is_empty_heap(heap_t *h);
+
+/**
+ * @name heap_insert - Inserts an element in the heap, in O(log n)
+ * @param h          - The heap
+ * @param key        - The key of the element (the smallest one is on top)
+ * @param value      - The element to insert
+ * @return void
+ */
+void heap_insert(heap_t *h, u_int32 key, u_int32 value);
+/**
+ * @name heap_min - Returns the element with the smallest key, in O(1)
+ * @param h       - A non-empty heap
+ * @return heap_elt_t
+ */
+heap_elt_t heap_min(heap_t *h);
+/**
+ * @name heap_pop - Removes the element with the smallest key, in O(log n)
+ * @param h       - A non-empty heap
+ * @return heap_elt_t
+ */
+heap_elt_t heap_pop(heap_t *h);
+/**
+ * @name heap_remove - Removes the first occurrence of a value, in O(n)
+ * @param h          - The heap
+ * @param value      - The value to remove
+ * @return bool      - Whether the value was found
+ */
+bool heap_remove(heap_t *h, u_int32 value);
+
+/**
+ * @name delete_heap - Frees a whole heap
+ * @param h          - The heap to free
+ * @return void
+ */
+void delete_heap(heap_t *h);
+
+#endif
@@ -0,0 +1,41 @@
+#include "histogram.h"
+#include "printer.h"
+
+
+u_int32 read_tsc()
+{
+  u_int32 low, high;
+  asm volatile ("rdtsc" : "=a" (low), "=d" (high));
+  return low;
+}
+
+
+void hist_add(histogram_t *h, u_int32 cycles)
+{
+  u_int32 bucket = 0;
+  while (bucket < HIST_BUCKETS - 1 && (cycles >> (bucket + 1))) {
+    bucket++;
+  }
+  h->buckets[bucket]++;
+
+  if (!h->count || cycles < h->min) {
+    h->min = cycles;
+  }
+  if (cycles > h->max) {
+    h->max = cycles;
+  }
+  h->count++;
+}
+
+
+void print_histogram(string name, histogram_t *h)
+{
+  writef("%f%s%f: %u calls, min %u, max %u cycles\n", LightBlue, name, White, \
+         h->count, h->min, h->max);
+
+  for (u_int32 bucket = 0; bucket < HIST_BUCKETS; bucket++) {
+    if (h->buckets[bucket]) {
+      writef("\t>= 2^%u:\t%u\n", bucket, h->buckets[bucket]);
+    }
+  }
+}
@@ -0,0 +1,42 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include "types.h"
+#include "string.h"
+
+#define HIST_BUCKETS 32
+
+
+/**
+ * A logarithmic histogram of durations, measured in processor cycles.
+ */
+typedef struct histogram {
+  u_int32 count;                  /* Number of measures */
+  u_int32 min, max;               /* Extreme measures */
+  u_int32 buckets[HIST_BUCKETS];  /* buckets[i] counts the measures in [2^i, 2^(i+1)[ */
+} histogram_t;
+
+
+/**
+ * @name read_tsc - Reads the time-stamp counter (number of cycles since reset)
+ * @return u_int32 - The lower 32 bits of the counter
+ */
+u_int32 read_tsc();
+
+/**
+ * @name hist_add - Records a measure in a histogram
+ * @param h       - The histogram
+ * @param cycles  - The measured duration, in cycles
+ * @return void
+ */
+void hist_add(histogram_t *h, u_int32 cycles);
+
+/**
+ * @name print_histogram - Writes the non-empty buckets of a histogram
+ * @param name           - The name of the histogram
+ * @param h              - The histogram
+ * @return void
+ */
+void print_histogram(string name, histogram_t *h);
+
+#endif
@@ -1,5 +1,7 @@
 #include "irq.h"
 #include "gdt.h"
+#include "smp.h"
+#include "apic.h"
 
 /* This array is actually an array of function pointers. We use
  *  this to handle custom IRQ handlers for a given IRQ */
@@ -9,6 +11,9 @@ void *irq_routines[16] =
     0, 0, 0, 0, 0, 0, 0, 0
   };
 
+/* Same, for the vectors sent by the local APIC only, from APIC_VECTORS */
+void *apic_routines[256 - APIC_VECTORS];
+
 /* This installs a custom IRQ handler for the given IRQ */
 void irq_install_handler(int irq, void (*handler)(struct regs *r))
 {
@@ -21,6 +26,11 @@ void irq_uninstall_handler(int irq)
   irq_routines[irq] = 0;
 }
 
+void apic_install_handler(u_int8 vector, void (*handler)(struct regs *r))
+{
+  apic_routines[vector - APIC_VECTORS] = handler;
+}
+
 /* Normally, IRQs 0 to 7 are mapped to entries 8 to 15.
  * We send commands to the Programmable Interrupt Controller in
  * order to make IRQ0 to 15 be remapped to IDT entries 32 to 47 */
@@ -67,6 +77,13 @@ void irq_install()
   /* kloug(100, "IRQ installed\n"); */
 }
 
+void irq_install_apic()
+{
+  idt_set_gate(IPI_TICK_VECTOR,   (unsigned)apic0,         KERNEL_CODE_SEGMENT, 0);
+  idt_set_gate(APIC_TIMER_VECTOR, (unsigned)apic1,         KERNEL_CODE_SEGMENT, 0);
+  idt_set_gate(APIC_SPURIOUS,     (unsigned)apic_spurious, KERNEL_CODE_SEGMENT, 0);
+}
+
 /* Each of the IRQ ISRs point to this function, rather than
  * the 'fault_handler' in 'isrs.c'. The IRQ Controllers need
  * to be told when you are done servicing them, so you need
@@ -76,28 +93,50 @@ void irq_install()
  * 15) gets an interrupt, you need to acknowledge the
  * interrupt at BOTH controllers, otherwise, you only send
  * an EOI command to the first controller. If you don't send
- * an EOI, you won't raise any more IRQs */
+ * an EOI, you won't raise any more IRQs
+ * The handlers run under the kernel lock, and the interruption
+ * returns through the frame given by the scheduler. */
 
-void irq_handler(struct regs *r)
+regs_t *irq_handler(struct regs *r)
 {
+  lock_kernel();
+
   /* This is a blank function pointer */
   void (*handler)(struct regs *r);
 
-  /* Find out if we have a custom handler to run for this
-   * IRQ, and then finally, run it */
-  handler = irq_routines[r->int_no - 32];
-  if (handler) {
-    handler(r);
-  }
+  if (r->int_no >= APIC_VECTORS) {
+    /* Sent by the local APIC, which is also the one to acknowledge */
+    handler = apic_routines[r->int_no - APIC_VECTORS];
+    if (handler) {
+      handler(r);
+    }
+    lapic_eoi();
+  } else {
+    /* Find out if we have a custom handler to run for this
+     * IRQ, and then finally, run it */
+    handler = irq_routines[r->int_no - 32];
+    if (handler) {
+      handler(r);
+    }
+
+    if (ioapic_enabled) {
+      /* Routed by the IOAPIC: the local APIC acknowledges, the PIC is masked */
+      lapic_eoi();
+    } else {
+      /* If the IDT entry that was invoked was greater than 40
+       * (meaning IRQ8 - 15), then we need to send an EOI to
+       * the slave controller */
+      if (r->int_no >= 40) {
+        outb(0xA0, 0x20);
+      }
 
-  /* If the IDT entry that was invoked was greater than 40
-   * (meaning IRQ8 - 15), then we need to send an EOI to
-   * the slave controller */
-  if (r->int_no >= 40) {
-    outb(0xA0, 0x20);
+      /* In either case, we need to send an EOI to the master
+       * interrupt controller too */
+      outb(0x20, 0x20);
+    }
   }
 
-  /* In either case, we need to send an EOI to the master
-   * interrupt controller too */
-  outb(0x20, 0x20);
+  regs_t *frame = resume_frame(r);
+  unlock_kernel();
+  return frame;
 }
@@ -13,6 +13,16 @@
 void irq_install_handler(int irq, void (*handler)(struct regs *r));
 
 
+/**
+ *  @name apic_install_handler - Same as irq_install_handler, for a vector
+ *  sent by the local APIC only
+ *
+ *  @param vector  - The vector, from APIC_VECTORS
+ *  @param handler - The handler to install
+ */
+void apic_install_handler(u_int8 vector, void (*handler)(struct regs *r));
+
+
 /**
  *  @name irq_uninstall_handler -
  *
@@ -25,11 +35,17 @@ void irq_uninstall_handler(int irq);
  */
 void irq_install();
 
+/**
+ *  @name irq_install_apic - Sets the handlers of the local APIC vectors.
+ */
+void irq_install_apic();
+
 /**
  *  @name irq_handler -
  *
  *  @param r - Wrapper for the registers' state
+ *  @return regs_t* - The frame through which the interruption returns
  */
-void irq_handler(struct regs *r);
+regs_t *irq_handler(struct regs *r);
 
 #endif
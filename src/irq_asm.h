@@ -20,4 +20,9 @@ void irq13();
 void irq14();
 void irq15();
 
+/* Interruptions sent by the local APIC only, from APIC_VECTORS */
+void apic0();
+void apic1();
+void apic_spurious();
+
 #endif
@@ -8,6 +8,16 @@ irq%1:
   jmp common_irq_handler
 %endmacro
 
+%macro apic_request_handler 1
+global apic%1
+
+apic%1:
+  push dword 0            ; push 0 as error code
+  cli                     ; disable interrupts
+  push dword (0xF0+%1)    ; push the interrupt number, see APIC_VECTORS
+  jmp common_irq_handler
+%endmacro
+
 extern irq_handler
 
 
@@ -28,7 +38,8 @@ common_irq_handler:
   push eax
   mov eax, irq_handler
   call eax
-  pop eax
+  mov esp, eax            ; Returns through the frame given by irq_handler, which
+                          ; is on another kernel stack if the process changed
   pop gs
   pop fs
   pop es
@@ -54,3 +65,11 @@ interrupt_request_handler 12
 interrupt_request_handler 13
 interrupt_request_handler 14
 interrupt_request_handler 15
+
+;; local APIC interruptions
+apic_request_handler  0
+apic_request_handler  1
+
+global apic_spurious
+apic_spurious:            ; Spurious interruptions need no end of interruption
+  iret
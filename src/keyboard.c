@@ -274,11 +274,10 @@ void keyboard_shell_handler(struct regs *r)
   /* Read from the keyboard's data buffer */
   scancode = inb(0x60);
 
+  /* The malloc globals always hold the kernel heap state, only paging changes */
   page_directory_t *temp = current_directory;
-  void *temp_um = unallocated_mem, *temp_ffb = first_free_block;
   bool change_dir = temp != kernel_directory;
   if (change_dir) {
-    unallocated_mem = kernel_context.unallocated_mem; first_free_block = kernel_context.first_free_block;
     switch_page_directory(kernel_directory);
   }
 
@@ -368,8 +367,6 @@ void keyboard_shell_handler(struct regs *r)
       kill_family(pid);
     }
     if (change_dir) {
-      kernel_context.unallocated_mem = unallocated_mem; kernel_context.first_free_block = first_free_block;
-      unallocated_mem = temp_um; first_free_block = temp_ffb;
       switch_page_directory(temp);
     }
     return;
@@ -511,8 +508,6 @@ void keyboard_shell_handler(struct regs *r)
     }
   if (change_dir) {
     switch_page_directory(temp);
-    kernel_context.unallocated_mem = unallocated_mem; kernel_context.first_free_block = first_free_block;
-    unallocated_mem = temp_um; first_free_block = temp_ffb;
   }
 }
 #pragma GCC diagnostic pop
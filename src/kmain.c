@@ -6,6 +6,8 @@
 #include "fs_inter.h"
 #include "shell.h"
 #include "scheduler.h"
+#include "smp.h"
+#include "apic.h"
 
 /** kmain.c
  *  Contains the kernel main function.
@@ -34,7 +36,7 @@ int kmain(multiboot_info_t* mbd, u_int32 stack_start, u_int32 stack_size)
 
   /* Segmentation and interruptions */
   gdt_install();
-  /* kloug(100, "%x %x %x %x %x %x %x\n", KERNEL_CODE_SEGMENT, KERNEL_DATA_SEGMENT, KERNEL_STACK_SEGMENT, USER_CODE_SEGMENT, USER_DATA_SEGMENT, USER_STACK_SEGMENT, TSS_SEGMENT); */
+  /* kloug(100, "%x %x %x %x %x %x %x\n", KERNEL_CODE_SEGMENT, KERNEL_DATA_SEGMENT, KERNEL_STACK_SEGMENT, USER_CODE_SEGMENT, USER_DATA_SEGMENT, USER_STACK_SEGMENT, TSS_SEGMENTS[0]); */
   init_pic();
   /* timer_install(); */
   keyboard_install(TRUE);
@@ -44,6 +46,8 @@ int kmain(multiboot_info_t* mbd, u_int32 stack_start, u_int32 stack_size)
   idt_install();
   isrs_install();
   irq_install();
+  smp_install();
+  apic_install();
 
   filesystem_install();
   fs_inter_install();
@@ -21,3 +21,13 @@ void mem_copy(void *dest, const void *source, size_t len)
     /* Or, if you'd like it put more simply, *(ptr_d++) = *(ptr_s++); */
   }
 }
+
+void mem_copy_words(void *dest, const void *source, size_t len)
+{
+  u_int32 *words_s = (u_int32 *)source;
+  u_int32 *words_d = (u_int32 *)dest;
+  for (; len >= 4; len -= 4) {
+    *(words_d++) = *(words_s++);
+  }
+  mem_copy(words_d, words_s, len);
+}
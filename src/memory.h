@@ -26,4 +26,13 @@ void mem_set(void* str, u_int8 c, size_t len);
  */
 void mem_copy(void *dest, const void *source, size_t len);
 
+/** mem_copy_words:
+ *  Same as mem_copy, four bytes at a time. The areas must not overlap.
+ *
+ *  @param dest   The area to overwrite
+ *  @param source The area to copy from
+ *  @param len    The number of bytes to fill
+ */
+void mem_copy_words(void *dest, const void *source, size_t len);
+
 #endif
@@ -8,6 +8,7 @@
 #include "malloc.h"
 #include "process.h"
 #include "scheduler.h"
+#include "utils.h"
 
 /* Source material: http://www.jamesmolloy.co.uk/tutorial_html/6.-Paging.html */
 
@@ -41,6 +42,9 @@ void flush_tlb(u_int32 address)
 {
   /* asm volatile ("invlpg (%0)" : : "r" (address)); */
   asm volatile ("mov %cr3, %eax; mov %eax, %cr3");
+  /* The other processors flush theirs when taking the kernel lock */
+  tlb_generation++;
+  cpus[cpu_id()].tlb_generation = tlb_generation;
 }
 #pragma GCC diagnostic pop
 
@@ -283,6 +287,198 @@ u_int32 request_physical_space(page_directory_t *dir, u_int32 physical_address,
   return virtual_address;
 }
 
+bool map_mmio(page_directory_t *dir, u_int32 physical_address)
+{
+  u_int32 address = physical_address & 0xFFFFF000;
+  page_table_entry_t *page = get_page(dir, address, TRUE, TRUE);
+
+  if (page->present) {
+    return page->address == address / 0x1000;
+  }
+
+  /* Not marked in the frames bitset, which only covers the usable memory */
+  page->present        = TRUE;
+  page->rw             = TRUE;
+  page->user           = FALSE;
+  page->write_through  = TRUE;
+  page->cache_disabled = TRUE;
+  page->address        = address / 0x1000;
+
+  flush_tlb(address);
+  return TRUE;
+}
+
+bool share_kernel_pages(page_directory_t *dir, u_int32 address, u_int32 size)
+{
+  for (u_int32 page = address & 0xFFFFF000; page < address + size; page += 0x1000) {
+    u_int32 frame = get_physical_address(kernel_directory, page) / 0x1000;
+    if (!frame) {
+      return FALSE;
+    }
+
+    page_table_entry_t *entry = get_page(dir, page, TRUE, TRUE);
+    if (entry->present) {
+      if (entry->address != frame) {
+        return FALSE;  /* The virtual page is used for something else */
+      }
+    } else {
+      map_page_to_frame(entry, frame, TRUE, TRUE);
+    }
+  }
+  return TRUE;
+}
+
+/**
+ * @name is_lazy_page - Whether an address is in a lazy page not mapped yet
+ * @param dir         - The page directory of the process
+ * @param address     - The address
+ * @return bool
+ */
+bool is_lazy_page(page_directory_t *dir, u_int32 address)
+{
+  return (address - dir->lazy_start) / 0x1000 < dir->lazy_pages
+    && !get_physical_address(dir, address);
+}
+
+bool map_lazy_page(page_directory_t *dir, u_int32 address)
+{
+  return is_lazy_page(dir, address) && fill_user_page(dir, address, NULL, 0, TRUE);
+}
+
+u_int8 *map_user_page(page_directory_t *dir, u_int32 address, bool is_writable)
+{
+  u_int32 frame_address = address / 0x1000;
+  u_int32 table_index   = frame_address / 1024;
+  if (is_lazy_page(dir, address) && !map_lazy_page(dir, address)) {
+    return NULL;
+  }
+  if (!dir->entries[table_index].present || !dir->entries[table_index].user) {
+    return NULL;
+  }
+  page_table_entry_t page = dir->tables[table_index]->pages[frame_address % 1024];
+  if (!page.present || !page.user || (is_writable && !page.rw)) {
+    return NULL;  /* The kernel data is not a user buffer */
+  }
+
+  /* Each processor only flushes its own TLB, hence one window each */
+  u_int32 window = USER_WINDOWS + cpu_id() * 0x1000;
+  page_table_entry_t *entry = get_page(kernel_directory, window, TRUE, TRUE);
+  if (!entry->present || entry->address != page.address) {
+    /* The frame belongs to its process, and only this processor uses the
+     * window: neither the frame bitmap nor the other processors are involved */
+    entry->present = TRUE;
+    entry->rw      = TRUE;
+    entry->user    = FALSE;
+    entry->address = page.address;
+    asm volatile ("invlpg (%0)" : : "r" (window) : "memory");
+  }
+
+  return (u_int8 *)(window + address % 0x1000);
+}
+
+bool fill_user_page(page_directory_t *dir, u_int32 address, const void *bytes, u_int32 length,
+                    bool is_writable)
+{
+  page_table_entry_t *page = get_page(dir, address, FALSE, is_writable);
+  bool fresh = !page->present;
+  if (fresh && !map_page(page, FALSE, is_writable)) {
+    return FALSE;
+  }
+  if (!fresh && is_writable && !page->rw) {
+    page->rw = TRUE;
+    flush_tlb(address);
+  }
+
+  /* The window of the kernel is writable, whatever the rights of the process */
+  u_int8 *kernel = map_user_page(dir, address & 0xFFFFF000, FALSE);
+  if (fresh) {
+    mem_set(kernel, 0, 0x1000);
+  }
+  mem_copy_words(kernel + address % 0x1000, bytes, length);
+  return TRUE;
+}
+
+/**
+ * @name user_copy - Copies bytes between the kernel and a process, one page of
+ * the process at a time
+ * @param dir      - The page directory of the process
+ * @param address  - The address of the bytes in the process
+ * @param kernel   - The kernel buffer
+ * @param length   - The number of bytes
+ * @param to_user  - Whether the bytes go to the process
+ * @return bool    - Whether every byte was copied
+ */
+bool user_copy(page_directory_t *dir, u_int32 address, u_int8 *kernel, u_int32 length,
+               bool to_user)
+{
+  for (u_int32 done = 0; done < length;) {
+    u_int8 *user = map_user_page(dir, address + done, to_user);
+    if (!user) {
+      return FALSE;
+    }
+    u_int32 width = min(length - done, 0x1000 - (address + done) % 0x1000);
+    if (to_user) {
+      mem_copy_words(user, kernel + done, width);
+    } else {
+      mem_copy_words(kernel + done, user, width);
+    }
+    done += width;
+  }
+  return TRUE;
+}
+
+bool copy_from_user(page_directory_t *dir, void *dest, u_int32 src, u_int32 length)
+{
+  return user_copy(dir, src, dest, length, FALSE);
+}
+
+bool copy_to_user(page_directory_t *dir, u_int32 dest, const void *src, u_int32 length)
+{
+  return user_copy(dir, dest, (u_int8 *)src, length, TRUE);
+}
+
+bool clear_user(page_directory_t *dir, u_int32 dest, u_int32 length)
+{
+  for (u_int32 done = 0; done < length;) {
+    u_int8 *user = map_user_page(dir, dest + done, TRUE);
+    if (!user) {
+      return FALSE;
+    }
+    u_int32 width = min(length - done, 0x1000 - (dest + done) % 0x1000);
+    mem_set(user, 0, width);
+    done += width;
+  }
+  return TRUE;
+}
+
+s_int32 strncpy_from_user(page_directory_t *dir, char *dest, u_int32 src, u_int32 size)
+{
+  u_int8 *user = NULL;
+  for (u_int32 i = 0; i < size; i++) {
+    if (!user || (src + i) % 0x1000 == 0) {
+      user = map_user_page(dir, src + i, FALSE);
+      if (!user) {
+        return -1;
+      }
+    }
+    dest[i] = *(user++);
+    if (dest[i] == '\0') {
+      return i;
+    }
+  }
+  return -1;  /* Not terminated within size */
+}
+
+void map_shared_frame(page_directory_t *dir, u_int32 address, u_int32 frame)
+{
+  page_table_entry_t *page = get_page(dir, address, FALSE, FALSE);
+  if (page->present) {
+    free_page(page, !(page->available & PAGE_SHARED));
+  }
+  map_page_to_frame(page, frame, FALSE, FALSE);
+  page->available = PAGE_SHARED;
+}
+
 void free_virtual_space(page_directory_t *dir, u_int32 virtual_address, bool free_frame)
 {
   page_table_entry_t *page = get_page(dir, virtual_address, TRUE, FALSE);
@@ -297,26 +493,25 @@ void switch_page_directory(page_directory_t *dir)
   /* kloug(100, "Switching page directory to the one at %X\n", dir->physical_address, 8); */
   /* kloug(100, "dir %X phys %X entries %X\n", dir, 8, dir->physical_address, 8, dir->entries, 8); */
 
-  /* Disables paging */
-  u_int32 cr0;
-  asm volatile ("mov %%cr0, %0" : "=r" (cr0));
-  /* cr0 &= ~0x80000000; */
-  /* asm volatile ("mov %0, %%cr0" : : "r" (cr0)); */
+  if (paging_enabled && dir == current_directory) {
+    return;  /* Reloading cr3 would only flush the TLB */
+  }
 
   /* Loads address of the current directory into cr3 */
   current_directory = dir;
   u_int32 to_write = dir->physical_address;
   /* kloug(100, "Before writing %X to cr3\n", to_write, 8); */
   asm volatile ("mov %0, %%cr3"  : : "r" (to_write));
-  u_int32 cr3;
-  asm volatile ("mov %%cr3, %0" : "=r" (cr3));
-  /* kloug(100, "Wrote %X to cr3\n", cr3, 8); */
 
-  /* Enables paging! */
-  cr0 |= 0x80000000;
-  /* kloug(100, "Before writing to cr0\n"); */
-  asm volatile ("mov %0, %%cr0" : : "r" (cr0));
-  /* kloug(100, "Wrote to cr0\n"); */
+  if (!paging_enabled) {
+    /* Enables paging! */
+    u_int32 cr0;
+    asm volatile ("mov %%cr0, %0" : "=r" (cr0));
+    cr0 |= 0x80000000;
+    /* kloug(100, "Before writing to cr0\n"); */
+    asm volatile ("mov %0, %%cr0" : : "r" (cr0));
+    /* kloug(100, "Wrote to cr0\n"); */
+  }
 }
 
 
@@ -347,6 +542,19 @@ void page_fault_handler(regs_t *regs)
    *   1  1  1 - User process tried to write a page and caused a protection fault
    */
 
+  /* The first access of the process to a lazy page */
+  if (us && !present) {
+    lock_kernel();
+    page_directory_t *dir = current_directory;
+    switch_page_directory(kernel_directory);  /* For the window of map_lazy_page */
+    bool mapped = map_lazy_page(dir, faulting_address);
+    switch_page_directory(dir);
+    unlock_kernel();
+    if (mapped) {
+      return;  /* The access is made again */
+    }
+  }
+
   /* Temporary, TODO remove */
   writef("Page fault at %x, p %u r %u user %u reserved %u instruction fetch %u\n", \
          faulting_address, present, rw, us, reserved, id);
@@ -529,36 +737,31 @@ void paging_install()
 }
 
 
-page_directory_t *new_page_dir(void **user_first_free_block, void **user_unallocated_mem)
+/**
+ * @name map_user_pages - Maps one page of user stack and one of heap, and sets
+ * up malloc on the heap
+ * The code pages are mapped by the loader, segment by segment.
+ * @param dir                   - The page directory, without user pages
+ * @param user_first_free_block - Where to put the malloc state of the process
+ * @param user_unallocated_mem  - Same
+ * @return void
+ */
+void map_user_pages(page_directory_t *dir, void **user_first_free_block, void **user_unallocated_mem)
 {
-  /* kloug(100, "New page dir\n"); */
-  /* log_memory(); */
-
-  page_directory_t *new = clone_directory(base_directory);
-  /* log_page_dir(new); */
-
-  /* Add pages for the code, until the end of virtual memory (address will loop to 0) */
-  for (u_int32 address = START_OF_USER_CODE; address != 0; address += 0x1000) {
-    if (!request_virtual_space(new, address, FALSE, TRUE)) {
-      throw("Unable to add user code!");
-      /* TODO: free and return NULL */
-    }
-  }
-
   /* Add one page of user stack */
-  if (!request_virtual_space(new, START_OF_USER_STACK, FALSE, TRUE)) {
+  if (!request_virtual_space(dir, START_OF_USER_STACK, FALSE, TRUE)) {
     throw("Unable to add user stack!");
     /* TODO: free and return NULL */
   }
 
   /* And one page of user heap */
-  if (!request_virtual_space(new, START_OF_USER_HEAP, FALSE, TRUE)) {
+  if (!request_virtual_space(dir, START_OF_USER_HEAP, FALSE, TRUE)) {
     throw("Unable to add user heap!");
     /* TODO: free and return NULL */
   }
 
   /* Adding malloc: we need to map this user heap page */
-  u_int32 heap_physical = get_physical_address(new, START_OF_USER_HEAP);
+  u_int32 heap_physical = get_physical_address(dir, START_OF_USER_HEAP);
   /* kloug(100, "Start of user heap is %X, mapped at physical %X\n", \
      START_OF_USER_HEAP, 8, heap_physical, 8); */
   u_int32 heap_virtual = request_physical_space(current_directory, heap_physical, TRUE, FALSE);
@@ -569,11 +772,46 @@ page_directory_t *new_page_dir(void **user_first_free_block, void **user_unalloc
   *user_unallocated_mem  = (void *)START_OF_USER_HEAP + 0x1000;
 
   free_virtual_space(current_directory, heap_virtual, FALSE);  /* The frame is used by the process */
+}
+
+page_directory_t *new_page_dir(void **user_first_free_block, void **user_unallocated_mem)
+{
+  /* kloug(100, "New page dir\n"); */
+  /* log_memory(); */
+
+  page_directory_t *new = clone_directory(base_directory);
+  /* log_page_dir(new); */
+
+  map_user_pages(new, user_first_free_block, user_unallocated_mem);
 
   /* kloug(100, "New page dir successfully created\n"); */
   return new;
 }
 
+void reset_page_dir(page_directory_t *dir, void **user_first_free_block, void **user_unallocated_mem)
+{
+  for (u_int32 table_index = 0; table_index < 1024; table_index++) {
+    if (!dir->entries[table_index].present) {
+      continue;
+    }
+    page_table_t *table = dir->tables[table_index];
+    for (u_int32 page_index = 0; page_index < 1024; page_index++) {
+      u_int32 virtual = 0x1000 * (page_index + 1024 * table_index);
+      page_table_entry_t *page = &table->pages[page_index];
+      if (page->present && !get_physical_address(base_directory, virtual)) {
+        free_page(page, !(page->available & PAGE_SHARED));
+        /* No stale frame left for free_page_dir */
+        mem_set(page, 0, sizeof(page_table_entry_t));
+      }
+    }
+  }
+
+  dir->lazy_start = dir->lazy_pages = 0;
+
+  /* The page tables are kept, and reused by the new pages */
+  map_user_pages(dir, user_first_free_block, user_unallocated_mem);
+}
+
 page_directory_t *fork_page_dir(page_directory_t *dir)
 {
   /* kloug(100, "Forking directory\n"); */
@@ -586,6 +824,8 @@ page_directory_t *fork_page_dir(page_directory_t *dir)
 #define RET_NULL() { kloug(100, "Fork failed\n"); free_page_dir(fork); return NULL; }
 
   fork->physical_address = get_physical_address(current_directory, (u_int32)fork);
+  fork->lazy_start = dir->lazy_start;  /* Those not accessed yet stay lazy */
+  fork->lazy_pages = dir->lazy_pages;
 
   for (u_int32 table_index = 0; table_index < 1024; table_index++) {
     if (dir->entries[table_index].present) {
@@ -606,6 +846,8 @@ page_directory_t *fork_page_dir(page_directory_t *dir)
           u_int32 virtual = table_index*1024*0x1000 + page_index*0x1000;
           if (get_physical_address(base_directory, virtual)) {
             /* The page is present in base directory: link! */
+          } else if (table->pages[page_index].available & PAGE_SHARED) {
+            /* A read-only page of the executable cache: link too */
           } else {
             /* Copy the page */
             u_int32 physical = first_false_bit(frames);
@@ -657,8 +899,10 @@ void free_page_dir(page_directory_t *dir)
       for (int page_index = 0; page_index < 1024; page_index++) {
         u_int32 virtual = 0x1000 * (page_index + 1024 * table_index);
         if (!get_physical_address(base_directory, virtual)) {
-          /* Page not in base directory (and not frame 0): free frame! */
-          free_virtual_space(dir, virtual, TRUE);
+          /* Page not in base directory (and not frame 0): free frame, unless
+           * it belongs to the executable cache! */
+          page_table_entry_t page = dir->tables[table_index]->pages[page_index];
+          free_virtual_space(dir, virtual, !(page.available & PAGE_SHARED));
         }
       }
       mem_free(dir->tables[table_index]);
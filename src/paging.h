@@ -7,11 +7,16 @@
 
 #include "types.h"
 #include "bitset.h"
+#include "smp.h"
 
 /* Reference for paging directory structure: http://valhalla.bofh.pl/~l4mer/WDM/secureread/pde-pte.htm */
 
 u_int32 START_OF_USER_STACK, START_OF_USER_HEAP, START_OF_USER_CODE;
 
+/* One page per processor in kernel_directory, below the kernel stacks, through
+ * which the kernel reaches the user buffers without switching directories */
+#define USER_WINDOWS 0xDF000000
+
 /* Whether the paging is enabled */
 bool paging_enabled;  /* This must be set to FALSE by kmain before anything */
 
@@ -35,6 +40,10 @@ typedef struct page_table_entry {
   u_int32 address        : 20;  /* Page address (physical address, shifted right 12 bits) */
 } __attribute__((packed)) page_table_entry_t;
 
+/* In the available bits of a user page: its frame belongs to the executable
+ * cache (see exec_cache.h), and is not freed with the page directory */
+#define PAGE_SHARED 0x1
+
 typedef struct page_table {
   page_table_entry_t pages[1024];
 } __attribute__((packed)) page_table_t;
@@ -65,10 +74,16 @@ typedef struct page_directory
 
   /* The physical address of the page directory */
   u_int32 physical_address;
+
+  /* User pages mapped to zeroed frames on their first access (the bss), from
+   * lazy_start: see map_lazy_page */
+  u_int32 lazy_start;
+  u_int32 lazy_pages;
 } __attribute__((packed)) page_directory_t;
 
 
-page_directory_t* current_directory;
+page_directory_t* current_directories[MAX_CPUS];  /* The directory loaded by each processor */
+#define current_directory (current_directories[cpu_id()])
 page_directory_t* kernel_directory;
 page_directory_t* base_directory;    /* Copy of the original kernel directory */
 
@@ -109,6 +124,115 @@ bool request_virtual_space(page_directory_t *dir, u_int32 virtual_address, \
  */
 u_int32 request_physical_space(page_directory_t *dir, u_int32 physical_address, \
                                bool is_kernel, bool is_writable);
+/**
+ * @name map_mmio          - Identity maps a physical page which is not in the frames,
+ * such as device registers or firmware tables, with the cache disabled
+ * @param dir              - The page directory
+ * @param physical_address - An address in the page
+ * @return bool            - Whether the page is mapped (FALSE if its virtual page is used)
+ */
+bool map_mmio(page_directory_t *dir, u_int32 physical_address);
+/**
+ * @name share_kernel_pages - Maps pages of kernel_directory at the same addresses
+ * in another directory, for the kernel data which must be reachable from every one
+ * The pages must not be used for something else in the directory.
+ * @param dir               - The page directory
+ * @param address           - The start of the kernel data
+ * @param size              - The size of the kernel data
+ * @return bool             - Whether every page could be mapped
+ */
+bool share_kernel_pages(page_directory_t *dir, u_int32 address, u_int32 size);
+
+/**
+ * @name map_user_page - Maps the frame of a user page at the window of the current
+ * processor in kernel_directory, replacing what it mapped before
+ * A lazy page is mapped first (see map_lazy_page).
+ * @param dir          - The page directory of the process
+ * @param address      - An address of the process
+ * @param is_writable  - Whether the kernel will write at this address
+ * @return u_int8*     - The address in kernel_directory corresponding to address,
+ *                       or NULL if it is not in a (writable) page of the process
+ */
+u_int8 *map_user_page(page_directory_t *dir, u_int32 address, bool is_writable);
+
+/**
+ * @name map_lazy_page - Maps a lazy page of a process to a zeroed frame
+ * The kernel_directory must be loaded.
+ * @param dir          - The page directory of the process
+ * @param address      - An address of the process
+ * @return bool        - Whether address was in a lazy page not mapped yet
+ */
+bool map_lazy_page(page_directory_t *dir, u_int32 address);
+
+/**
+ * @name fill_user_page - Copies bytes into a page of a process, first mapping
+ * it to a zeroed frame if needed
+ * The kernel_directory must be loaded.
+ * @param dir           - The page directory of the process
+ * @param address       - Where to copy the bytes in the process
+ * @param bytes         - The bytes, which must fit in the page of address
+ * @param length        - Their number, possibly 0 to only map a zeroed page
+ * @param is_writable   - Whether the process may write the page, which stays
+ *                        writable if it already was
+ * @return bool         - FALSE if there is no free frame left
+ */
+bool fill_user_page(page_directory_t *dir, u_int32 address, const void *bytes, u_int32 length,
+                    bool is_writable);
+
+/**
+ * @name copy_from_user - Copies bytes of a process into the kernel
+ * The kernel_directory must be loaded. The copy stops at the first byte which is
+ * not in a page of the process, so that bad pointers fail instead of faulting.
+ * @param dir           - The page directory of the process
+ * @param dest          - The kernel buffer
+ * @param src           - The address of the bytes in the process
+ * @param length        - Their number
+ * @return bool         - Whether every byte was copied
+ */
+bool copy_from_user(page_directory_t *dir, void *dest, u_int32 src, u_int32 length);
+
+/**
+ * @name copy_to_user - Copies bytes of the kernel into a process
+ * Same as copy_from_user, the pages of the process having to be writable.
+ * @param dir         - The page directory of the process
+ * @param dest        - The address of the buffer in the process
+ * @param src         - The kernel bytes
+ * @param length      - Their number
+ * @return bool       - Whether every byte was copied
+ */
+bool copy_to_user(page_directory_t *dir, u_int32 dest, const void *src, u_int32 length);
+
+/**
+ * @name clear_user - Zeroes bytes of a process
+ * Same as copy_to_user.
+ * @param dir       - The page directory of the process
+ * @param dest      - The address of the bytes in the process
+ * @param length    - Their number
+ * @return bool     - Whether every byte was zeroed
+ */
+bool clear_user(page_directory_t *dir, u_int32 dest, u_int32 length);
+
+/**
+ * @name strncpy_from_user - Copies a string of a process into the kernel
+ * @param dir              - The page directory of the process
+ * @param dest             - The kernel buffer
+ * @param src              - The address of the string in the process
+ * @param size             - The size of dest
+ * @return s_int32         - The length of the string, or -1 if it does not fit
+ *                           in dest or is not in the pages of the process
+ */
+s_int32 strncpy_from_user(page_directory_t *dir, char *dest, u_int32 src, u_int32 size);
+
+/**
+ * @name map_shared_frame - Maps a user page to a frame of the executable cache,
+ * read-only, freeing the frame it mapped before
+ * @param dir             - The page directory of the process
+ * @param address         - An address in the page
+ * @param frame           - The frame (physical address / 0x1000)
+ * @return void
+ */
+void map_shared_frame(page_directory_t *dir, u_int32 address, u_int32 frame);
+
 /**
  * @name free_virtual_space - Frees up the virtual space, so someone else can access it
  * @param dir               - The page directory (usually current_directory)
@@ -121,6 +245,7 @@ void free_virtual_space(page_directory_t *dir, u_int32 virtual_address, bool fre
 
 /**
  * @name switch_page_directory - Loads the new page directory into the CR3 register
+ * Nothing is done if it is already the current one
  * @param new                  -
  * @return void
  */
@@ -138,6 +263,18 @@ void switch_page_directory(page_directory_t *new);
  */
 page_directory_t *new_page_dir(void **user_first_free_block, void **user_unallocated_mem);
 
+/**
+ * @name reset_page_dir - Frees every user page of a directory, then maps fresh
+ * code, stack and heap pages like new_page_dir
+ * The kernel pages and the page tables are kept. The directory must not be the
+ * current one.
+ * @param dir                   - The page directory
+ * @param user_first_free_block - Where to put the new malloc state
+ * @param user_unallocated_mem  - Same
+ * @return void
+ */
+void reset_page_dir(page_directory_t *dir, void **user_first_free_block, void **user_unallocated_mem);
+
 /**
 * @name fork_page_dir - Creates a new page directory with the kernel linked and user data copied
 * @param dir          - The directory of the forking process
@@ -0,0 +1,88 @@
+#include "pipe.h"
+#include "scheduler.h"
+
+pipe_t pipes[NUM_PIPES];
+u_int8 pipe_rings[NUM_PIPES][RING_SIZE];  /* In the kernel image, see ring_t */
+
+
+s_int32 new_pipe()
+{
+  for (s_int32 p = 0; p < NUM_PIPES; p++) {
+    pipe_t *pipe = &pipes[p];
+    if (!pipe->used) {
+      pipe->used    = TRUE;
+      pipe->readers = 0;
+      pipe->writers = 0;
+      pipe->ring.data  = pipe_rings[p];
+      pipe->ring.start = 0;
+      pipe->ring.count = 0;
+      pipe->read_wait.first  = pipe->read_wait.last  = NO_PID;
+      pipe->write_wait.first = pipe->write_wait.last = NO_PID;
+      return p;
+    }
+  }
+
+  return -1;
+}
+
+void pipe_open(u_int32 p, bool write)
+{
+  if (write) {
+    pipes[p].writers++;
+  } else {
+    pipes[p].readers++;
+  }
+}
+
+void pipe_close(u_int32 p, bool write)
+{
+  pipe_t *pipe = &pipes[p];
+  if (write && !--pipe->writers) {
+    wake_up_all(&pipe->read_wait);
+  } else if (!write && !--pipe->readers) {
+    wake_up_all(&pipe->write_wait);
+  }
+
+  if (!pipe->readers && !pipe->writers) {
+    pipe->used = FALSE;
+  }
+}
+
+s_int32 pipe_read(u_int32 p, pid reader, u_int8 *buffer, u_int32 length)
+{
+  pipe_t *pipe = &pipes[p];
+  if (!length) {
+    return 0;
+  }
+  if (!pipe->ring.count) {
+    if (!pipe->writers) {
+      return 0;  /* End of file */
+    }
+    block_process(&pipe->read_wait, reader, Blocked);
+    return PIPE_BLOCKED;
+  }
+
+  s_int32 done = ring_get(&pipe->ring, reader, buffer, length);
+  if (done > 0) {
+    wake_up_all(&pipe->write_wait);
+  }
+  return done;
+}
+
+s_int32 pipe_write(u_int32 p, pid writer, u_int8 *buffer, u_int32 length, bool from_kernel)
+{
+  pipe_t *pipe = &pipes[p];
+  if (!pipe->readers || !length) {
+    return 0;
+  }
+  if (pipe->ring.count == RING_SIZE) {
+    block_process(&pipe->write_wait, writer, Blocked);
+    return PIPE_BLOCKED;
+  }
+
+  s_int32 done = ring_put(&pipe->ring, writer, buffer, length, from_kernel);
+  if (done > 0) {
+    wake_up_all(&pipe->read_wait);
+  }
+  return done;
+}
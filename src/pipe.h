@@ -0,0 +1,79 @@
+#ifndef PIPE_H
+#define PIPE_H
+
+/* pipe.h:
+ * Pipes: bounded buffers between processes, read and written through file
+ * descriptors (see fs_inter.h). A reader blocks while its pipe is empty, and a
+ * writer while it is full.
+ */
+
+#include "types.h"
+#include "process.h"
+#include "channel.h"
+
+
+#define NUM_PIPES    16
+#define PIPE_BLOCKED (-1)  /* The call must be made again once the process is woken up */
+
+typedef struct pipe {
+  bool         used;
+  u_int32      readers;     /* Number of open read ends */
+  u_int32      writers;     /* Number of open write ends */
+  ring_t       ring;
+  wait_queue_t read_wait;   /* The processes waiting for bytes */
+  wait_queue_t write_wait;  /* The processes waiting for free space */
+} pipe_t;
+
+
+/**
+ * @name new_pipe - Creates a pipe, without any open end
+ * @return s_int32 - The pipe, or -1 if every one is used
+ */
+s_int32 new_pipe();
+
+/**
+ * @name pipe_open - Counts a new end of a pipe
+ * @param p        - The pipe
+ * @param write    - Whether it is a write end
+ * @return void
+ */
+void pipe_open(u_int32 p, bool write);
+
+/**
+ * @name pipe_close - Closes an end of a pipe
+ * The other side is woken up when the last end of a kind is closed: the readers
+ * then get the end of file, and the writers fail. The pipe is freed once both
+ * sides are closed.
+ * @param p         - The pipe
+ * @param write     - Whether it is a write end
+ * @return void
+ */
+void pipe_close(u_int32 p, bool write);
+
+/**
+ * @name pipe_read - Reads from a pipe into the address space of a process
+ * @param p        - The pipe
+ * @param reader   - The process, blocked if the pipe is empty but still has writers
+ * @param buffer   - Where to copy the bytes
+ * @param length   - The size of buffer
+ * @return s_int32 - The number of bytes read (0 at the end of file), PIPE_BLOCKED,
+ *                   or RING_FAULT if buffer is not in the writable pages of reader
+ */
+s_int32 pipe_read(u_int32 p, pid reader, u_int8 *buffer, u_int32 length);
+
+/**
+ * @name pipe_write - Writes to a pipe from the address space of a process, or
+ * from the kernel on its behalf
+ * Only the bytes that fit are written.
+ * @param p         - The pipe
+ * @param writer    - The process, blocked if the pipe is full
+ * @param buffer    - The bytes
+ * @param length    - Their number
+ * @param from_kernel - Whether the bytes are in the kernel rather than in the process
+ * @return s_int32  - The number of bytes written (0 if there is no reader left),
+ *                    PIPE_BLOCKED, or RING_FAULT if buffer is not in the pages
+ *                    of writer
+ */
+s_int32 pipe_write(u_int32 p, pid writer, u_int8 *buffer, u_int32 length, bool from_kernel);
+
+#endif
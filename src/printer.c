@@ -82,13 +82,19 @@ void scroll()
 }
 
 
-void write_char(char c)
+/**
+ *  @name output_char - Writes a character at a position of the framebuffer,
+ *  scrolling if needed, without moving the cursor
+ *  @param cursor_pos - The position
+ *  @param c          - The character
+ *  @return           - The position following the character
+ */
+pos_t output_char(pos_t cursor_pos, char c)
 {
-  pos_t cursor_pos = get_cursor_pos();
   switch (c) {
 
   case '\0': {
-    return;
+    return cursor_pos;
     break;
   }
 
@@ -135,26 +141,60 @@ void write_char(char c)
     cursor_pos -= SCREEN_WIDTH;
   }
 
-  set_cursor_pos(cursor_pos);
+  return cursor_pos;
 }
 
-void write_string(const char *string)
+void write_char(char c)
+{
+  pos_t cursor_pos = get_cursor_pos();
+  if (c == '\0') {
+    return;
+  }
+  set_cursor_pos(output_char(cursor_pos, c));
+}
+
+void write_chars(const char *chars, u_int32 length)
 {
-  for (unsigned int i = 0;; i++) {
-    char c = string[i];
-    if(c=='\0')
-      return;
-    else if(c==0xc2) {
+  /* The cursor is read and moved once for the whole run */
+  pos_t cursor_pos = get_cursor_pos();
+  for (u_int32 i = 0; i < length; i++) {
+    char c = chars[i];
+    if (c == CONSOLE_ESCAPE && i + 2 < length) {
+      if (chars[i+1] == 'f') {
+        foreground = chars[i+2];
+      } else if (chars[i+1] == 'b') {
+        background = chars[i+2];
+      }
+      i += 2;
+    } else if (c == 0xc2 && i + 1 < length) {
       i++;
-      write_char(utf8_c2[(unsigned int)(string[i]-0xa1)]);
-    }
-    else if(c==0xc3) {
+      cursor_pos = output_char(cursor_pos, utf8_c2[(unsigned int)(chars[i]-0xa1)]);
+    } else if (c == 0xc3 && i + 1 < length) {
       i++;
-      write_char(utf8_c3[(unsigned int)(string[i]-0x80)]);
+      cursor_pos = output_char(cursor_pos, utf8_c3[(unsigned int)(chars[i]-0x80)]);
+    } else {
+      cursor_pos = output_char(cursor_pos, c);
+    }
+  }
+  set_cursor_pos(cursor_pos);
+}
+
+u_int32 strip_escapes(char *chars, u_int32 length)
+{
+  u_int32 kept = 0;
+  for (u_int32 i = 0; i < length; i++) {
+    if (chars[i] == CONSOLE_ESCAPE) {
+      i += 2;
+    } else {
+      chars[kept++] = chars[i];
     }
-    else
-      write_char(c);
   }
+  return kept;
+}
+
+void write_string(const char *string)
+{
+  write_chars(string, str_length((char *)string));
 }
 
 void write_int(int n)
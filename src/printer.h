@@ -22,6 +22,9 @@
 #define POS(row, col)  ((row) * SCREEN_WIDTH + (col))
 
 
+/* In the output of the processes, introduces a color change (see write_chars) */
+#define CONSOLE_ESCAPE 0x1B
+
 /* The I/O ports */
 #define ADDRESS_REG (port_t)0x3D4
 #define DATA_REG    (port_t)0x3D5
@@ -109,6 +112,24 @@ void clear();
  */
 void write_char(char c);
 
+/**
+ *  @name write_chars - Writes characters at the end of the framebuffer, moving
+ *  the cursor once
+ *  CONSOLE_ESCAPE followed by 'f' (resp. 'b') and a color sets the foreground
+ *  (resp. background) color. The UTF-8 characters of write_string are converted.
+ *  @param chars  - The characters
+ *  @param length - Their number
+ */
+void write_chars(const char *chars, u_int32 length);
+
+/**
+ *  @name strip_escapes - Removes the color escapes of write_chars from characters
+ *  @param chars        - The characters, modified in place
+ *  @param length       - Their number
+ *  @return             - The number of characters left
+ */
+u_int32 strip_escapes(char *chars, u_int32 length);
+
 /**
  *  @name write_string - Writes a string at the end of the framebuffer.
  *
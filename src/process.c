@@ -2,18 +2,36 @@
 #include "paging.h"
 #include "error.h"
 #include "malloc.h"
+#include "memory.h"
 #include "logging.h"
 #include "gdt.h"
 
 
-process_t new_process(pid parent_id, priority prio, bool create_page_dir)
+process_t new_process(pid id, pid parent_id, priority prio, bool create_page_dir)
 {
   /* kloug(100, "Creating new process\n"); */
 
   process_t proc;
   proc.state = Runnable;
   proc.parent_id = parent_id;
+  proc.first_child = proc.next_sibling = proc.prev_sibling = NO_PID;
+  proc.child_exit.first = proc.child_exit.last = NO_PID;
+  proc.blocked_on = NULL;
+  proc.wait_next = NO_PID;
+  proc.next_free = NO_PID;
+  proc.killed = FALSE;
+  proc.nb_chans = 0;
+  proc.stdin = proc.stdout = 0;
+  proc.out_done = 0;
+  proc.sys_ring = NULL;
+  proc.trace = NULL;
+  proc.image = NULL;
   proc.prio = prio;
+  proc.sched_class = Strict;
+  proc.vruntime = 0;
+  mem_set(&proc.stats, 0, sizeof(proc_stats_t));
+  proc.ready_since = 0;
+  proc.cpu = 0;
 
   context_t ctx;
   if (create_page_dir) {
@@ -23,7 +41,19 @@ process_t new_process(pid parent_id, priority prio, bool create_page_dir)
   }
   /* kloug(100, "Malloc state: %x %x\n", ctx.first_free_block, ctx.unallocated_mem); */
 
-  regs_t *regs = (regs_t *)mem_alloc(sizeof(regs_t));
+  /* The registers lie where an interruption from user mode would have pushed them */
+  ctx.kernel_stack = KERNEL_STACKS + (id + 1) * PROCESS_KERNEL_STACK_SIZE;
+  regs_t *regs = (regs_t *)(ctx.kernel_stack - sizeof(regs_t));
+  init_regs(regs);
+
+  ctx.regs = regs;
+  proc.context = ctx;
+
+  return proc;
+}
+
+void init_regs(regs_t *regs)
+{
   /* The data and general purpose segment registers are set to the user data segment */
   regs->ds = regs->es = regs->fs = regs->gs = USER_DATA_SEGMENT;
   /* All general purpose registers are set to 0 */
@@ -36,9 +66,4 @@ process_t new_process(pid parent_id, priority prio, bool create_page_dir)
   regs->eflags = 0x200;  /* Interruptions */
   regs->useresp = START_OF_USER_STACK;
   regs->ss = USER_STACK_SEGMENT;
-
-  ctx.regs = regs;
-  proc.context = ctx;
-
-  return proc;
 }
@@ -12,6 +12,18 @@ typedef unsigned int pid;
 typedef int priority;           /* 0 indicates a weak priority, MAX_PRIORITY the strongest one */
 #define MAX_PRIORITY     15     /* Priorities range from 0 to 15 */
 
+#define NUM_PROCESSES   128     /* Initial size of the process table */
+#define PROCESS_CHUNK    64     /* Number of processes the table grows by */
+#define MAX_PROCESS_CHUNKS 64   /* Hence at most 4096 concurrent processes */
+#define NO_PID    ((pid)-1)     /* End of the lists of processes */
+#define INIT_PID          1     /* Adopts the orphans */
+#define RECV_CHANNELS     4     /* Maximum number of channels listened to by a receive */
+#define PROCESS_KERNEL_STACK_SIZE 0x2000  /* Size of the kernel stack of each process */
+/* The kernel stacks, one after the other, mapped in every page directory as the
+ * processor pushes the frame of an interruption there before the kernel directory
+ * is loaded. Far from both the user heap and the user stack. */
+#define KERNEL_STACKS 0xE0000000
+
 
 /* The state of the process */
 typedef enum process_state {
@@ -19,13 +31,44 @@ typedef enum process_state {
   Waiting,  /* The process is waiting for onf of his child processes to die */
   Runnable, /* The process does not wait for any result and can be executed */
   Zombie,   /* The process returned, and his parent process has not yet called wait */
+  Sleeping, /* The process waits for a deadline, and is out of the runqueues */
+  Blocked,  /* The process waits on a wait queue, and is out of the runqueues */
 } process_state_t;
 
 
+/* A wait queue: the processes blocked until some event, in FIFO order. They
+ * are linked through their wait_next field, so that blocking allocates nothing. */
+typedef struct wait_queue {
+  pid first;
+  pid last;
+} wait_queue_t;
+
+
+/* The scheduling class of a process */
+typedef enum sched_class {
+  Strict = 0, /* Scheduled by priority, before every fair process (but after them at priority 0) */
+  Fair,       /* Shares the processor with the other fair processes, according to their vruntime */
+} sched_class_t;
+
+#define SCHED_FAIR   0x100  /* Fork flag: the child process is in the Fair class */
+#define SCHED_STRICT 0x200  /* Fork flag: the child process is in the Strict class */
+
+
+/* Accounting of the processor usage of a process */
+typedef struct proc_stats {
+  u_int32 run_time;        /* Time spent running, in ms */
+  u_int32 wait_time;       /* Time spent Runnable but not running, in ms */
+  u_int32 switches;        /* Number of times the process was given the processor */
+  u_int32 voluntary;       /* Number of times it blocked, exited or yielded in a syscall */
+  u_int32 involuntary;     /* Number of times it was preempted */
+} proc_stats_t;
+
+
 /* The context of the process: all the variables he need */
 typedef struct context {
   /* Registers */
-  regs_t *regs;  /* The registers of the process */
+  regs_t *regs;          /* The registers of the process, saved at the top of its kernel stack */
+  u_int32 kernel_stack;  /* Top of the kernel stack, used by interruptions from user mode */
 
   /* Malloc state */
   void *first_free_block;
@@ -38,26 +81,68 @@ typedef struct context {
 context_t kernel_context;
 
 
-/* A process */
+/* A process
+ * The fields read by every selection come first, in the first cache line of
+ * the process, so that scanning the runqueues does not load the cold ones. */
 typedef struct process {
+  /* Hot: scheduling */
   process_state_t state;
+  priority prio;   /* For fair processes, the weight is prio + 1 */
+
+  sched_class_t sched_class;
+  u_int32       vruntime;  /* Weighted running time, in ms (Fair class only) */
 
+  u_int32       cpu;  /* The processor whose runqueues hold the process */
+  u_int32       ready_since;  /* Value of timer_ticks when the process last became ready to run */
+
+  wait_queue_t *blocked_on;  /* The wait queue holding the process, NULL if none */
+  pid      wait_next;        /* Next process in that wait queue */
+
+  /* Cold: family, accounting and context */
   pid      parent_id;
-  priority prio;
+  pid      first_child;   /* The children, linked through their siblings fields */
+  pid      next_sibling;
+  pid      prev_sibling;
+  wait_queue_t child_exit;  /* Where the process waits for its children */
+
+  pid      next_free;     /* Next free process in the free stack, while Free */
+  bool     killed;        /* Killed while a processor used its kernel stack (see kill_family) */
+
+  s_int32  chans[RECV_CHANNELS];  /* The channels the process is blocked on (see channel.c) */
+  u_int32  nb_chans;
+
+  u_int32 *stdin;         /* Pipe ends read and written as STDIN_FD and STDOUT_FD */
+  u_int32 *stdout;        /* (see fs_inter.h), owned by the process, 0 if none */
+  u_int32  out_done;      /* Bytes of the pending ConsoleWrite already written to stdout */
+  void    *sys_ring;      /* The syscall ring in the memory of the process (see syscall.h) */
+  struct trace_ring *trace;  /* Its recent syscalls, NULL if none was traced (see trace.h) */
+  struct exec_image *image;  /* The cached executable it maps, or NULL (see exec_cache.h) */
+
+  proc_stats_t  stats;
 
   context_t context;
-} process_t;
+} __attribute__((aligned(64))) process_t;
 
 
 /**
  * @name new_process      - Returns a new process with a clean paging and malloc state
- *                          What remains to initialize is the kernel esp, regs->esp and regs->eip
+ *                          What remains to initialize is regs->eip, and the
+ *                          children list of the parent (see add_child)
+ * @param id              - Identifier of the process, which gives its kernel stack
  * @param parent_id       - Identifier of the parent process
  * @param prio            - Priority of the process
  * @param create_page_dir - Whether to create a fresh new page directory
  * @return process_t
  */
-process_t new_process(pid parent_id, priority prio, bool create_page_dir);
+process_t new_process(pid id, pid parent_id, priority prio, bool create_page_dir);
+
+/**
+ * @name init_regs - Sets the registers of a process about to start in user mode
+ * What remains to set is eip.
+ * @param regs     - The registers, at the top of its kernel stack
+ * @return void
+ */
+void init_regs(regs_t *regs);
 
 
 #endif
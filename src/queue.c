@@ -56,3 +56,29 @@ u_int32 dequeue(queue_t *q)
 
   return v;
 }
+
+bool dequeue_elt(queue_t *q, u_int32 x)
+{
+  queue_t first = *q;
+  if (!first) {
+    return FALSE;
+  }
+
+  queue_t elt = first;
+  do {
+    if (elt->value == x) {
+      elt->prev->next = elt->next;
+      elt->next->prev = elt->prev;
+      if (elt->next == elt) {
+        *q = NULL;
+      } else if (elt == first) {
+        *q = elt->next;
+      }
+      mem_free(elt);
+      return TRUE;
+    }
+    elt = elt->next;
+  } while (elt != first);
+
+  return FALSE;
+}
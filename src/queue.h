@@ -39,5 +39,12 @@ void enqueue(queue_t *q, u_int32 x);
  * @return The element at the end of the queue
  */
 u_int32 dequeue(queue_t *q);
+/**
+ * @name dequeue_elt - Removes the first occurrence of an element inside a queue
+ * @param q          - A pointer to the queue
+ * @param x          - The element to remove
+ * @return bool      - Whether the element was found
+ */
+bool dequeue_elt(queue_t *q, u_int32 x);
 
 #endif
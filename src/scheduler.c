@@ -9,113 +9,839 @@
 #include "filesystem.h"
 #include "elf.h"
 #include "list.h"
+#include "gdt.h"
+#include "smp.h"
+#include "apic.h"
+#include "trace.h"
+#include "exec_cache.h"
 
 
 scheduler_state_t *state = NULL;
-bool in_kernel = FALSE;     /* If true, we were doing a syscall while we were interrupted */
-bool should_cycle = FALSE;  /* If true, we should select a new process after the current syscall */
 list_t *run_pid = NULL;     /* List of run-launched processes */
 
+histogram_t timer_hist;     /* Durations of timer_handler */
+histogram_t syscall_hist;   /* Durations of syscall_handler */
+
+
+/**
+ * @name select_in_runqueue - Searches a runqueue for a runnable process
+ * The selected process is moved at the end of its runqueue.
+ * @param cpu               - The processor of the runqueue
+ * @param prio              - The priority of the runqueue
+ * @return bool             - Whether a process was found
+ */
+bool select_in_runqueue(cpu_state_t *cpu, priority prio)
+{
+  bool found = FALSE;
+  queue_t *temp = empty_queue();  /* The queue to temporary save processes into */
+  queue_t *q = cpu->runqueues[prio];
+
+  while (!is_empty_queue(q) && !found) {
+    pid pid = dequeue(q);
+    enqueue(temp, pid);
+
+    /* kloug(100, "Process %d is %d\n", pid, PROCESS(pid).state); */
+
+    if (PROCESS(pid).state == Runnable) {
+      /* We found a runnable process */
+      found = TRUE;
+      cpu->curr_pid = pid;
+    }
+  }
+
+  /* Restoring the runqueue */
+  while (!is_empty_queue(temp)) {
+    enqueue(q, dequeue(temp));
+  }
+  /* The selected process is at the end of his runqueue now */
+
+  mem_free(temp);
+  return found;
+}
+
+/**
+ * @name select_fair - Selects the runnable fair process with the smallest vruntime
+ * The current process keeps running while it is less than FAIR_GRANULARITY ahead.
+ * @param cpu        - The processor
+ * @return bool      - Whether a process was found
+ */
+bool select_fair(cpu_state_t *cpu)
+{
+  heap_t *h = cpu->fair_queue;
+
+  /* Processes which stopped being runnable are dropped, make_runnable puts them back */
+  while (!is_empty_heap(h) && PROCESS(heap_min(h).value).state != Runnable) {
+    if (heap_pop(h).value != cpu->idle_pid) {
+      cpu->nb_runnable--;
+    }
+  }
+  if (is_empty_heap(h)) {
+    return FALSE;
+  }
+
+  heap_elt_t min = heap_min(h);
+  if (min.key > cpu->min_vruntime) {
+    cpu->min_vruntime = min.key;
+  }
+
+  process_t *curr = &PROCESS(cpu->curr_pid);
+  if (!(curr->sched_class == Fair && curr->state == Runnable
+        && curr->vruntime < min.key + FAIR_GRANULARITY)) {
+    cpu->curr_pid = min.value;
+  }
+
+  return TRUE;
+}
+
+/**
+ * @name migrate_process - Moves a queued process to the runqueues of another processor
+ * @param pid            - The process, which must not be running
+ * @param to             - The index of the new processor
+ * @return void
+ */
+void migrate_process(pid pid, u_int32 to)
+{
+  process_t *proc = &PROCESS(pid);
+  cpu_state_t *from_state = &state->cpu_states[proc->cpu];
+  cpu_state_t *to_state   = &state->cpu_states[to];
+
+  dequeue_process(pid);
+  /* The vruntime keeps its advance over the other fair processes of its processor */
+  proc->vruntime = proc->vruntime - from_state->min_vruntime + to_state->min_vruntime;
+  from_state->migrations_out++;
+  to_state->migrations_in++;
+
+  proc->cpu = to;
+  enqueue_process(pid);
+}
+
+/**
+ * @name can_steal - Whether a queued process of another processor can be stolen
+ * Neither the running ones, nor the ones whose kernel stack is still in use,
+ * nor the idle ones can.
+ * @param owner    - The processor of the process
+ * @param pid      - The process
+ * @return bool
+ */
+bool can_steal(cpu_state_t *owner, pid pid)
+{
+  return PROCESS(pid).state == Runnable && pid != owner->curr_pid
+    && pid != owner->stack_pid && pid != owner->idle_pid;
+}
+
+/**
+ * @name stealable_process - Returns a process of a processor that can be stolen,
+ * from its highest priority runqueue first
+ * @param owner            - The processor
+ * @return pid             - The process, or NO_PID
+ */
+pid stealable_process(cpu_state_t *owner)
+{
+  for (s_int32 prio = MAX_PRIORITY; prio >= 0; prio--) {
+    queue_t first = *owner->runqueues[prio];
+    if (!first) {
+      continue;
+    }
+    queue_t elt = first;
+    do {
+      if (can_steal(owner, elt->value)) {
+        return elt->value;
+      }
+      elt = elt->next;
+    } while (elt != first);
+  }
+
+  heap_t *h = owner->fair_queue;
+  for (u_int32 i = 0; i < h->size; i++) {
+    if (can_steal(owner, h->elts[i].value)) {
+      return h->elts[i].value;
+    }
+  }
+
+  return NO_PID;
+}
+
+/**
+ * @name steal_process - Selects a process stolen from the busiest processor
+ * @param cpu          - The current processor
+ * @return bool        - Whether a process was stolen
+ */
+bool steal_process(cpu_state_t *cpu)
+{
+  u_int32 this_cpu = cpu_id();
+  u_int32 busiest = this_cpu;
+  u_int32 busiest_load = 1;  /* A single process is the running one */
+  for (u_int32 other = 0; other < nb_cpus; other++) {
+    u_int32 load = state->cpu_states[other].nb_runnable;
+    if (other != this_cpu && cpus[other].online && load > busiest_load) {
+      busiest = other;
+      busiest_load = load;
+    }
+  }
+  if (busiest == this_cpu) {
+    return FALSE;
+  }
+
+  pid stolen = stealable_process(&state->cpu_states[busiest]);
+  if (stolen == NO_PID) {
+    return FALSE;
+  }
+  migrate_process(stolen, this_cpu);
+  cpu->curr_pid = stolen;
+  return TRUE;
+}
 
 void select_new_process()
 {
   /* kloug(100, "Select new process\n"); */
 
+  cpu_state_t *cpu = CPU_STATE;
+
+  /* A process handed the processor off */
+  pid handoff = cpu->handoff;
+  cpu->handoff = NO_PID;
+  if (handoff != NO_PID && PROCESS(handoff).state == Runnable && PROCESS(handoff).cpu == cpu_id()) {
+    cpu->curr_pid = handoff;
+    return;
+  }
+
   /* Search for a runnable process */
   bool found = FALSE;
-  queue_t *temp = empty_queue();  /* The queue to temporary save processes into */
 
-  for (priority prio = MAX_PRIORITY; prio >= 0 && !found; prio--) {
-    queue_t *q = state->runqueues[prio];
+  for (priority prio = MAX_PRIORITY; prio > 0 && !found; prio--) {
+    found = select_in_runqueue(cpu, prio);
+  }
+  if (!found) {
+    found = select_fair(cpu);
+  }
+  if (!found) {
+    found = steal_process(cpu);
+  }
+  if (!found) {
+    select_in_runqueue(cpu, 0);
+  }
+  cpu->need_resched = FALSE;
+
+  kloug(100, "Selected %d as new process\n", cpu->curr_pid);
+}
+
+
+void handoff_process(pid pid)
+{
+  cpu_state_t *cpu = CPU_STATE;
+  process_t *proc = &PROCESS(pid);
+  process_t *curr = &PROCESS(cpu->curr_pid);
+
+  /* Not to a process the current one would have preempted */
+  if (proc->sched_class != curr->sched_class
+      || (proc->sched_class == Strict && proc->prio < curr->prio)) {
+    return;
+  }
+  if (proc->cpu != cpu_id()) {
+    /* The kernel stack of the process may still be in use by its processor */
+    if (state->cpu_states[proc->cpu].stack_pid == pid) {
+      return;
+    }
+    migrate_process(pid, cpu_id());
+  }
+
+  cpu->handoff = pid;
+  cpu->should_cycle = TRUE;
+}
+
 
-    while (!is_empty_queue(q) && !found) {
-      pid pid = dequeue(q);
-      enqueue(temp, pid);
+bool stack_in_use(pid pid)
+{
+  cpu_state_t *owner = &state->cpu_states[PROCESS(pid).cpu];
+  return owner->curr_pid == pid || owner->stack_pid == pid;
+}
 
-      /* kloug(100, "Process %d is %d\n", pid, state->processes[pid].state); */
 
-      if (state->processes[pid].state == Runnable) {
-        /* We found a runnable process */
-        found = TRUE;
-        state->curr_pid = pid;
+/**
+ * @name kick_idle_cpu - Wakes up a processor running its idle process, so that it steals work
+ * @param busy         - The index of a processor with work to steal
+ * @return void
+ */
+void kick_idle_cpu(u_int32 busy)
+{
+  for (u_int32 i = 0; i < nb_cpus; i++) {
+    cpu_state_t *cpu = &state->cpu_states[i];
+    if (i != busy && cpus[i].online && cpu->curr_pid == cpu->idle_pid) {
+      cpu->need_resched = TRUE;
+      if (i != cpu_id()) {
+        send_ipi(i, IPI_TICK_VECTOR);
       }
+      return;
     }
+  }
+}
 
-    /* Restoring the runqueue */
-    while (!is_empty_queue(temp)) {
-      enqueue(q, dequeue(temp));
+void enqueue_process(pid pid)
+{
+  process_t *proc = &PROCESS(pid);
+  cpu_state_t *cpu = &state->cpu_states[proc->cpu];
+  proc->ready_since = timer_ticks;
+
+  if (proc->sched_class == Fair) {
+    /* A process coming back must not monopolize the processor to catch up */
+    if (proc->vruntime < cpu->min_vruntime) {
+      proc->vruntime = cpu->min_vruntime;
     }
-    /* The selected process is at the end of his runqueue now */
+    heap_insert(cpu->fair_queue, proc->vruntime, pid);
+  } else {
+    enqueue(cpu->runqueues[proc->prio], pid);
+  }
+  if (pid != cpu->idle_pid) {
+    cpu->nb_runnable++;
   }
 
-  mem_free(temp);
+  cpu->need_resched = TRUE;
+  if (proc->cpu != cpu_id() && cpus[proc->cpu].online) {
+    /* Wakes it up if it is halted, and lets it reconsider its current process */
+    send_ipi(proc->cpu, IPI_TICK_VECTOR);
+  }
+  if (cpu->curr_pid != cpu->idle_pid) {
+    kick_idle_cpu(proc->cpu);
+  }
+}
+
+void dequeue_process(pid pid)
+{
+  process_t *proc = &PROCESS(pid);
+  cpu_state_t *cpu = &state->cpu_states[proc->cpu];
+
+  bool queued;
+  if (proc->sched_class == Fair) {
+    queued = heap_remove(cpu->fair_queue, pid);
+  } else {
+    queued = dequeue_elt(cpu->runqueues[proc->prio], pid);
+  }
+  if (queued && pid != cpu->idle_pid) {
+    cpu->nb_runnable--;
+  }
+}
+
+void make_runnable(pid pid)
+{
+  PROCESS(pid).state = Runnable;
+  dequeue_process(pid);
+  enqueue_process(pid);
+}
+
+
+void block_process(wait_queue_t *wq, pid pid, process_state_t blocked_state)
+{
+  process_t *proc = &PROCESS(pid);
+  proc->state = blocked_state;
+  dequeue_process(pid);
+
+  proc->blocked_on = wq;
+  proc->wait_next = NO_PID;
+  if (wq->last == NO_PID) {
+    wq->first = pid;
+  } else {
+    PROCESS(wq->last).wait_next = pid;
+  }
+  wq->last = pid;
+}
+
+void leave_wait_queue(pid id)
+{
+  process_t *proc = &PROCESS(id);
+  wait_queue_t *wq = proc->blocked_on;
+  if (!wq) {
+    return;
+  }
+
+  /* Only a killed process leaves from the middle of its queue */
+  if (wq->first == id) {
+    wq->first = proc->wait_next;
+    if (wq->first == NO_PID) {
+      wq->last = NO_PID;
+    }
+  } else {
+    pid prev = wq->first;
+    while (PROCESS(prev).wait_next != id) {
+      prev = PROCESS(prev).wait_next;
+    }
+    PROCESS(prev).wait_next = proc->wait_next;
+    if (wq->last == id) {
+      wq->last = prev;
+    }
+  }
+
+  proc->blocked_on = NULL;
+  proc->wait_next = NO_PID;
+}
+
+bool wake_up_one(wait_queue_t *wq)
+{
+  if (wq->first == NO_PID) {
+    return FALSE;
+  }
+
+  pid pid = wq->first;
+  leave_wait_queue(pid);
+  make_runnable(pid);
+  return TRUE;
+}
+
+void wake_up_all(wait_queue_t *wq)
+{
+  while (wake_up_one(wq));
+}
+
+
+/**
+ * @name grow_process_table - Adds PROCESS_CHUNK Free processes to the table
+ * Their kernel stacks are mapped in the kernel directory, in base_directory
+ * (hence in the directories created later), and in the directory of every process.
+ * @return bool             - Whether the table could grow
+ */
+bool grow_process_table()
+{
+  u_int32 chunk = state->nb_processes / PROCESS_CHUNK;
+  if (chunk == MAX_PROCESS_CHUNKS) {
+    return FALSE;
+  }
+
+  u_int32 stacks = KERNEL_STACKS + state->nb_processes * PROCESS_KERNEL_STACK_SIZE;
+  u_int32 size   = PROCESS_CHUNK * PROCESS_KERNEL_STACK_SIZE;
+
+  /* The kernel heap is only mapped in the kernel directory */
+  page_directory_t *dir = current_directory;
+  switch_page_directory(kernel_directory);
+
+  process_t *processes = mem_alloc_aligned(PROCESS_CHUNK * sizeof(process_t), __alignof__(process_t));
+  mem_set(processes, 0, PROCESS_CHUNK * sizeof(process_t));  /* All Free */
+
+  for (u_int32 page = stacks; page < stacks + size; page += 0x1000) {
+    if (!request_virtual_space(kernel_directory, page, TRUE, TRUE)) {
+      throw("Unable to map the kernel stacks");
+    }
+  }
+  bool shared = share_kernel_pages(base_directory, stacks, size);
+  for (pid id = 0; shared && id < state->nb_processes; id++) {
+    process_t *proc = &PROCESS(id);
+    if (proc->state != Free && proc->context.page_dir) {
+      shared = share_kernel_pages(proc->context.page_dir, stacks, size);
+    }
+  }
+  if (!shared) {
+    throw("Unable to share the kernel stacks");
+  }
+
+  switch_page_directory(dir);
+
+  state->chunks[chunk] = processes;
+  state->nb_processes += PROCESS_CHUNK;
+  /* The lowest pids on top of the stack */
+  for (pid id = state->nb_processes; id-- > chunk * PROCESS_CHUNK;) {
+    free_pid(id);
+  }
+
+  return TRUE;
+}
+
+pid alloc_pid()
+{
+  if (state->free_pids == NO_PID && !grow_process_table()) {
+    return NO_PID;
+  }
+
+  pid id = state->free_pids;
+  state->free_pids = PROCESS(id).next_free;
+  return id;
+}
+
+void free_pid(pid id)
+{
+  process_t *proc = &PROCESS(id);
+  trace_release(proc);
+  release_exec_image(proc->image);
+  proc->image = NULL;
+  proc->state = Free;
+  proc->next_free = state->free_pids;
+  state->free_pids = id;
+}
+
+
+void add_child(pid parent, pid child)
+{
+  process_t *parent_proc = &PROCESS(parent);
+  process_t *child_proc  = &PROCESS(child);
+
+  child_proc->parent_id = parent;
+  child_proc->prev_sibling = NO_PID;
+  child_proc->next_sibling = parent_proc->first_child;
+  if (parent_proc->first_child != NO_PID) {
+    PROCESS(parent_proc->first_child).prev_sibling = child;
+  }
+  parent_proc->first_child = child;
+}
+
+void remove_child(pid child)
+{
+  process_t *child_proc = &PROCESS(child);
+  process_t *parent_proc = &PROCESS(child_proc->parent_id);
+
+  if (child_proc->prev_sibling != NO_PID) {
+    PROCESS(child_proc->prev_sibling).next_sibling = child_proc->next_sibling;
+  } else if (parent_proc->first_child == child) {
+    parent_proc->first_child = child_proc->next_sibling;
+  }
+  if (child_proc->next_sibling != NO_PID) {
+    PROCESS(child_proc->next_sibling).prev_sibling = child_proc->prev_sibling;
+  }
+  child_proc->next_sibling = child_proc->prev_sibling = NO_PID;
+}
 
-  kloug(100, "Selected %d as new process\n", state->curr_pid);
+
+void charge_current()
+{
+  cpu_state_t *cpu = CPU_STATE;
+  pid curr = cpu->curr_pid;
+  process_t *proc = &PROCESS(curr);
+  u_int32 elapsed = timer_ticks - cpu->slice_start;
+  cpu->slice_start = timer_ticks;
+
+  proc->stats.run_time += elapsed;
+
+  if (proc->sched_class == Fair && elapsed) {
+    proc->vruntime += elapsed * FAIR_SCALE / (proc->prio + 1);
+    if (proc->state == Runnable && heap_remove(cpu->fair_queue, curr)) {
+      heap_insert(cpu->fair_queue, proc->vruntime, curr);
+    }
+  }
+}
+
+
+void sleep_process(pid pid, u_int32 ms)
+{
+  PROCESS(pid).state = Sleeping;
+  dequeue_process(pid);
+  heap_insert(state->sleepers, timer_ticks + ms, pid);
+}
+
+void cancel_sleep(pid pid)
+{
+  heap_remove(state->sleepers, pid);
+}
+
+void account_switch(pid prev, bool voluntary)
+{
+  pid next = CURR_PID;
+  if (next == prev) {
+    return;
+  }
+
+  process_t *prev_proc = &PROCESS(prev);
+  process_t *next_proc = &PROCESS(next);
+
+  if (voluntary) {
+    prev_proc->stats.voluntary++;
+  } else {
+    prev_proc->stats.involuntary++;
+  }
+  if (prev_proc->state == Runnable) {
+    prev_proc->ready_since = timer_ticks;
+  }
+
+  next_proc->stats.switches++;
+  next_proc->stats.wait_time += timer_ticks - next_proc->ready_since;
+}
+
+
+/* One letter per process state, as in ps */
+string state_names[] = { "F", "W", "R", "Z", "S", "B" };
+
+u_int32 least_loaded_cpu()
+{
+  u_int32 best = cpu_id();
+  u_int32 best_load = state->cpu_states[best].nb_runnable;
+
+  for (u_int32 cpu = 0; cpu < nb_cpus; cpu++) {
+    if (cpus[cpu].online) {
+      u_int32 load = state->cpu_states[cpu].nb_runnable;
+      if (load < best_load) {
+        best = cpu;
+        best_load = load;
+      }
+    }
+  }
+
+  return best;
+}
+
+
+void print_scheduler_stats()
+{
+  writef("%fPID\tSTATE\tCPU\tCLASS\tPRIO\tRUN\tWAIT\tSWITCH\tVOL\tINVOL%f\n", LightBlue, White);
+  for (pid pid = 0; pid < state->nb_processes; pid++) {
+    process_t *proc = &PROCESS(pid);
+    if (proc->state == Free) {
+      continue;
+    }
+    bool running = pid == state->cpu_states[proc->cpu].curr_pid;
+    writef("%u%s\t%s\t%u\t%s\t%u\t%u\t%u\t%u\t%u\t%u\n", pid, running ? "*" : "", \
+           state_names[proc->state], proc->cpu, \
+           proc->sched_class == Fair ? "fair" : "strict", proc->prio, \
+           proc->stats.run_time, proc->stats.wait_time, proc->stats.switches, \
+           proc->stats.voluntary, proc->stats.involuntary);
+  }
+
+  for (u_int32 cpu = 0; cpu < nb_cpus; cpu++) {
+    if (cpus[cpu].online) {
+      cpu_state_t *cpu_state = &state->cpu_states[cpu];
+      writef("CPU %u: %u processes stolen, %u stolen from it\n", cpu, \
+             cpu_state->migrations_in, cpu_state->migrations_out);
+    }
+  }
+
+  print_histogram("timer_handler", &timer_hist);
+  print_histogram("syscall_handler", &syscall_hist);
+}
+
+
+/**
+ * @name wake_sleepers - Makes runnable all the processes whose deadline is reached
+ * @return bool        - Whether a process was woken up
+ */
+bool wake_sleepers()
+{
+  bool woken = FALSE;
+
+  /* The difference handles the wrap-around of timer_ticks */
+  while (!is_empty_heap(state->sleepers)
+         && (s_int32)(heap_min(state->sleepers).key - timer_ticks) <= 0) {
+    pid pid = heap_pop(state->sleepers).value;
+    if (PROCESS(pid).state == Sleeping) {
+      make_runnable(pid);
+      woken = TRUE;
+    }
+  }
+
+  return woken;
+}
+
+
+/**
+ * @name runnable_in_queue - Checks whether a runqueue has a runnable process
+ * @param cpu              - The processor of the runqueue
+ * @param prio             - The priority of the runqueue
+ * @param except           - A process to ignore
+ * @return bool
+ */
+bool runnable_in_queue(cpu_state_t *cpu, priority prio, pid except)
+{
+  queue_t first = *cpu->runqueues[prio];
+  if (!first) {
+    return FALSE;
+  }
+
+  queue_t elt = first;
+  do {
+    if (elt->value != except && PROCESS(elt->value).state == Runnable) {
+      return TRUE;
+    }
+    elt = elt->next;
+  } while (elt != first);
+
+  return FALSE;
+}
+
+/**
+ * @name runnable_fair - Checks whether there is a runnable fair process
+ * @param cpu          - The processor
+ * @param except       - A process to ignore
+ * @return bool
+ */
+bool runnable_fair(cpu_state_t *cpu, pid except)
+{
+  heap_t *h = cpu->fair_queue;
+  for (u_int32 i = 0; i < h->size; i++) {
+    if (h->elts[i].value != except && PROCESS(h->elts[i].value).state == Runnable) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+/**
+ * @name can_preempt - Checks whether the timer could select another process than the current one
+ * A strict process is only preempted by processes of the same or a higher priority,
+ * a fair one by the other fair processes.
+ * @param cpu         - The processor
+ * @return bool
+ */
+bool can_preempt(cpu_state_t *cpu)
+{
+  pid curr = cpu->curr_pid;
+  process_t *proc = &PROCESS(curr);
+
+  if (proc->state != Runnable) {
+    return TRUE;
+  }
+
+  priority lowest = proc->sched_class == Fair ? 1 : proc->prio;
+  for (priority prio = MAX_PRIORITY; prio >= lowest; prio--) {
+    if (runnable_in_queue(cpu, prio, curr)) {
+      return TRUE;
+    }
+  }
+
+  if (proc->sched_class == Fair || proc->prio == 0) {
+    return runnable_fair(cpu, curr);
+  }
+  return FALSE;
+}
+
+void update_timer()
+{
+  if (lapic_ticks_per_ms) {
+    /* The ticks of this processor come from its own local APIC timer. The
+     * other processors program theirs once they get the IPI of enqueue_process. */
+    bool local = can_preempt(CPU_STATE);
+    if (local && !cpus[cpu_id()].lapic_ticking) {
+      lapic_timer_periodic(SWITCH_FREQ);
+    } else if (!local && cpus[cpu_id()].lapic_ticking) {
+      lapic_timer_stop();
+    }
+  }
+
+  /* The PIT keeps the clock: periodic while some process can be preempted, so
+   * that the run times stay precise */
+  bool preempt = FALSE;
+  for (u_int32 cpu = 0; cpu < nb_cpus && !preempt; cpu++) {
+    preempt = cpus[cpu].online && can_preempt(&state->cpu_states[cpu]);
+  }
+
+  if (preempt) {
+    /* Preemption needed: back to a periodic tick */
+    if (!timer_periodic) {
+      timer_phase(SWITCH_FREQ);
+    }
+  } else if (is_empty_heap(state->sleepers)) {
+    /* Nobody to preempt: no tick until the next deadline. There is none, so
+     * the longest possible delay just keeps timer_ticks up to date */
+    if (!timer_armed) {
+      timer_one_shot(TIMER_MAX_ONE_SHOT);
+    }
+  } else {
+    unsigned int deadline = heap_min(state->sleepers).key;
+    s_int32 delay = deadline - timer_ticks;
+    if (!timer_armed || (s_int32)(deadline - timer_deadline) < 0) {
+      timer_one_shot(delay > 0 ? delay : 1);
+    }
+  }
 }
 
 
-/* Context-switching defines, not functions, to avoid using the stack */
+/* Context-switching defines, not functions, to avoid using the stack
+ * The registers of a process stay in the frame at the top of its kernel stack,
+ * and the malloc globals always hold the kernel heap state (see syscall.c for
+ * the syscalls working on the user heap), so there is nothing to copy. */
 #define SWITCH_BEFORE() {                                               \
-    in_kernel = TRUE;                                                   \
+    CPU_STATE->in_kernel = TRUE;                                        \
+    /* The stack of the process, until the next interruption */         \
+    CPU_STATE->stack_pid = CPU_STATE->curr_pid;                         \
     /* Restores kernel paging */                                        \
     switch_page_directory(kernel_directory);                            \
-    context_t *ctx = &state->processes[state->curr_pid].context;        \
-                                                                        \
-    /* Saves process context */                                         \
-    *ctx->regs = *regs;                                                 \
-    ctx->first_free_block = first_free_block;                           \
-    ctx->unallocated_mem  = unallocated_mem;                            \
-                                                                        \
-    /* Restores kernel context */                                       \
-    unallocated_mem  = kernel_context.unallocated_mem;                  \
-    first_free_block = kernel_context.first_free_block;                 \
   }
 
 #define SWITCH_AFTER() {                                                \
-    /* kloug(100, "Switching back to %d\n", state->curr_pid);  */       \
-    /* Saves kernel context */                                          \
-    kernel_context.unallocated_mem  = unallocated_mem;                  \
-    kernel_context.first_free_block = first_free_block;                 \
-                                                                        \
-    /* Restores process context */                                      \
-    context_t *ctx = &state->processes[state->curr_pid].context;        \
-    first_free_block = ctx->first_free_block;                           \
-    unallocated_mem  = ctx->unallocated_mem;                            \
-    *regs = *ctx->regs;                                                 \
+    /* kloug(100, "Switching back to %d\n", CURR_PID);  */              \
+    cpu_state_t *cpu_state = CPU_STATE;                                 \
+    context_t *ctx = &PROCESS(cpu_state->curr_pid).context;    \
+    if (ctx->regs != regs) {                                            \
+      /* Another process: the interruption stub returns through its frame */ \
+      cpus[cpu_id()].next_frame = ctx->regs;                            \
+      set_kernel_stack(ctx->kernel_stack);                              \
+    }                                                                   \
                                                                         \
     /* Restores process paging */                                       \
     switch_page_directory(ctx->page_dir);                               \
-    in_kernel = FALSE;                                                  \
+    cpu_state->in_kernel = FALSE;                                       \
   }
 
-void timer_handler(regs_t *regs)
+/**
+ * @name schedule_tick - Preempts the current process of the current processor
+ * Handler of the local APIC timer, and of the ticks sent by the other processors.
+ * @param regs         - Context of the current process
+ * @return void
+ */
+void schedule_tick(regs_t *regs)
 {
-  /* kloug(100, "Timer\n"); */
+  cpu_state_t *cpu = CPU_STATE;
 
-  if (in_kernel) {
+  if (cpu->in_kernel) {
     /* kloug(100, "Timer during kernel!\n"); */
-    should_cycle = TRUE;
+    cpu->should_cycle = TRUE;
+    if (!timer_periodic) {
+      update_timer();  /* Re-arms the one-shot count */
+    }
     return;
   }
 
+  pid released = cpu->stack_pid;
   SWITCH_BEFORE();       /* Save context + kernel paging */
+  if (!exit_killed(released, regs)) {
+    poll_syscall_ring();   /* Picks up the syscalls queued by the process */
+  }
+  pid prev = cpu->curr_pid;
+  charge_current();
   select_new_process();
+  account_switch(prev, FALSE);
+  update_timer();
   SWITCH_AFTER();        /* Paging set-up + restore the stack and the context */
 }
 
+void timer_handler(regs_t *regs)
+{
+  /* kloug(100, "Timer\n"); */
+  u_int32 tsc = read_tsc();
+  timer_tick();
+  wake_sleepers();
+
+  if (lapic_ticks_per_ms) {
+    /* Every processor preempts on its local APIC timer, this one only
+     * reconsiders its process if a sleeper woke up on it */
+    if (CPU_STATE->need_resched) {
+      schedule_tick(regs);
+    } else {
+      update_timer();  /* Re-arms the one-shot count */
+    }
+  } else {
+    /* The other processors get their ticks from this one */
+    for (u_int32 cpu = 0; cpu < nb_cpus; cpu++) {
+      if (cpu != cpu_id() && cpus[cpu].online && can_preempt(&state->cpu_states[cpu])) {
+        send_ipi(cpu, IPI_TICK_VECTOR);
+      }
+    }
+    schedule_tick(regs);
+  }
+  hist_add(&timer_hist, read_tsc() - tsc);
+}
+
 /**
  * @name syscall_handler - Handler for the syscall interruption
  * Decodes the syscall (in eax) and performs it on the current state.
  * @param regs           - Context of the current process
- * @return void
+ * @return regs_t*       - The frame through which the interruption returns
  */
-void syscall_handler(regs_t *regs)
+regs_t *syscall_handler(regs_t *regs)
 {
-  if (in_kernel) {
+  lock_kernel();
+  cpu_state_t *cpu = CPU_STATE;
+
+  if (cpu->in_kernel) {
     throw("WTF");
   }
 
   /* kloug(100, "Syscall %d\n", regs->eax); */
+  u_int32 tsc = read_tsc();
+  pid released = cpu->stack_pid;
   SWITCH_BEFORE();  /* Save context + kernel paging */
   /* kloug(100, "Context restored\n"); */
   /* u_int32 esp; */
@@ -124,220 +850,305 @@ void syscall_handler(regs_t *regs)
   /* kloug(100, "Useresp %X ss %x esp %X\n", regs->useresp, 8, regs->ss, regs->esp, 8); */
 
 
-  syscall(regs->eax);
+  if (exit_killed(released, regs)) {
+    /* Killed meanwhile (see kill_family), the syscall is not performed */
+  } else if (regs->int_no == SYSENTER_FRAME
+      && !read_stub_registers(regs, PROCESS(cpu->curr_pid).context.page_dir)) {
+    /* The stub did not save its registers on its stack: the call fails, and
+     * returns through iret */
+    regs->int_no = SYSCALL_ISR;
+    regs->eax = 0;
+  } else {
+    syscall(regs->eax);
+  }
   /* kloug(100, "Syscall ended\n"); */
 
   /* Check if the syscall has not ended, and if it is the case select a new process */
-  if (should_cycle || state->processes[state->curr_pid].state != Runnable) {
+  if (cpu->should_cycle || PROCESS(cpu->curr_pid).state != Runnable) {
+    pid prev = cpu->curr_pid;
+    /* Otherwise preempted by a wakeup or a handoff */
+    bool voluntary = PROCESS(prev).state != Runnable || cpu->yielded;
+    charge_current();
     select_new_process();
-    should_cycle = FALSE;
+    account_switch(prev, voluntary);
+    cpu->should_cycle = FALSE;
   }
+  cpu->yielded = FALSE;
+  update_timer();
 
   SWITCH_AFTER();  /* Paging set-up + restore the stack and the context */
+
+  hist_add(&syscall_hist, read_tsc() - tsc);
+
+  regs_t *frame = resume_frame(regs);
+  unlock_kernel();
+  return frame;
 }
 
 
-bool load_code(string program_name, context_t ctx)
+u_int32 program_inode(string program_name)
 {
-  /* kloug(100, "Loading %s code\n", program_name); */
-
   string temp = str_cat("/progs/", program_name);
   string path = str_cat(temp, ".elf");
   mem_free(temp);
 
   u_int32 inode = find_inode(path, 2);
-  if (!inode) {
-    return FALSE;
-  }
   mem_free(path);
+  return inode;
+}
 
-  /* TODO: read until EOF or something */
-  inode_t inode_buffer;
-  set_inode(inode, &inode_buffer);
-  size_t size = inode_buffer.size_low;
+bool load_code(exec_image_t *image, process_t *proc)
+{
+  /* kloug(100, "Loading inode %d code\n", image->inode); */
+  if (!map_exec_image(image, proc->context.page_dir)) {
+    return FALSE;
+  }
+  proc->image = image;
+  proc->context.regs->eip = image->entry_point;
+  return TRUE;
+}
 
-  /* Loads ELF file in memory */
-  u_int8 *elf_buffer = (u_int8 *)mem_alloc(size);
+/**
+ * @name load_system_program - Loads a program the system cannot run without
+ * @param name               - The name of the program
+ * @param proc               - The process
+ * @return void
+ */
+void load_system_program(string name, process_t *proc)
+{
+  exec_image_t *image = open_exec_image(program_inode(name));
+  if (!image || !load_code(image, proc)
+      || !set_program_args(proc->context, name, str_length(name) + 1, 1)) {
+    throw("Unable to load a system program");
+  }
+}
 
-  u_int8 *current = elf_buffer;
-  while (current < elf_buffer + size) {
-    current += read_inode_data(inode, current, current - elf_buffer, elf_buffer + size - current);
+bool set_program_args(context_t ctx, const char *args, u_int32 length, u_int32 argc)
+{
+  if (length > EXEC_ARGS_MAX || argc > EXEC_ARGC_MAX) {
+    return FALSE;
   }
 
-  u_int32 nb_pages = (0xFFFFFFFF - START_OF_USER_CODE + 1) / 0x1000;
-  /* kloug(100, "%d pages of user code\n", nb_pages); */
-  u_int32 virtuals[nb_pages];
-  for (u_int32 page = 0; page < nb_pages; page++) {
-    u_int32 physical = get_physical_address(ctx.page_dir, START_OF_USER_CODE + page*0x1000);
-    u_int32 virtual = request_physical_space(current_directory, physical, TRUE, FALSE);
-    if (virtual) {
-      virtuals[page] = virtual;
-    } else {
-      /* TODO: free properly */
-      throw("Unable to load user code");
-    }
+  /* From the top of the stack: the strings, argv (NULL-terminated), then the
+   * params of main, where loader_prog.s calls it */
+  u_int32 strings = (START_OF_USER_STACK + 4 - length) & 0xFFFFFFFC;
+  u_int32 argv[EXEC_ARGC_MAX + 1];
+  u_int32 pos = 0;
+  for (u_int32 i = 0; i < argc; i++) {
+    argv[i] = strings + pos;
+    pos += str_length((string)args + pos) + 1;
   }
+  argv[argc] = NULL;
 
-  /* Loads actual code and data at the right place, and set up eip */
-  ctx.regs->eip = check_and_load(elf_buffer, virtuals);
+  u_int32 vector = strings - (argc + 1) * sizeof(u_int32);
+  u_int32 params[2] = { argc, vector };
+  u_int32 sp = vector - sizeof(params);
 
-  /* Free! */
-  mem_free(elf_buffer);
-  for (u_int32 page = 0; page < nb_pages; page++) {
-    free_virtual_space(current_directory, virtuals[page], FALSE);  /* Frame also mapped for the proc */
+  page_directory_t *dir = ctx.page_dir;
+  if (!copy_to_user(dir, strings, args, length)
+      || !copy_to_user(dir, vector, argv, (argc + 1) * sizeof(u_int32))
+      || !copy_to_user(dir, sp, params, sizeof(params))) {
+    return FALSE;
   }
-
+  ctx.regs->useresp = sp;
   return TRUE;
 }
 
 
 /**
  * @name switch_to_process - Transfers control to the given new process
- * This ignores the regs structure, as well as the kernel esp
+ * This ignores the current stack, which is left for good, and releases the
+ * kernel lock
  * @param pid              - The process to transfer control to
  * @return void
  */
 void switch_to_process(pid pid)
 {
-  in_kernel = FALSE;
-  should_cycle = FALSE;
-
-  process_t proc = state->processes[pid];
-
-  /* Saves kernel context */
-  kernel_context.unallocated_mem  = unallocated_mem;
-  kernel_context.first_free_block = first_free_block;
-
-  /* Restores process context */
-  context_t ctx = proc.context;
-  first_free_block = ctx.first_free_block;
-  unallocated_mem  = ctx.unallocated_mem;
-
-  /* Pushes the regs structure on the stack */
-  /* kloug(100, "Pushing, kernel ESP %X user ESP %X EIP %X\n",       \ */
-        /* kernel_context.esp, 8, ctx.regs->useresp, 8, ctx.regs->eip, 8); */
-
-  /* Simulate an interruption stack frame */
-  asm volatile ("push %0" : : "r" (ctx.regs->ss));
-  asm volatile ("push %0" : : "r" (ctx.regs->useresp));
-  asm volatile ("pushf; mov (%esp), %eax; or $0x200, %eax; mov %eax, (%esp)");
-  asm volatile ("push %0" : : "r" (ctx.regs->cs));
-  asm volatile ("push %0" : : "r" (ctx.regs->eip));
-
-  /* The user segments */
-  asm volatile ("push %0" : : "r" (ctx.regs->ds));
-  asm volatile ("push %0" : : "r" (ctx.regs->es));
-  asm volatile ("push %0" : : "r" (ctx.regs->fs));
-  asm volatile ("push %0" : : "r" (ctx.regs->gs));
-
-  /* /\* Restores process paging *\/ */
-  /* u_int32 *code = (u_int32 *)ctx.regs->eip; */
-  /* kloug(100, "Oh god\n"); */
-  /* log_page_dir(ctx.page_dir); */
-  /* kloug(100, "%u %u\n", ctx.page_dir->tables[0x3FF]->pages[0x400 - 16].user, \ */
-        /* ctx.page_dir->tables[0x3FF]->pages[0x400 - 16].rw); */
-
-  switch_page_directory(ctx.page_dir);
-  /* kloug(100, "Instruction at %X: %X\n", code, 8, *code, 8); */
-  /* Let's go! */
-
-  asm volatile ("pop %gs");
-  asm volatile ("pop %fs");
-  asm volatile ("pop %es");
-  asm volatile ("pop %ds");
-
-  /* u_int32 eip; */
-  /* asm volatile ("pop %0" : "=r" (eip)); */
-  /* writef("%x", eip); */
-
-  asm volatile ("iret;");
+  cpu_state_t *cpu = CPU_STATE;
+  cpu->in_kernel = FALSE;
+  cpu->should_cycle = FALSE;
+  cpu->yielded = FALSE;
+
+  context_t *ctx = &PROCESS(pid).context;
+  regs_t *regs = ctx->regs;
+
+  /* kloug(100, "Switching to %d, user ESP %X EIP %X\n", pid, regs->useresp, 8, regs->eip, 8); */
+
+  set_kernel_stack(ctx->kernel_stack);
+  switch_page_directory(ctx->page_dir);
+  unlock_kernel();
+
+  /* Let's go! Returns through the frame at the top of the kernel stack of the
+   * process, exactly like the end of an interruption handler */
+  asm volatile ("mov %0, %%esp;"
+                "pop %%gs; pop %%fs; pop %%es; pop %%ds;"
+                "popa;"
+                "add $8, %%esp;"  /* Interruption number and error code */
+                "iret;"
+                : : "r" (regs));
 }
 
 
-bool run_executed = FALSE;
-void run_program(string name)
+pid start_program(u_int32 inode, pid parent, priority prio,
+                  const char *args, u_int32 length, u_int32 argc)
 {
-  pid pid = 0;
-  while (pid < NUM_PROCESSES && state->processes[pid].state != Free) {
-    pid++;
+  exec_image_t *image = open_exec_image(inode);
+  if (!image) {
+    return NO_PID;
+  }
+  pid id = alloc_pid();
+  if (id == NO_PID) {
+    release_exec_image(image);
+    return NO_PID;
   }
 
-  if (pid == NUM_PROCESSES) {
-    writef("%frun:%f\tUnable to create a new process\n", LightRed, White);
-    return;
+  process_t *proc = &PROCESS(id);
+  *proc = new_process(id, parent, prio, TRUE);
+  proc->cpu = least_loaded_cpu();
+  bool loaded = load_code(image, proc);
+  if (!loaded) {
+    release_exec_image(image);
   }
+  if (!loaded || !set_program_args(proc->context, args, length, argc)) {
+    free_page_dir(proc->context.page_dir);
+    free_pid(id);  /* Also releases the image, once loaded */
+    return NO_PID;
+  }
+  add_child(parent, id);
 
-  process_t *proc = &state->processes[pid];
-  *proc = new_process(1, 1, TRUE);  /* User processes have a priority of 1 */
-  if (!load_code(name, proc->context)) {
+  return id;
+}
+
+void run_program(string name, fd in, fd out)
+{
+  u_int32 inode = program_inode(name);
+  if (!inode) {
     /* Unable to load code */
     writef("%frun:%f\tUnknown file: progs/%s.elf\n", LightRed, White, name);
+    close(in);
+    close(out);
+    return;
+  }
 
-    mem_free(proc->context.regs);
-    free_page_dir(proc->context.page_dir);
-    proc->state = Free;
-
+  /* User processes have a priority of 1 */
+  pid pid = start_program(inode, INIT_PID, 1, name, str_length(name) + 1, 1);
+  if (pid == NO_PID) {
+    writef("%frun:%f\tUnable to create a new process\n", LightRed, White);
+    close(in);
+    close(out);
     return;
   }
 
+  process_t *proc = &PROCESS(pid);
+  proc->stdin  = in;
+  proc->stdout = out;
+
   /* kloug(100, "%x %x\n", proc->context.regs->ss, proc->context.regs->cs); */
 
   push(run_pid, pid);
-  enqueue(state->runqueues[1], pid);
+  enqueue_process(pid);
+  update_timer();  /* The running process may now need to be preempted */
+}
+
 
-  run_executed = TRUE;
+/**
+ * @name create_idle - Creates the idle process of a processor
+ * @param pid        - The process
+ * @param cpu        - The processor
+ * @return void
+ */
+void create_idle(pid pid, u_int32 cpu)
+{
+  process_t *idle = &PROCESS(pid);
+  *idle = new_process(pid, pid, 0, TRUE);
+  idle->cpu = cpu;
+  load_system_program("idle", idle);
+  state->cpu_states[cpu].idle_pid = pid;
+  enqueue_process(pid);
 }
 
+void scheduler_ap_start()
+{
+  cpu_state_t *cpu = CPU_STATE;
+
+  cpu->curr_pid = cpu->idle_pid;
+  PROCESS(cpu->idle_pid).stats.switches++;
+  cpu->slice_start = timer_ticks;
+  update_timer();
+  switch_to_process(cpu->idle_pid);
+}
 
 void scheduler_install()
 {
+  /* The application processors wait for this lock, released when init starts */
+  lock_kernel();
+
   state = (scheduler_state_t *)mem_alloc(sizeof(scheduler_state_t));
   mem_set(state, 0, sizeof(scheduler_state_t));
+  state->free_pids = NO_PID;
+  while (state->nb_processes < NUM_PROCESSES) {
+    grow_process_table();
+  }
 
   /* Initialization of the state */
-  for (priority prio = 0; prio <= MAX_PRIORITY; prio++) {
-    state->runqueues[prio] = empty_queue();
+  for (u_int32 cpu = 0; cpu < nb_cpus; cpu++) {
+    for (priority prio = 0; prio <= MAX_PRIORITY; prio++) {
+      state->cpu_states[cpu].runqueues[prio] = empty_queue();
+    }
+    state->cpu_states[cpu].fair_queue = empty_heap();
+    state->cpu_states[cpu].handoff = NO_PID;
   }
+  state->sleepers = empty_heap();
 
-  /* Creating idle process */
-  pid idle_pid = 0;
-  process_t *idle = &state->processes[idle_pid];
-  *idle = new_process(idle_pid, 0, TRUE);
-  load_code("idle", idle->context);
-  enqueue(state->runqueues[0],            idle_pid);
+  /* Creating idle process, the free stack giving the lowest pids first */
+  pid idle_pid = alloc_pid();
+  create_idle(idle_pid, 0);
 
   /* Creating init process */
-  pid init_pid = 1;
-  process_t *init = &(state->processes[init_pid]);
-  *init = new_process(init_pid, MAX_PRIORITY, TRUE);
-  load_code("init", init->context);
-  enqueue(state->runqueues[MAX_PRIORITY], init_pid);
+  pid init_pid = alloc_pid();
+  if (init_pid != INIT_PID) {
+    throw("Init did not get its pid");
+  }
+  process_t *init = &(PROCESS(init_pid));
+  *init = new_process(init_pid, init_pid, MAX_PRIORITY, TRUE);
+  load_system_program("init", init);
+  enqueue_process(init_pid);
 
   run_pid = empty_list();
 
+  /* One idle process per application processor */
+  smp_start_aps();
+  for (u_int32 cpu = 1; cpu < nb_cpus; cpu++) {
+    if (cpus[cpu].online) {
+      create_idle(alloc_pid(), cpu);
+    }
+  }
 
   /* /\* Creating timer1 process *\/ */
   /* pid timer1_pid = 2; */
-  /* process_t *timer1 = &(state->processes[timer1_pid]); */
-  /* *timer1 = new_process(timer1_pid, MAX_PRIORITY-1, TRUE); */
+  /* process_t *timer1 = &(PROCESS(timer1_pid)); */
+  /* *timer1 = new_process(timer1_pid, timer1_pid, MAX_PRIORITY-1, TRUE); */
   /* load_code("timer1", timer1->context); */
   /* enqueue(state->runqueues[MAX_PRIORITY], timer1_pid); */
 
   /* /\* Creating timer2 process *\/ */
   /* pid timer2_pid = 1; */
-  /* process_t *timer2 = &(state->processes[timer2_pid]); */
-  /* *timer2 = new_process(timer2_pid, MAX_PRIORITY, TRUE); */
+  /* process_t *timer2 = &(PROCESS(timer2_pid)); */
+  /* *timer2 = new_process(timer2_pid, timer2_pid, MAX_PRIORITY, TRUE); */
   /* load_code("timer2", timer2->context); */
   /* enqueue(state->runqueues[MAX_PRIORITY], timer2_pid); */
 
   /* Adds handlers for timer and syscall interruptions */
-  extern void *timer_phase(int hz);  /* Defined in timer.c */
-  timer_phase(SWITCH_FREQ);
   irq_install_handler(0, timer_handler);
+  apic_install_handler(IPI_TICK_VECTOR, schedule_tick);
+  apic_install_handler(APIC_TIMER_VECTOR, schedule_tick);
   syscall_install();
 
   /* kloug(100, "Scheduler installed\n"); */
 
-  state->curr_pid = init_pid;  /* We start with the init process */
+  CPU_STATE->curr_pid = init_pid;  /* We start with the init process */
+  PROCESS(init_pid).stats.switches++;
+  CPU_STATE->slice_start = timer_ticks;
+  update_timer();
   switch_to_process(init_pid);
 }
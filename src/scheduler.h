@@ -4,19 +4,62 @@
 #include "types.h"
 #include "string.h"
 #include "queue.h"
+#include "heap.h"
+#include "histogram.h"
 #include "process.h"
+#include "smp.h"
+#include "fs_inter.h"
+#include "exec_cache.h"
 
 
-#define NUM_PROCESSES   128  /* Maximum number of concurrent processes */
 #define SWITCH_FREQ    1000  /* Frequence (in Hz) of the switching */
+#define FAIR_SCALE       16  /* A fair process of weight w gains FAIR_SCALE / w of vruntime per ms */
+#define FAIR_GRANULARITY  4  /* Advance in vruntime (in ms) a fair process may take before being preempted */
 
-typedef struct scheduler_state {
-  pid      curr_pid;
+/* The scheduling state of a processor */
+typedef struct cpu_state {
+  pid       curr_pid;
+  pid       idle_pid;      /* Runs when nothing else is runnable on the processor */
 
-  process_t processes[NUM_PROCESSES];
   queue_t  *runqueues[MAX_PRIORITY + 1];  /* Set of process ids ordered by priority */
+
+  heap_t   *fair_queue;    /* Fair processes, keyed by vruntime */
+  u_int32   nb_runnable;   /* Number of processes in its runqueues and fair queue,
+                            * except its idle process */
+  u_int32   min_vruntime;  /* Smallest vruntime of the runnable fair processes, never decreasing */
+  u_int32   slice_start;   /* Value of timer_ticks when the current process was last charged */
+
+  bool      in_kernel;     /* If true, we were doing a syscall while we were interrupted */
+  bool      should_cycle;  /* If true, we should select a new process after the current syscall */
+  bool      yielded;       /* If true, the current process set should_cycle itself, giving
+                            * the processor up rather than being preempted */
+  bool      need_resched;  /* If true, a process was queued since the last selection */
+  pid       stack_pid;     /* Process whose kernel stack the last interruption used, until the next one */
+  pid       handoff;       /* Process to select next, if still runnable (see handoff_process) */
+
+  u_int32   migrations_in;   /* Number of processes stolen by this processor */
+  u_int32   migrations_out;  /* Number of processes stolen from this processor */
+} cpu_state_t;
+
+typedef struct scheduler_state {
+  /* The process table, grown by chunks which are never moved, so that the
+   * pointers to processes (e.g. to their wait queues) stay valid */
+  process_t *chunks[MAX_PROCESS_CHUNKS];
+  u_int32   nb_processes;  /* Size of the process table */
+  pid       free_pids;     /* Stack of the Free processes, linked through next_free */
+
+  heap_t   *sleepers;  /* Sleeping processes, keyed by the value of timer_ticks at which they wake up */
+
+  cpu_state_t cpu_states[MAX_CPUS];  /* Indexed like cpus (see smp.h) */
 } scheduler_state_t;
 
+/* A process of the table, which must be smaller than nb_processes */
+#define PROCESS(id) (state->chunks[(id) / PROCESS_CHUNK][(id) % PROCESS_CHUNK])
+
+/* The scheduling state of the current processor, and the process it runs */
+#define CPU_STATE (&state->cpu_states[cpu_id()])
+#define CURR_PID  (CPU_STATE->curr_pid)
+
 
 /**
  * @name scheduler_install - Initializes a new scheduler
@@ -25,17 +68,235 @@ typedef struct scheduler_state {
 void scheduler_install();
 
 /**
- * @name select_new_process - Searches the runqueues for a runnable process with highest priority
+ * @name scheduler_ap_start - Runs the idle process of the current application processor
+ * The kernel lock must be held, it is released once in user mode.
+ * @return void
+ */
+void scheduler_ap_start();
+
+/**
+ * @name alloc_pid - Takes a Free process, growing the process table if needed
+ * The process must then be initialized with new_process.
+ * @return pid     - The process, or NO_PID if the table is full
+ */
+pid alloc_pid();
+
+/**
+ * @name free_pid - Marks a process as Free, for the next alloc_pid
+ * @param id      - The process
+ * @return void
+ */
+void free_pid(pid id);
+
+/**
+ * @name select_new_process - Searches the runqueues of the current processor for a runnable process
+ * Strict processes are selected by priority, the fair ones with the smallest vruntime
+ * come before the strict processes of priority 0 (i.e. idle). Before running idle,
+ * a process is stolen from the busiest processor, if any. A process given by
+ * handoff_process comes before all of them.
  * @return void
  */
 void select_new_process();
 
 /**
- * @name run_program - Runs the given program
+ * @name handoff_process - Makes a runnable process the next one selected on the current processor
+ * It is moved to the current processor if needed. Nothing is done if the current
+ * process would have preempted it (a lower priority, or another class), or if its
+ * processor may still use its kernel stack.
+ * @param pid            - The process
+ * @return void
+ */
+void handoff_process(pid pid);
+
+/**
+ * @name stack_in_use - Tells whether a processor may still use the kernel stack of a process
+ * Only the processor of the process can: it runs it, or the last interruption
+ * there used its stack.
+ * @param pid         - The process
+ * @return bool
+ */
+bool stack_in_use(pid pid);
+
+/**
+ * @name enqueue_process - Adds a process at the end of its runqueue
+ * The processor of the process is interrupted if it is not the current one, and
+ * an idle processor is woken up to steal it if its processor is busy.
+ * @param pid            - The process
+ * @return void
+ */
+void enqueue_process(pid pid);
+
+/**
+ * @name dequeue_process - Removes a process from its runqueue
+ * @param pid            - The process
+ * @return void
+ */
+void dequeue_process(pid pid);
+
+/**
+ * @name make_runnable - Sets a process as Runnable, and puts it back in its runqueue
+ * @param pid          - The process
+ * @return void
+ */
+void make_runnable(pid pid);
+
+/**
+ * @name block_process - Parks a process on a wait queue, out of the runqueues
+ * @param wq           - The wait queue
+ * @param pid          - The process
+ * @param blocked_state - The state of the process until it is woken up
+ * @return void
+ */
+void block_process(wait_queue_t *wq, pid pid, process_state_t blocked_state);
+
+/**
+ * @name leave_wait_queue - Removes a process from the wait queue holding it, if any
+ * The process stays in its blocked state.
+ * @param id              - The process
+ * @return void
+ */
+void leave_wait_queue(pid id);
+
+/**
+ * @name wake_up_one - Makes runnable the first process of a wait queue
+ * @param wq         - The wait queue
+ * @return bool      - Whether there was a process to wake up
+ */
+bool wake_up_one(wait_queue_t *wq);
+
+/**
+ * @name wake_up_all - Makes runnable every process of a wait queue
+ * @param wq         - The wait queue
+ * @return void
+ */
+void wake_up_all(wait_queue_t *wq);
+
+/**
+ * @name add_child - Sets the parent of a process, at the head of its children list
+ * @param parent   - The parent process
+ * @param child    - The process, which must not be in another children list
+ * @return void
+ */
+void add_child(pid parent, pid child);
+
+/**
+ * @name remove_child - Removes a process from the children list of its parent
+ * @param child       - The process
+ * @return void
+ */
+void remove_child(pid child);
+
+/**
+ * @name charge_current - Charges the current process for the time elapsed since
+ * its last charge (updating its vruntime for a fair process)
+ * @return void
+ */
+void charge_current();
+
+/**
+ * @name sleep_process - Puts a runnable process to sleep
+ * The process is removed from the runqueues until the deadline is reached
+ * @param pid          - The process
+ * @param ms           - The sleeping time, in milliseconds
+ * @return void
+ */
+void sleep_process(pid pid, u_int32 ms);
+
+/**
+ * @name cancel_sleep - Forgets about the deadline of a sleeping process
+ * @param pid         - The process
+ * @return void
+ */
+void cancel_sleep(pid pid);
+
+/**
+ * @name account_switch - Updates the statistics of the processes after a selection
+ * @param prev          - The process which was running before the selection
+ * @param voluntary     - Whether prev blocked, exited or yielded, rather than being preempted
+ * @return void
+ */
+void account_switch(pid prev, bool voluntary);
+
+/**
+ * @name least_loaded_cpu - Returns the online processor with the fewest
+ * queued processes, the current one in case of a tie
+ * @return u_int32
+ */
+u_int32 least_loaded_cpu();
+
+/**
+ * @name print_scheduler_stats - Writes the processor usage of every process,
+ * and the histograms of the timer and syscall handlers durations
+ * @return void
+ */
+void print_scheduler_stats();
+
+/**
+ * @name update_timer - Programs the timer according to the runnable processes
+ * The PIT fires every 1/SWITCH_FREQ s only when there is a process to preempt
+ * on some processor, otherwise it is left in one-shot mode until the next
+ * deadline (tickless). With the local APIC timers, the one of the current
+ * processor likewise only ticks when its current process can be preempted.
+ * @return void
+ */
+void update_timer();
+
+#define EXEC_ARGS_MAX 1024  /* Maximal size of the arguments of a program, terminators included */
+#define EXEC_ARGC_MAX 32    /* Maximal number of arguments */
+
+/**
+ * @name program_inode - Looks for the executable of a program
+ * @param program_name - The name of the program, without directory nor extension
+ * @return u_int32     - The inode of /progs/program_name.elf, or 0 if it does not exist
+ */
+u_int32 program_inode(string program_name);
+
+/**
+ * @name load_code - Maps an executable in the user code pages of a process,
+ * and sets its eip to the entry point
+ * @param image    - The image of the executable (see open_exec_image), which
+ *                   the process then holds, to be released when it is freed
+ * @param proc     - The process
+ * @return bool    - FALSE if the memory was lacking: the image is not held then
+ */
+bool load_code(exec_image_t *image, process_t *proc);
+
+/**
+ * @name set_program_args - Puts the arguments of main on the stack of a process
+ * about to start, and sets its esp accordingly
+ * @param ctx             - The context of the process
+ * @param args            - The arguments, as consecutive null-terminated strings
+ * @param length          - Their total size, at most EXEC_ARGS_MAX
+ * @param argc            - Their number, at most EXEC_ARGC_MAX
+ * @return bool           - FALSE if there are too many of them
+ */
+bool set_program_args(context_t ctx, const char *args, u_int32 length, u_int32 argc);
+
+/**
+ * @name start_program - Creates a process running an executable, with a fresh
+ * page directory
+ * The process is not queued yet, and has no pipe ends.
+ * @param inode        - The inode of the executable (see program_inode)
+ * @param parent       - The parent of the process
+ * @param prio         - Its priority
+ * @param args         - The arguments of its main (see set_program_args)
+ * @param length       - Their total size
+ * @param argc         - Their number
+ * @return pid         - The process, or NO_PID if the process table is full, or if
+ *                      the executable is not valid or could not be loaded
+ */
+pid start_program(u_int32 inode, pid parent, priority prio,
+                  const char *args, u_int32 length, u_int32 argc);
+
+/**
+ * @name run_program - Runs the given program, its only argument being its name
  * @param name       - The name of the program, /progs/name.elf must exist
+ * @param in         - The pipe end read as STDIN_FD, or 0
+ * @param out        - The pipe end written as STDOUT_FD (and by printf), or 0
+ * They belong to the process from then on, even if it cannot be created.
  * @return void
  */
-void run_program(string name);
+void run_program(string name, fd in, fd out);
 
 
 #endif /* SCHEDULER_H */
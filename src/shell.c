@@ -4,6 +4,8 @@
 #include "logging.h"
 #include "fs_inter.h"
 #include "scheduler.h"
+#include "pipe.h"
+#include "trace.h"
 
 
 /* TODO: free unused args */
@@ -342,7 +344,7 @@ void run_handler(list_t args)
   } else {
     while (!is_empty_list(&args)) {
       string prog = (string)pop(&args);
-      run_program(prog);
+      run_program(prog, 0, 0);
     }
   }
 }
@@ -417,13 +419,56 @@ command_t rm_cmd = {
   .handler = *rm_handler,
 };
 
+/* The top command */
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+void top_handler(list_t args)
+{
+  print_scheduler_stats();
+}
+#pragma GCC diagnostic pop
+command_t top_cmd = {
+  .name = "top",
+  .help = "Prints the processor usage of the processes (times in ms) and of the kernel handlers",
+  .handler = *top_handler,
+};
+
+/* The trace command */
+void trace_handler(list_t args)
+{
+  if (is_empty_list(&args)) {
+    print_trace();
+    return;
+  }
+  while (!is_empty_list(&args)) {
+    string arg = (string)pop(&args);
+    if (str_cmp(arg, "on")) {
+      trace_mode = TraceCounts;
+    } else if (str_cmp(arg, "events")) {
+      trace_mode = TraceEvents;
+    } else if (str_cmp(arg, "off")) {
+      trace_mode = TraceOff;
+    } else if (str_cmp(arg, "reset")) {
+      trace_reset();
+    } else if (str_cmp(arg, "dump")) {
+      dump_trace();
+    } else {
+      writef("%ftrace:%f\tUnknown argument %s\n", LightRed, White, arg);
+    }
+  }
+}
+command_t trace_cmd = {
+  .name = "trace",
+  .help = "Prints the syscall statistics, or: on, events (also keeps the recent syscalls of each process), off, reset, dump (CSV to the serial port)",
+  .handler = *trace_handler,
+};
+
 void shell_install()
 {
   path = (string)mem_alloc(sizeof("/"));
   path[0] = '/'; path[1] = '\0';
 
   register_command(splash_cmd);
-  register_command(run_cmd);
+  register_command(run_cmd);  /* Programs can also be chained with "a | b" */
   register_command(ls_cmd);
   register_command(help_cmd);
   register_command(echo_cmd);
@@ -432,6 +477,8 @@ void shell_install()
   register_command(ascii_cmd);
   register_command(mkdir_cmd);
   register_command(rm_cmd);
+  register_command(top_cmd);
+  register_command(trace_cmd);
 
   /* display_ascii(); */
   splash_screen(NULL);
@@ -469,8 +516,68 @@ void echo_command()
   set_pos();
 }
 
+/**
+ *  @name free_strings - Frees a list of strings
+ *  @param l           - The list
+ */
+void free_strings(list_t l)
+{
+  while (l) {
+    mem_free((void*)l->head);
+    pop(&l);
+  }
+}
+
+/**
+ *  @name run_pipeline - Runs programs concurrently, each one reading through
+ *  STDIN_FD what the previous one writes through STDOUT_FD or printf
+ *  @param stages      - The stages of the pipeline, the first word of each one
+ *                       being the name of a program
+ */
+void run_pipeline(list_t stages)
+{
+  fd in = 0;
+  while (stages) {
+    list_t words = str_split((string)stages->head, ' ', FALSE);
+    mem_free((void*)stages->head);
+    pop(&stages);
+    if (!words) {
+      writef("%frun:%f\tEmpty command in the pipeline\n", LightRed, White);
+      close(in);
+      free_strings(stages);
+      return;
+    }
+
+    fd out = 0, next_in = 0;
+    if (stages) {
+      s_int32 p = new_pipe();
+      if (p < 0) {
+        writef("%frun:%f\tNo pipe left\n", LightRed, White);
+        close(in);
+        free_strings(words);
+        free_strings(stages);
+        return;
+      }
+      out     = openpipe(p, O_WRONLY);
+      next_in = openpipe(p, O_RDONLY);
+    }
+
+    run_program((string)words->head, in, out);
+    free_strings(words);
+    in = next_in;
+  }
+}
+
 void send_command()
 {
+  /* Pipelines of programs: "a | b" */
+  list_t stages = str_split(history[history_pos], '|', TRUE);
+  if (stages && stages->tail) {
+    run_pipeline(stages);
+    return;
+  }
+  free_strings(stages);
+
   /* Parsing of the command */
   list_t words = str_split(history[history_pos], ' ', FALSE);
   kloug(100 + buffer_size, "Executing command %s %x\n", history[history_pos], words);
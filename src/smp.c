@@ -0,0 +1,643 @@
+#include "smp.h"
+#include "apic.h"
+#include "smp_asm.h"
+#include "gdt.h"
+#include "idt.h"
+#include "irq.h"
+#include "paging.h"
+#include "timer.h"
+#include "memory.h"
+#include "string.h"
+#include "logging.h"
+#include "scheduler.h"
+#include "syscall.h"
+
+/* Sources: Intel MultiProcessor Specification 1.4, ACPI Specification (MADT),
+ * http://wiki.osdev.org/SMP and http://wiki.osdev.org/APIC */
+
+#define FIRMWARE_PAGES   32  /* Maximum number of pages mapped to read the firmware tables */
+#define AP_START_TIMEOUT 100 /* Time (in ms) given to an application processor to start */
+
+/* Interruption command register */
+#define ICR_INIT          0x00000500
+#define ICR_STARTUP       0x00000600
+#define ICR_PENDING       0x00001000  /* Delivery status: the last command is not accepted yet */
+#define ICR_LEVEL_ASSERT  0x00004000
+#define ICR_LEVEL_TRIGGER 0x00008000
+
+
+/* MP floating pointer structure */
+typedef struct mp_pointer {
+  char    signature[4];  /* "_MP_" */
+  u_int32 config;        /* Physical address of the configuration table, 0 for a default configuration */
+  u_int8  length;        /* In 16 bytes units */
+  u_int8  revision;
+  u_int8  checksum;
+  u_int8  features[5];
+} __attribute__((packed)) mp_pointer_t;
+
+/* Header of the MP configuration table */
+typedef struct mp_config {
+  char    signature[4];  /* "PCMP" */
+  u_int16 length;
+  u_int8  revision;
+  u_int8  checksum;
+  char    oem[8];
+  char    product[12];
+  u_int32 oem_table;
+  u_int16 oem_table_size;
+  u_int16 nb_entries;
+  u_int32 lapic;         /* Physical address of the local APIC registers */
+  u_int16 extended_length;
+  u_int8  extended_checksum;
+  u_int8  reserved;
+} __attribute__((packed)) mp_config_t;
+
+#define MP_PROCESSOR       0  /* Type of the processor entries, the other ones are 8 bytes long */
+#define MP_BUS             1
+#define MP_IOAPIC          2
+#define MP_INTERRUPT       3  /* Connection of an IRQ to an IOAPIC input */
+#define MP_CPU_ENABLED  0x01
+#define MP_IOAPIC_ENABLED 0x01
+#define MP_INT_VECTORED    0  /* Interruption type of the IRQs, as opposed to NMI or ExtINT */
+#define MP_IMCR         0x80  /* In features[1]: the PIC is connected through the IMCR */
+
+typedef struct mp_processor {
+  u_int8  type;
+  u_int8  apic_id;
+  u_int8  apic_version;
+  u_int8  flags;
+  u_int32 signature;
+  u_int32 features;
+  u_int32 reserved[2];
+} __attribute__((packed)) mp_processor_t;
+
+typedef struct mp_bus {
+  u_int8  type;
+  u_int8  bus_id;
+  char    bus_type[6];   /* "ISA   " for the ISA bus */
+} __attribute__((packed)) mp_bus_t;
+
+typedef struct mp_ioapic {
+  u_int8  type;
+  u_int8  apic_id;
+  u_int8  apic_version;
+  u_int8  flags;
+  u_int32 address;       /* Physical address of the IOAPIC registers */
+} __attribute__((packed)) mp_ioapic_t;
+
+typedef struct mp_interrupt {
+  u_int8  type;
+  u_int8  interrupt_type;
+  u_int16 flags;         /* Polarity and trigger mode */
+  u_int8  source_bus;
+  u_int8  source_irq;
+  u_int8  ioapic_id;     /* 0xFF for every IOAPIC */
+  u_int8  ioapic_input;
+} __attribute__((packed)) mp_interrupt_t;
+
+/* ACPI root system description pointer */
+typedef struct rsdp {
+  char    signature[8];  /* "RSD PTR " */
+  u_int8  checksum;
+  char    oem[6];
+  u_int8  revision;
+  u_int32 rsdt;          /* Physical address of the root system description table */
+} __attribute__((packed)) rsdp_t;
+
+/* Header of the ACPI system description tables */
+typedef struct sdt_header {
+  char    signature[4];
+  u_int32 length;        /* Including the header */
+  u_int8  revision;
+  u_int8  checksum;
+  char    oem[6];
+  char    oem_table[8];
+  u_int32 oem_revision;
+  u_int32 creator;
+  u_int32 creator_revision;
+} __attribute__((packed)) sdt_header_t;
+
+/* Multiple APIC description table, followed by its entries */
+typedef struct madt {
+  sdt_header_t header;   /* Signature "APIC" */
+  u_int32 lapic;         /* Physical address of the local APIC registers */
+  u_int32 flags;
+} __attribute__((packed)) madt_t;
+
+#define MADT_LAPIC        0  /* Type of the processor entries */
+#define MADT_IOAPIC       1
+#define MADT_OVERRIDE     2  /* Interruption source override, for an ISA IRQ */
+#define MADT_CPU_ENABLED  0x01
+
+typedef struct madt_lapic {
+  u_int8  type;
+  u_int8  length;
+  u_int8  acpi_id;
+  u_int8  apic_id;
+  u_int32 flags;
+} __attribute__((packed)) madt_lapic_t;
+
+typedef struct madt_ioapic {
+  u_int8  type;
+  u_int8  length;
+  u_int8  apic_id;
+  u_int8  reserved;
+  u_int32 address;       /* Physical address of the IOAPIC registers */
+  u_int32 gsi_base;      /* First global system interruption it handles */
+} __attribute__((packed)) madt_ioapic_t;
+
+typedef struct madt_override {
+  u_int8  type;
+  u_int8  length;
+  u_int8  bus;           /* Always 0, for ISA */
+  u_int8  source_irq;
+  u_int32 gsi;
+  u_int16 flags;         /* Polarity and trigger mode */
+} __attribute__((packed)) madt_override_t;
+
+
+spinlock_t kernel_lock = SPINLOCK_FREE;  /* Held by the interruption handlers, see lock_kernel */
+
+volatile u_int32 booting_cpu = 0;  /* The processor being started by smp_start_aps */
+u_int8 ap_stacks[MAX_CPUS][AP_STACK_SIZE] __attribute__((aligned(16)));
+
+u_int32 firmware_pages[FIRMWARE_PAGES];  /* Pages mapped by map_firmware */
+u_int32 nb_firmware_pages = 0;
+
+
+u_int32 cpu_id()
+{
+  if (nb_cpus <= 1) {
+    return 0;  /* Also before gdt_install, when the task register is not set */
+  }
+
+  u_int16 selector;
+  asm volatile ("str %0" : "=r" (selector));
+  return (selector - TSS_SEGMENTS[0]) / sizeof(gdt_entry_t);
+}
+
+
+u_int32 lapic_read(u_int32 reg)
+{
+  return *(volatile u_int32 *)(lapic_base + reg);
+}
+
+void lapic_write(u_int32 reg, u_int32 value)
+{
+  *(volatile u_int32 *)(lapic_base + reg) = value;
+}
+
+void lapic_eoi()
+{
+  lapic_write(LAPIC_EOI, 0);
+}
+
+/**
+ * @name lapic_command - Sends an interruption command to another local APIC
+ * @param apic_id      - The identifier of the target local APIC
+ * @param command      - The low part of the command (vector, delivery mode)
+ * @return void
+ */
+void lapic_command(u_int8 apic_id, u_int32 command)
+{
+  while (lapic_read(LAPIC_ICR_LOW) & ICR_PENDING) {
+    asm volatile ("pause");
+  }
+  lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+  lapic_write(LAPIC_ICR_LOW, command);  /* Writing the low part sends the command */
+}
+
+void send_ipi(u_int32 cpu, u_int8 vector)
+{
+  if (apic_present) {
+    lapic_command(cpus[cpu].apic_id, vector);
+  }
+}
+
+/**
+ * @name lapic_enable - Enables the local APIC of the current processor
+ * Only the bootstrap processor receives the interruptions of the PIC.
+ * @param bsp         - Whether the current processor is the bootstrap one
+ * @return void
+ */
+void lapic_enable(bool bsp)
+{
+  lapic_write(LAPIC_TPR, 0);  /* Accepts every interruption */
+  lapic_write(LAPIC_SVR, 0x100 | APIC_SPURIOUS);
+  lapic_write(LAPIC_LINT0, bsp ? LVT_EXTINT : LVT_MASKED);
+  lapic_write(LAPIC_LINT1, LVT_NMI);
+}
+
+
+void lock_kernel()
+{
+  spin_lock(&kernel_lock);
+
+  /* Another processor may have changed the kernel page tables */
+  cpu_t *cpu = &cpus[cpu_id()];
+  if (cpu->tlb_generation != tlb_generation) {
+    cpu->tlb_generation = tlb_generation;
+    asm volatile ("mov %%cr3, %%eax; mov %%eax, %%cr3" : : : "eax");
+  }
+}
+
+void unlock_kernel()
+{
+  spin_unlock(&kernel_lock);
+}
+
+regs_t *resume_frame(regs_t *regs)
+{
+  cpu_t *cpu = &cpus[cpu_id()];
+  regs_t *frame = cpu->next_frame ? cpu->next_frame : regs;
+  cpu->next_frame = NULL;
+
+  if (frame->int_no == SYSENTER_FRAME) {
+    /* Its stub pops ecx and edx from the user stack, in the paging loaded */
+    page_directory_t *dir = current_directory;
+    switch_page_directory(kernel_directory);  /* For the window of copy_to_user */
+    bool written = write_stub_registers(frame, dir);
+    switch_page_directory(dir);
+    if (!written) {
+      frame->int_no = SYSCALL_ISR;  /* Returns through iret, with its registers */
+    }
+  }
+  return frame;
+}
+
+
+/**
+ * @name map_firmware - Makes a firmware table readable at its physical address
+ * @param address     - The physical address of the table
+ * @param size        - The size of the table
+ * @return bool       - Whether the whole table could be mapped
+ */
+bool map_firmware(u_int32 address, u_int32 size)
+{
+  for (u_int32 page = address & 0xFFFFF000; page < address + size; page += 0x1000) {
+    if (page && get_physical_address(kernel_directory, page) == page) {
+      continue;  /* Already identity mapped */
+    }
+    if (nb_firmware_pages == FIRMWARE_PAGES || !map_mmio(kernel_directory, page)) {
+      return FALSE;
+    }
+    firmware_pages[nb_firmware_pages++] = page;
+  }
+  return TRUE;
+}
+
+/**
+ * @name release_firmware - Unmaps the pages mapped by map_firmware
+ * @return void
+ */
+void release_firmware()
+{
+  for (u_int32 i = 0; i < nb_firmware_pages; i++) {
+    free_virtual_space(kernel_directory, firmware_pages[i], FALSE);
+  }
+  nb_firmware_pages = 0;
+}
+
+/**
+ * @name has_signature - Checks the signature at the start of a firmware table
+ * @param table        - The table
+ * @param signature    - The expected signature
+ * @return bool
+ */
+bool has_signature(void *table, string signature)
+{
+  u_int8 *bytes = table;
+  for (u_int32 i = 0; signature[i]; i++) {
+    if (bytes[i] != (u_int8)signature[i]) {
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+/**
+ * @name checksum_ok - Checks that the bytes of a firmware table sum to 0
+ * @param table      - The table
+ * @param size       - The size of the table
+ * @return bool
+ */
+bool checksum_ok(void *table, u_int32 size)
+{
+  u_int8 *bytes = table;
+  u_int8 sum = 0;
+  for (u_int32 i = 0; i < size; i++) {
+    sum += bytes[i];
+  }
+  return sum == 0;
+}
+
+/**
+ * @name scan_firmware - Searches a memory range for a firmware structure
+ * The structures are aligned on 16 bytes.
+ * @param signature    - The signature of the structure
+ * @param size         - The size covered by its checksum
+ * @param start        - The start of the range
+ * @param length       - The length of the range
+ * @return u_int32     - The address of the structure, or NULL
+ */
+u_int32 scan_firmware(string signature, u_int32 size, u_int32 start, u_int32 length)
+{
+  if (!map_firmware(start, length)) {
+    return NULL;
+  }
+
+  for (u_int32 address = start; address + size <= start + length; address += 16) {
+    if (has_signature((void *)address, signature) && checksum_ok((void *)address, size)) {
+      return address;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @name find_in_bios - Searches the BIOS areas for a firmware structure: the
+ * first KB of the extended BIOS data area, the last KB of the base memory,
+ * then the BIOS read-only memory
+ * @param signature   - The signature of the structure
+ * @param size        - The size covered by its checksum
+ * @param rom_start   - The start of the searched read-only memory, which ends at 1MB
+ * @return u_int32    - The address of the structure, or NULL
+ */
+u_int32 find_in_bios(string signature, u_int32 size, u_int32 rom_start)
+{
+  u_int32 address = NULL;
+
+  /* The segment of the extended BIOS data area is stored at 0x40E */
+  if (map_firmware(0x40E, sizeof(u_int16))) {
+    u_int32 ebda = *(u_int16 *)0x40E << 4;
+    if (ebda) {
+      address = scan_firmware(signature, size, ebda, 1024);
+    }
+  }
+  if (!address && LOWER_MEMORY >= 1024) {
+    address = scan_firmware(signature, size, LOWER_MEMORY - 1024, 1024);
+  }
+  if (!address) {
+    address = scan_firmware(signature, size, rom_start, 0x100000 - rom_start);
+  }
+
+  return address;
+}
+
+
+/**
+ * @name add_cpu - Registers a processor found in the firmware tables
+ * @param apic_id - The identifier of its local APIC
+ * @return void
+ */
+void add_cpu(u_int8 apic_id)
+{
+  if (apic_id == cpus[0].apic_id) {
+    return;  /* The bootstrap processor, which is always cpus[0] */
+  }
+  if (nb_cpus == MAX_CPUS) {
+    kloug(100, "Processor %d ignored, MAX_CPUS reached\n", apic_id);
+    return;
+  }
+
+  cpus[nb_cpus].apic_id = apic_id;
+  cpus[nb_cpus].online  = FALSE;
+  nb_cpus++;
+}
+
+/**
+ * @name parse_mp - Finds the processors and the first IOAPIC in the MP
+ * configuration table, with the inputs of the ISA IRQs on the IOAPIC
+ * @return bool   - Whether the table was found
+ */
+bool parse_mp()
+{
+  mp_pointer_t *mp = (mp_pointer_t *)find_in_bios("_MP_", sizeof(mp_pointer_t), 0xF0000);
+  if (!mp || !mp->config) {
+    return FALSE;  /* The default configurations (without table) are not supported */
+  }
+
+  mp_config_t *config = (mp_config_t *)mp->config;
+  if (!map_firmware(mp->config, sizeof(mp_config_t)) || !has_signature(config, "PCMP")
+      || !map_firmware(mp->config, config->length) || !checksum_ok(config, config->length)) {
+    return FALSE;
+  }
+
+  lapic_base = config->lapic;
+  imcr_present = (mp->features[1] & MP_IMCR) != 0;
+
+  /* The buses and IOAPICs are listed before the interruptions using them */
+  s_int32 isa_bus = -1;
+  u_int8 ioapic_id = 0;
+  u_int8 *entry = (u_int8 *)(config + 1);
+  for (u_int32 i = 0; i < config->nb_entries; i++) {
+    if (*entry == MP_PROCESSOR) {
+      mp_processor_t *processor = (mp_processor_t *)entry;
+      if (processor->flags & MP_CPU_ENABLED) {
+        add_cpu(processor->apic_id);
+      }
+      entry += sizeof(mp_processor_t);
+      continue;
+    }
+
+    if (*entry == MP_BUS) {
+      mp_bus_t *bus = (mp_bus_t *)entry;
+      if (has_signature(bus->bus_type, "ISA")) {
+        isa_bus = bus->bus_id;
+      }
+    } else if (*entry == MP_IOAPIC) {
+      mp_ioapic_t *ioapic = (mp_ioapic_t *)entry;
+      if (!ioapic_base && (ioapic->flags & MP_IOAPIC_ENABLED)) {
+        ioapic_base = ioapic->address;
+        ioapic_id   = ioapic->apic_id;
+      }
+    } else if (*entry == MP_INTERRUPT) {
+      mp_interrupt_t *interrupt = (mp_interrupt_t *)entry;
+      if (interrupt->interrupt_type == MP_INT_VECTORED && interrupt->source_bus == isa_bus
+          && interrupt->source_irq < ISA_IRQS
+          && (interrupt->ioapic_id == ioapic_id || interrupt->ioapic_id == 0xFF)) {
+        irq_gsi[interrupt->source_irq]   = interrupt->ioapic_input;
+        irq_flags[interrupt->source_irq] = interrupt->flags;
+      }
+    }
+    entry += 8;
+  }
+
+  return TRUE;
+}
+
+/**
+ * @name map_sdt   - Maps an ACPI system description table and checks it
+ * @param address  - The physical address of the table
+ * @return sdt_header_t* - The table, or NULL if it is invalid
+ */
+sdt_header_t *map_sdt(u_int32 address)
+{
+  sdt_header_t *sdt = (sdt_header_t *)address;
+  if (!map_firmware(address, sizeof(sdt_header_t)) || !map_firmware(address, sdt->length)
+      || !checksum_ok(sdt, sdt->length)) {
+    return NULL;
+  }
+  return sdt;
+}
+
+/**
+ * @name parse_acpi - Finds the processors, the first IOAPIC and the overridden
+ * ISA IRQs in the ACPI multiple APIC description table
+ * @return bool     - Whether the table was found
+ */
+bool parse_acpi()
+{
+  rsdp_t *rsdp = (rsdp_t *)find_in_bios("RSD PTR ", sizeof(rsdp_t), 0xE0000);
+  if (!rsdp) {
+    return FALSE;
+  }
+
+  sdt_header_t *rsdt = map_sdt(rsdp->rsdt);
+  if (!rsdt || !has_signature(rsdt, "RSDT")) {
+    return FALSE;
+  }
+
+  u_int32 *tables = (u_int32 *)(rsdt + 1);
+  u_int32 nb_tables = (rsdt->length - sizeof(sdt_header_t)) / sizeof(u_int32);
+  for (u_int32 i = 0; i < nb_tables; i++) {
+    madt_t *madt = (madt_t *)map_sdt(tables[i]);
+    if (!madt || !has_signature(madt, "APIC")) {
+      continue;
+    }
+
+    lapic_base = madt->lapic;
+
+    u_int8 *end = (u_int8 *)madt + madt->header.length;
+    for (u_int8 *entry = (u_int8 *)(madt + 1); entry + 2 <= end && entry[1]; entry += entry[1]) {
+      if (*entry == MADT_LAPIC) {
+        madt_lapic_t *lapic = (madt_lapic_t *)entry;
+        if (lapic->flags & MADT_CPU_ENABLED) {
+          add_cpu(lapic->apic_id);
+        }
+      } else if (*entry == MADT_IOAPIC && !ioapic_base) {
+        madt_ioapic_t *ioapic = (madt_ioapic_t *)entry;
+        ioapic_base     = ioapic->address;
+        ioapic_gsi_base = ioapic->gsi_base;
+      } else if (*entry == MADT_OVERRIDE) {
+        madt_override_t *override = (madt_override_t *)entry;
+        if (override->source_irq < ISA_IRQS) {
+          irq_gsi[override->source_irq]   = override->gsi;
+          irq_flags[override->source_irq] = override->flags;
+        }
+      }
+    }
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
+
+void smp_install()
+{
+  nb_cpus = 1;
+  cpus[0].online = TRUE;
+  lapic_base = LAPIC_DEFAULT_BASE;
+
+  /* Whether there is a local APIC, and the identifier of ours */
+  u_int32 eax = 1, ebx, ecx, edx;
+  asm volatile ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+  apic_present = (edx >> 9) & 1;
+  cpus[0].apic_id = ebx >> 24;
+
+  /* Unless the firmware says otherwise, the ISA IRQs are the first inputs of the IOAPIC */
+  for (u_int32 irq = 0; irq < ISA_IRQS; irq++) {
+    irq_gsi[irq]   = irq;
+    irq_flags[irq] = 0;
+  }
+
+  if (!apic_present) {
+    kloug(100, "No local APIC, using a single processor\n");
+    return;
+  }
+
+  if (!parse_mp() && !parse_acpi()) {
+    kloug(100, "No MP nor ACPI table, using a single processor\n");
+  }
+  release_firmware();
+
+  /* The end of interruption is written once the directory of the process is
+   * back, so the registers are mapped in every directory */
+  if (!map_mmio(kernel_directory, lapic_base) || !map_mmio(base_directory, lapic_base)) {
+    kloug(100, "Unable to map the local APIC, using a single processor\n");
+    nb_cpus = 1;
+    apic_present = FALSE;
+    return;
+  }
+
+  lapic_enable(TRUE);
+  irq_install_apic();
+
+  kloug(100, "%d processors found\n", nb_cpus);
+  if (ioapic_base) {
+    kloug(100, "IOAPIC found at %X\n", ioapic_base, 8);
+  }
+}
+
+
+/**
+ * @name ap_main - Entry point of the application processors, called by the trampoline
+ * They run on their ap_stacks until they switch to their idle process.
+ * @return void
+ */
+void ap_main()
+{
+  u_int32 cpu = booting_cpu;
+
+  gdt_flush();
+  idt_load();
+  tss_flush(TSS_SEGMENTS[cpu]);  /* From now on, cpu_id() works */
+  sysenter_install();
+  current_directory = kernel_directory;  /* Loaded by the trampoline */
+
+  lapic_enable(FALSE);
+  cpus[cpu].online = TRUE;
+
+  lock_kernel();
+  scheduler_ap_start();  /* Never returns */
+}
+
+/* A parameter of the trampoline, in its copy */
+#define TRAMPOLINE_PARAM(param) \
+  (*(u_int32 *)(TRAMPOLINE + ((u_int32)&param - (u_int32)trampoline_start)))
+
+void smp_start_aps()
+{
+  if (nb_cpus == 1) {
+    return;
+  }
+
+  /* The trampoline is in the identity mapped low memory, below the kernel */
+  mem_copy((void *)TRAMPOLINE, trampoline_start, trampoline_end - trampoline_start);
+  TRAMPOLINE_PARAM(trampoline_cr3)   = kernel_directory->physical_address;
+  TRAMPOLINE_PARAM(trampoline_entry) = (u_int32)ap_main;
+
+  /* One at a time, as they share the trampoline */
+  for (u_int32 cpu = 1; cpu < nb_cpus; cpu++) {
+    booting_cpu = cpu;
+    TRAMPOLINE_PARAM(trampoline_stack) = (u_int32)&ap_stacks[cpu][AP_STACK_SIZE];
+
+    /* INIT, then two STARTUP with the page of the trampoline (MP specification, B.4) */
+    lapic_write(LAPIC_ESR, 0);
+    lapic_command(cpus[cpu].apic_id, ICR_INIT | ICR_LEVEL_ASSERT | ICR_LEVEL_TRIGGER);
+    timer_delay(10);
+    for (int i = 0; i < 2 && !cpus[cpu].online; i++) {
+      lapic_command(cpus[cpu].apic_id, ICR_STARTUP | (TRAMPOLINE / 0x1000));
+      timer_delay(1);
+    }
+
+    for (u_int32 ms = 0; ms < AP_START_TIMEOUT && !cpus[cpu].online; ms++) {
+      timer_delay(1);
+    }
+    if (!cpus[cpu].online) {
+      kloug(100, "Processor %d did not start\n", cpus[cpu].apic_id);
+    }
+  }
+}
@@ -0,0 +1,138 @@
+#ifndef SMP_H
+#define SMP_H
+
+/* smp.h:
+ * Detection and start-up of the processors, and their local APICs.
+ */
+
+#include "types.h"
+#include "spinlock.h"
+
+
+#define MAX_CPUS        8  /* Maximum number of processors used */
+#define AP_STACK_SIZE   0x1000  /* Size of the stack of a processor until it runs its idle process */
+#define TRAMPOLINE 0x8000  /* Physical address at which the application processors start, in real mode */
+
+#define LAPIC_DEFAULT_BASE 0xFEE00000  /* Physical address of the local APIC registers */
+
+/* Registers of the local APIC, as offsets from lapic_base */
+#define LAPIC_ID        0x020
+#define LAPIC_TPR       0x080  /* Task priority */
+#define LAPIC_EOI       0x0B0
+#define LAPIC_SVR       0x0F0  /* Spurious interruption vector, and software enable bit */
+#define LAPIC_ESR       0x280  /* Error status */
+#define LAPIC_ICR_LOW   0x300  /* Interruption command: vector and delivery mode */
+#define LAPIC_ICR_HIGH  0x310  /* Interruption command: destination */
+#define LAPIC_LINT0     0x350
+#define LAPIC_LINT1     0x360
+#define LAPIC_TIMER     0x320  /* Local vector table entry of the timer */
+#define LAPIC_TIMER_INIT 0x380 /* Initial count of the timer */
+#define LAPIC_TIMER_CURR 0x390 /* Current count of the timer */
+#define LAPIC_TIMER_DIV 0x3E0  /* Divide configuration of the timer */
+
+/* Local vector table */
+#define LVT_MASKED   0x00010000
+#define LVT_NMI      0x00000400
+#define LVT_EXTINT   0x00000700  /* The interruptions of the 8259 PIC */
+#define LVT_PERIODIC 0x00020000  /* Timer mode, otherwise one-shot */
+
+/* Interruption vectors delivered by the local APIC only, see irq.c */
+#define APIC_VECTORS      0xF0  /* First of them */
+#define IPI_TICK_VECTOR   0xF0  /* Scheduler tick, sent by another processor */
+#define APIC_TIMER_VECTOR 0xF1  /* Scheduler tick, from the local APIC timer */
+#define APIC_SPURIOUS     0xFF
+
+
+/* A processor */
+typedef struct cpu {
+  u_int8  apic_id;         /* Identifier of its local APIC */
+  volatile bool online;    /* Whether it started and runs the scheduler */
+  regs_t *next_frame;      /* If not NULL, frame through which the current interruption returns */
+  u_int32 tlb_generation;  /* Value of tlb_generation when its TLB was last flushed */
+  bool    lapic_ticking;   /* Whether its local APIC timer fires periodically */
+} cpu_t;
+
+cpu_t   cpus[MAX_CPUS];  /* cpus[0] is the bootstrap processor */
+u_int32 nb_cpus;         /* Number of processors found in the firmware tables */
+bool    apic_present;    /* Whether the local APICs are used */
+u_int32 lapic_base;      /* Address of the local APIC registers, identity mapped */
+u_int32 tlb_generation;  /* Incremented each time the TLB of the current processor is flushed */
+
+
+/**
+ * @name smp_install - Finds the processors (MP tables, or else ACPI MADT), and
+ * enables the local APIC of the bootstrap processor
+ * Must be called after paging_install and before any page directory is created,
+ * as the local APIC registers are mapped in base_directory.
+ * @return void
+ */
+void smp_install();
+
+/**
+ * @name smp_start_aps - Starts the application processors with INIT-SIPI-SIPI
+ * Each of them waits for the kernel lock, then calls scheduler_ap_start.
+ * @return void
+ */
+void smp_start_aps();
+
+/**
+ * @name cpu_id     - Returns the index in cpus of the current processor
+ * It is deduced from the TSS loaded in the task register.
+ * @return u_int32
+ */
+u_int32 cpu_id();
+
+/**
+ * @name lapic_read - Reads a register of the local APIC
+ * @param reg       - The offset of the register
+ * @return u_int32
+ */
+u_int32 lapic_read(u_int32 reg);
+
+/**
+ * @name lapic_write - Writes a register of the local APIC
+ * @param reg        - The offset of the register
+ * @param value      - The value to write
+ * @return void
+ */
+void lapic_write(u_int32 reg, u_int32 value);
+
+/**
+ * @name lapic_eoi - Acknowledges the interruption being handled
+ * @return void
+ */
+void lapic_eoi();
+
+/**
+ * @name send_ipi - Sends an inter-processor interruption
+ * @param cpu     - The index of the target processor
+ * @param vector  - The interruption vector
+ * @return void
+ */
+void send_ipi(u_int32 cpu, u_int8 vector);
+
+/**
+ * @name lock_kernel - Takes the kernel lock, held by the interruption handlers
+ * The kernel data (heap, frames, scheduler) is only used under this lock, and
+ * the TLB is flushed if another processor changed page tables in the meantime.
+ * @return void
+ */
+void lock_kernel();
+
+/**
+ * @name unlock_kernel - Releases the kernel lock
+ * @return void
+ */
+void unlock_kernel();
+
+/**
+ * @name resume_frame - Returns the frame through which the current interruption returns
+ * The ecx and edx registers of a frame built by sysenter are also written back
+ * on the user stack, where the stub of the process restores them. If they
+ * cannot be, the frame returns through iret instead.
+ * @param regs        - The frame pushed by the interruption
+ * @return regs_t*    - The frame of the process selected during the interruption
+ */
+regs_t *resume_frame(regs_t *regs);
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef SMP_ASM_H
+#define SMP_ASM_H
+
+#include "types.h"
+
+/* Start-up code of the application processors, copied at TRAMPOLINE */
+extern u_int8 trampoline_start[];
+extern u_int8 trampoline_end[];
+
+/* Parameters of the start-up code, to set in the copy */
+extern u_int32 trampoline_cr3;    /* Physical address of the page directory */
+extern u_int32 trampoline_stack;  /* Top of the stack */
+extern u_int32 trampoline_entry;  /* Address of the function to call */
+
+#endif
@@ -0,0 +1,63 @@
+; Start-up code of the application processors, see smp_start_aps in smp.c.
+; It is copied at TRAMPOLINE, where the processors start in real mode after
+; the SIPI, and brings them to protected mode with paging enabled, on their
+; own stack, before calling ap_main.
+
+TRAMPOLINE equ 0x8000
+
+; Address of a label once the trampoline is copied
+%define RELOC(label) (TRAMPOLINE + ((label) - trampoline_start))
+
+global trampoline_start
+global trampoline_end
+global trampoline_cr3
+global trampoline_stack
+global trampoline_entry
+
+section .data                   ; Never executed in place
+
+bits 16
+trampoline_start:
+  cli
+  xor ax, ax
+  mov ds, ax
+  lgdt [RELOC(trampoline_gdt_ptr)]
+  mov eax, cr0
+  or eax, 1                     ; Protected mode
+  mov cr0, eax
+  jmp dword 0x08:RELOC(trampoline_32)
+
+bits 32
+trampoline_32:
+  mov ax, 0x10
+  mov ds, ax
+  mov es, ax
+  mov fs, ax
+  mov gs, ax
+  mov ss, ax
+  mov eax, [RELOC(trampoline_cr3)]
+  mov cr3, eax
+  mov eax, cr0
+  or eax, 0x80000000            ; Paging
+  mov cr0, eax
+  mov esp, [RELOC(trampoline_stack)]
+  mov eax, [RELOC(trampoline_entry)]
+  call eax                      ; Never returns
+.halt:
+  cli
+  hlt
+  jmp .halt
+
+align 8
+trampoline_gdt:                 ; Flat segments, until ap_main loads the kernel GDT
+  dq 0
+  dq 0x00CF9A000000FFFF         ; Code, selector 0x08
+  dq 0x00CF92000000FFFF         ; Data, selector 0x10
+trampoline_gdt_ptr:
+  dw trampoline_gdt_ptr - trampoline_gdt - 1
+  dd RELOC(trampoline_gdt)
+
+trampoline_cr3:   dd 0          ; Physical address of the page directory
+trampoline_stack: dd 0          ; Top of the stack of the processor
+trampoline_entry: dd 0          ; Address of ap_main
+trampoline_end:
@@ -0,0 +1,27 @@
+#include "spinlock.h"
+
+
+bool spin_trylock(spinlock_t *lock)
+{
+  u_int32 previous = 1;
+  /* xchg with a memory operand is always atomic, no lock prefix needed */
+  asm volatile ("xchg %0, %1" : "+r" (previous), "+m" (*lock) : : "memory");
+  return previous == SPINLOCK_FREE;
+}
+
+void spin_lock(spinlock_t *lock)
+{
+  while (!spin_trylock(lock)) {
+    /* Waits on a plain read, which keeps the cache line shared until the release */
+    while (*lock != SPINLOCK_FREE) {
+      asm volatile ("pause");
+    }
+  }
+}
+
+void spin_unlock(spinlock_t *lock)
+{
+  /* Stores are not reordered with older loads and stores on x86 */
+  asm volatile ("" : : : "memory");
+  *lock = SPINLOCK_FREE;
+}
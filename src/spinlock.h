@@ -0,0 +1,38 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include "types.h"
+
+
+/**
+ * A lock taken by busy-waiting, 0 when free and 1 when held.
+ * It must only be held with the interruptions disabled, so that its holder
+ * cannot be interrupted by a handler trying to take it on the same processor.
+ */
+typedef volatile u_int32 spinlock_t;
+
+#define SPINLOCK_FREE 0
+
+
+/**
+ * @name spin_lock - Takes a lock, waiting for it to be released if needed
+ * @param lock     - The lock
+ * @return void
+ */
+void spin_lock(spinlock_t *lock);
+
+/**
+ * @name spin_trylock - Takes a lock if it is free
+ * @param lock        - The lock
+ * @return bool       - Whether the lock was taken
+ */
+bool spin_trylock(spinlock_t *lock);
+
+/**
+ * @name spin_unlock - Releases a lock
+ * @param lock       - The lock, which must be held by the caller
+ * @return void
+ */
+void spin_unlock(spinlock_t *lock);
+
+#endif
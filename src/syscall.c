@@ -10,25 +10,26 @@
 #include "memory.h"
 #include "shell.h"
 #include "utils.h"
+#include "timer.h"
+#include "channel.h"
+#include "pipe.h"
+#include "trace.h"
+#include "exec_cache.h"
 
 
-/* Possible speed enhancements:
- * - List of child processes for each process
- * - Stack of free processes
- */
-
 u_int8 sys_buf[2048]; // Static buffer
 
 extern scheduler_state_t *state;  /* Defined in scheduler.c */
 extern list_t *run_pid;
 
-#define CURR_PROC (state->processes[state->curr_pid])
-#define CURR_REGS (state->processes[state->curr_pid].context.regs)
+#define CURR_PROC (PROCESS(CURR_PID))
+#define CURR_REGS (PROCESS(CURR_PID).context.regs)
+#define CURR_DIR  (PROCESS(CURR_PID).context.page_dir)
 
 #define SWITCH_AFTER()                                              \
   kernel_context.unallocated_mem  = unallocated_mem;                \
   kernel_context.first_free_block = first_free_block;               \
-  context_t *ctx = &state->processes[state->curr_pid].context;      \
+  context_t *ctx = &PROCESS(CURR_PID).context;             \
   first_free_block = ctx->first_free_block;                         \
   unallocated_mem  = ctx->unallocated_mem;                          \
   switch_page_directory(ctx->page_dir);
@@ -42,6 +43,52 @@ extern list_t *run_pid;
   unallocated_mem  = kernel_context.unallocated_mem;    \
   first_free_block = kernel_context.first_free_block;
 
+
+/**
+ * @name restart_syscall - Makes the current process execute its syscall again
+ * once it is woken up, its registers being unchanged.
+ * @return void
+ */
+void restart_syscall()
+{
+  regs_t *regs = CURR_REGS;
+  if (regs->int_no == SYSENTER_FRAME) {
+    /* The sysenter of the stub is executed again, with the registers it expects
+     * (its stack still holds ecx and edx), and the process returns through iret */
+    regs->ecx = regs->useresp;
+    regs->edx = regs->eip;
+    regs->int_no = SYSCALL_ISR;
+  }
+  regs->eip -= 2;  /* Size of the int 0x80 and sysenter instructions */
+}
+
+/**
+ * @name std_fd - Replaces STDIN_FD and STDOUT_FD by the pipe ends of the current process
+ * @param f     - The file descriptor given by the process
+ * @return fd
+ */
+fd std_fd(fd f)
+{
+  if (f == STDIN_FD) {
+    return CURR_PROC.stdin;
+  } else if (f == STDOUT_FD) {
+    return CURR_PROC.stdout;
+  }
+  return f;
+}
+
+/**
+ * @name close_std_fds - Closes the pipe ends of a process, when it exits
+ * @param proc         - The process
+ * @return void
+ */
+void close_std_fds(process_t *proc)
+{
+  close(proc->stdin);
+  close(proc->stdout);
+  proc->stdin = proc->stdout = 0;
+}
+
 void syscall_malloc()
 {
   /* log_page_dir(CURR_PROC.context.page_dir); */
@@ -66,12 +113,13 @@ void syscall_free()
 
 void syscall_open()
 {
-  string path   = (void*) CURR_REGS->ebx;
+  u_int32 path  = CURR_REGS->ebx;
   u_int8 oflag  = CURR_REGS->ecx & 0xFF;
   u_int16 fperm = CURR_REGS->edx & 0xFFFF;
-  SWITCH_AFTER();
-  str_copy(path, (void*) &sys_buf);
-  SWITCH_BEFORE();
+  if(strncpy_from_user(CURR_DIR, (void*) &sys_buf, path, sizeof(sys_buf)) < 0) {
+    CURR_REGS->eax = 0; // Invalid path
+    return;
+  }
   fd ret = openfile((void*) &sys_buf, oflag, fperm);
   CURR_REGS->eax = (u_int32) ret;
 }
@@ -82,93 +130,199 @@ void syscall_close()
   close(f);
 }
 
-void syscall_read()
+/**
+ * @name user_file - Checks a file descriptor given by the current process
+ * @param f        - The file descriptor, STDIN_FD and STDOUT_FD included
+ * @param mode     - O_RDONLY or O_WRONLY, the access it must have been opened with
+ * @return fd      - The file descriptor, or 0 if it is invalid or lacks the access
+ */
+fd user_file(fd f, u_int16 mode)
 {
-  fd f = (void*) CURR_REGS->ebx;
-  u_int8* buffer = (void*) CURR_REGS->ecx;
-  u_int32 offset = CURR_REGS->edx;
-  u_int32 length = CURR_REGS->edi;
+  f = std_fd(f);
   if(!f || *f > fdt_size || fdt[*f].this != f || !fdt[*f].inode) {
-    CURR_REGS->eax = 0; // Invalid file descriptor
-    return;
+    return 0; // Invalid file descriptor
   }
-  if(!(fdt[*f].mode & O_RDONLY)) {
-    CURR_REGS->eax = 0; // No permission
-    return;
+  if(!(fdt[*f].mode & mode)) {
+    return 0; // No permission
   }
-  if(fdt[*f].pos >= fdt[*f].size) {
-    CURR_REGS->eax = 0;
-    return;
+  return f;
+}
+
+/**
+ * @name file_transfer - Reads or writes a file at a given position, from or to
+ * the memory of the current process
+ * @param f            - A valid file descriptor, which is not a pipe end
+ * @param buffer       - The address of the bytes in the process
+ * @param pos          - The position in the file
+ * @param length       - The number of bytes
+ * @param to_file      - Whether the bytes are written to the file
+ * @return u_int32     - The number of bytes transferred
+ */
+u_int32 file_transfer(fd f, u_int32 buffer, u_int32 pos, u_int32 length, bool to_file)
+{
+  fdt_e *file = &fdt[*f];
+  page_directory_t *dir = CURR_DIR;
+  if(!to_file) {
+    if(pos >= file->size) {
+      return 0;
+    }
+    length = min(length, file->size - pos);
+    return read_inode_user(file->inode, dir, buffer, pos, length);
   }
-  if(fdt[*f].pos + length > fdt[*f].size) {
-    length = fdt[*f].size - fdt[*f].pos;
+
+  if(pos > file->size) {
+    return 0; // The gap would show stale blocks, as lseek does not go past the end
   }
-  u_int32 inode = fdt[*f].inode;
-  u_int32 pos = fdt[*f].pos;
-  u_int32 done = read_inode_data(inode, sys_buf, pos, length);
-  SWITCH_AFTER();
-  mem_copy(buffer + offset, sys_buf, done);
-  SWITCH_BEFORE();
-  fdt[*f].pos += done;
-  CURR_REGS->eax = done;
+  if(!length || pos + length < pos || pos + length > max_file_size()) {
+    return 0; // Beyond the largest file
+  }
+  if(!prepare_file(file->inode, file->size, pos + length)) {
+    return 0; // All the blocks could not be allocated
+  }
+  u_int32 written = write_inode_user(file->inode, dir, buffer, pos, length);
+  if(written) {
+    file->size = max(file->size, pos + written);
+    set_file_size(file->inode, file->size);  // Also changes the generation
+  }
+  return written;
 }
 
-void syscall_write()
+/**
+ * @name pipe_transfer - Reads or writes a pipe end of the current process
+ * Restarts the syscall if the process blocks.
+ * @param f            - A valid file descriptor of a pipe end
+ * @param buffer       - The bytes in the process
+ * @param length       - Their number
+ * @param to_pipe      - Whether the bytes are written to the pipe
+ * @return void
+ */
+void pipe_transfer(fd f, u_int8 *buffer, u_int32 length, bool to_pipe)
 {
-  fd f = (void*) CURR_REGS->ebx;
+  s_int32 done;
+  if(to_pipe) {
+    done = pipe_write(fdt[*f].pipe, CURR_PID, buffer, length, FALSE);
+  } else {
+    done = pipe_read(fdt[*f].pipe, CURR_PID, buffer, length);
+  }
+  if(done == PIPE_BLOCKED) {
+    restart_syscall();
+  } else {
+    CURR_REGS->eax = done;
+  }
+}
+
+/**
+ * @name transfer - Common part of the read and write syscalls
+ * @param to_file - Whether it is a write
+ * @return void
+ */
+void transfer(bool to_file)
+{
+  fd f = user_file((void*) CURR_REGS->ebx, to_file ? O_WRONLY : O_RDONLY);
   u_int8* buffer = (void*) CURR_REGS->ecx;
   u_int32 offset = CURR_REGS->edx;
   u_int32 length = CURR_REGS->edi;
-  if(!f || *f > fdt_size || fdt[*f].this != f || !fdt[*f].inode) {
-    CURR_REGS->eax = 0;
-    return; // Invalid file descriptor
-  }
-  if(!(fdt[*f].mode & O_WRONLY)) {
-    CURR_REGS->eax = 0;
-    return; // No permission
-  }
-  if(!length) {
+  if(!f) {
     CURR_REGS->eax = 0;
     return;
   }
-  u_int32 to_use = 1 + (fdt[*f].pos + length - 1) / block_size;
-  u_int32 used;
-  if(fdt[*f].size) {
-    used = 1 + (fdt[*f].size - 1) / block_size;
-  } else {
-    used = 0;
+  if(fdt[*f].pipe >= 0) {
+    pipe_transfer(f, buffer + offset, length, to_file);
+    return;
   }
+  u_int32 done = file_transfer(f, (u_int32) (buffer + offset), fdt[*f].pos, length, to_file);
+  fdt[*f].pos += done;
+  CURR_REGS->eax = done;
+}
+
+void syscall_read()
+{
+  transfer(FALSE);
+}
 
-  u_int32 alloc  = prepare_blocks(fdt[*f].inode, used, to_use);
-  if(to_use > used && alloc != to_use - used) {
+void syscall_write()
+{
+  transfer(TRUE);
+}
+
+/**
+ * @name vector_transfer - Common part of the readv and writev syscalls
+ * @param to_file        - Whether it is a writev
+ * @return void
+ */
+void vector_transfer(bool to_file)
+{
+  fd f = user_file((void*) CURR_REGS->ebx, to_file ? O_WRONLY : O_RDONLY);
+  u_int32 iov    = CURR_REGS->ecx;
+  u_int32 count  = CURR_REGS->edx;
+  if(!f || fdt[*f].pipe >= 0 || count > IOV_MAX
+     || !copy_from_user(CURR_DIR, sys_buf, iov, count * sizeof(iovec_t))) {
     CURR_REGS->eax = 0;
-    return; // All the blocks could not be allocated
+    return;
   }
-  u_int32 written = 0;
-  u_int32 done = 0;
-  u_int32 inode = fdt[*f].inode;
-  u_int32 pos = fdt[*f].pos;
-  while(written != length) {
-    SWITCH_AFTER();
-    mem_copy(sys_buf, buffer + offset, max(length - written, sizeof(sys_buf)));
-    SWITCH_BEFORE();
-    done = write_inode_data(inode, sys_buf, pos, length - written);
-    if(!done) { // No data was written this time, so it won't evolve
-      break;
+  iovec_t *vectors = (void*) sys_buf;
+
+  u_int32 total = 0;
+  for(u_int32 i = 0; i < count; i++) {
+    u_int32 done = file_transfer(f, (u_int32) vectors[i].base, fdt[*f].pos,
+                                 vectors[i].length, to_file);
+    fdt[*f].pos += done;
+    total += done;
+    if(done != vectors[i].length) {
+      break; // End of file, or invalid buffer
     }
-    offset += done;
-    pos += done;
-    written += done;
   }
-  fdt[*f].pos = pos;
-  if(pos > fdt[*f].size) {
-    fdt[*f].size = pos;
-    // std_inode was set by write_inode_data or by prepare_block
-    std_inode->size_low = fdt[*f].size;
-    update_inode(fdt[*f].inode, std_inode);
+  CURR_REGS->eax = total;
+}
+
+void syscall_readv()
+{
+  vector_transfer(FALSE);
+}
+
+void syscall_writev()
+{
+  vector_transfer(TRUE);
+}
+
+/**
+ * @name positional_transfer - Common part of the pread and pwrite syscalls
+ * @param to_file            - Whether it is a pwrite
+ * @return void
+ */
+void positional_transfer(bool to_file)
+{
+  fd f = user_file((void*) CURR_REGS->ebx, to_file ? O_WRONLY : O_RDONLY);
+  u_int32 buffer = CURR_REGS->ecx;
+  u_int32 length = CURR_REGS->edx;
+  u_int32 pos    = CURR_REGS->edi;
+  if(!f || fdt[*f].pipe >= 0) {
+    CURR_REGS->eax = 0; // A pipe has no position
+    return;
   }
+  CURR_REGS->eax = file_transfer(f, buffer, pos, length, to_file);
+}
+
+void syscall_pread()
+{
+  positional_transfer(FALSE);
+}
+
+void syscall_pwrite()
+{
+  positional_transfer(TRUE);
+}
 
-  CURR_REGS->eax = written;
+void syscall_pipe()
+{
+  s_int32 p = new_pipe();
+  if(p < 0) {
+    CURR_REGS->eax = 0; // No free pipe
+    return;
+  }
+  CURR_REGS->eax = 1;
+  CURR_REGS->ebx = (u_int32) openpipe(p, O_RDONLY);
+  CURR_REGS->ecx = (u_int32) openpipe(p, O_WRONLY);
 }
 
 void syscall_lseek()
@@ -182,11 +336,9 @@ void syscall_lseek()
 void syscall_fstat()
 {
   fd f = (void*) CURR_REGS->ebx;
-  fstat(f, (void*) &sys_buf);
-  SWITCH_AFTER();
-  stats* s = (void*) CURR_REGS->ecx;
-  *s = *((stats*) (&sys_buf));
-  SWITCH_BEFORE();
+  stats s;
+  fstat(f, &s);
+  copy_to_user(CURR_DIR, CURR_REGS->ecx, &s, sizeof(stats));
 }
 
 
@@ -194,77 +346,219 @@ void syscall_fork()
 {
   kloug(100, "Syscall fork\n");
 
-  process_t *parent = &state->processes[state->curr_pid];
-  priority child_prio = CURR_REGS->ebx;
-
-  /* Research of a free process */
-  pid id = 0;
-  while (id < NUM_PROCESSES && state->processes[id].state != Free) {
-    id += 1;
+  process_t *parent = &PROCESS(CURR_PID);
+  priority child_prio = CURR_REGS->ebx & 0xFF;
+  sched_class_t child_class = parent->sched_class;
+  if (CURR_REGS->ebx & SCHED_FAIR) {
+    child_class = Fair;
+  } else if (CURR_REGS->ebx & SCHED_STRICT) {
+    child_class = Strict;
   }
 
   /* One cannot create a child process with a higher priority than its own */
-  if (id == NUM_PROCESSES || child_prio > CURR_PROC.prio) {
+  if (child_prio > CURR_PROC.prio) {
+    CURR_REGS->eax = 0;
+    return;
+  }
+
+  /* A free process, from the top of the free stack */
+  pid id = alloc_pid();
+  if (id == NO_PID) {
     CURR_REGS->eax = 0;
     return;
   }
 
   /* Initialization of fields, registers, copying of context */
-  process_t *proc = &state->processes[id];
-  *proc = new_process(state->curr_pid, child_prio, FALSE);
-  /* Context */
+  process_t *proc = &PROCESS(id);
+  *proc = new_process(id, CURR_PID, child_prio, FALSE);
+  proc->cpu = least_loaded_cpu();
+  proc->sched_class = child_class;
+  proc->vruntime = parent->vruntime;
+  /* Context, except the kernel stack */
+  context_t child_ctx = proc->context;
   mem_copy(&proc->context, &parent->context, sizeof(context_t));
+  proc->context.regs = child_ctx.regs;
+  proc->context.kernel_stack = child_ctx.kernel_stack;
   /* Regs */
-  proc->context.regs = (regs_t *)mem_alloc(sizeof(regs_t));
   /* kloug(100, "Parent %x child %x\n", parent->context.regs, proc->context.regs); */
   mem_copy(proc->context.regs, parent->context.regs, sizeof(regs_t));
   proc->context.regs->eax = 2;
-  proc->context.regs->ebx = state->curr_pid;
+  proc->context.regs->ebx = CURR_PID;
   /* Page directory */
   proc->context.page_dir = fork_page_dir(parent->context.page_dir);
+  proc->sys_ring = parent->sys_ring;  /* At the same address in the copied memory */
+  proc->image = parent->image;        /* Its read-only pages are linked */
+  retain_exec_image(proc->image);
+  proc->stdin  = dup(parent->stdin);
+  proc->stdout = dup(parent->stdout);
+  add_child(CURR_PID, id);
 
   /* Adding the process in the runqueue */
-  enqueue(state->runqueues[child_prio], id);
+  enqueue_process(id);
 
   /* Setting the values of the parent process */
   CURR_REGS->eax = 1;
   CURR_REGS->ebx = id;
 }
 
+/**
+ * @name user_args - Copies the arguments of a program out of the current process
+ * @param name      - The address of its name, the only argument if argv is NULL
+ * @param argv      - The address of its NULL-terminated array of arguments
+ * @param args      - Where to put them, EXEC_ARGS_MAX bytes of consecutive strings
+ * @param argc      - Will be set to their number
+ * @return u_int32  - Their total size, or 0 if they are invalid
+ */
+u_int32 user_args(u_int32 name, u_int32 argv, char *args, u_int32 *argc)
+{
+  page_directory_t *dir = CURR_DIR;
+  if (!argv) {
+    *argc = 1;
+    s_int32 size = strncpy_from_user(dir, args, name, EXEC_ARGS_MAX);
+    return size < 0 ? 0 : size + 1;
+  }
+
+  u_int32 length = 0, arg;
+  for (*argc = 0; copy_from_user(dir, &arg, argv + *argc * sizeof(u_int32), sizeof(u_int32)) && arg;
+       (*argc)++) {
+    s_int32 size = *argc < EXEC_ARGC_MAX ?
+      strncpy_from_user(dir, args + length, arg, EXEC_ARGS_MAX - length) : -1;
+    if (size < 0) {
+      return 0;
+    }
+    length += size + 1;
+  }
+  return arg ? 0 : length;  /* Unreadable argv */
+}
+
+/**
+ * @name user_program - Looks for the executable of a program named by the current process
+ * @param name        - The address of the name
+ * @return u_int32    - The inode of the executable, or 0
+ */
+u_int32 user_program(u_int32 name)
+{
+  if (strncpy_from_user(CURR_DIR, (void*) &sys_buf, name, sizeof(sys_buf)) < 0) {
+    return 0;
+  }
+  return program_inode((string) sys_buf);
+}
+
+void syscall_exec()
+{
+  process_t *proc = &CURR_PROC;
+
+  /* Everything is copied out of the old image before it is torn down */
+  char args[EXEC_ARGS_MAX];
+  u_int32 argc;
+  u_int32 length = user_args(CURR_REGS->ebx, CURR_REGS->ecx, args, &argc);
+  u_int32 inode  = length ? user_program(CURR_REGS->ebx) : 0;
+  /* The executable is read and checked while the call can still fail */
+  exec_image_t *image = open_exec_image(inode);
+  if (!image) {
+    CURR_REGS->eax = 0;
+    return;
+  }
+
+  /* The point of no return: the same pid, channels and pipe ends, in a new image */
+  release_exec_image(proc->image);
+  proc->image = NULL;
+  reset_page_dir(proc->context.page_dir, &proc->context.first_free_block,
+                 &proc->context.unallocated_mem);
+  proc->sys_ring = NULL;  /* It was in the old memory */
+  proc->out_done = 0;
+  init_regs(CURR_REGS);   /* Also returns through iret rather than sysexit */
+
+  bool loaded = load_code(image, proc);
+  if (!loaded) {
+    release_exec_image(image);
+  }
+  if (!loaded || !set_program_args(proc->context, args, length, argc)) {
+    /* Nothing is left to return to: the process exits */
+    CURR_REGS->ebx = -1;
+    syscall_exit();
+  }
+}
+
+void syscall_spawn()
+{
+  process_t *parent = &CURR_PROC;
+  priority child_prio = CURR_REGS->edx & 0xFF;
+  sched_class_t child_class = parent->sched_class;
+  if (CURR_REGS->edx & SCHED_FAIR) {
+    child_class = Fair;
+  } else if (CURR_REGS->edx & SCHED_STRICT) {
+    child_class = Strict;
+  }
+
+  /* Same rule as fork */
+  if (child_prio > parent->prio) {
+    CURR_REGS->eax = 0;
+    return;
+  }
+
+  char args[EXEC_ARGS_MAX];
+  u_int32 argc;
+  u_int32 length = user_args(CURR_REGS->ebx, CURR_REGS->ecx, args, &argc);
+  u_int32 inode  = length ? user_program(CURR_REGS->ebx) : 0;
+  if (!inode) {
+    CURR_REGS->eax = 0;
+    return;
+  }
+
+  pid id = start_program(inode, CURR_PID, child_prio, args, length, argc);
+  if (id == NO_PID) {
+    CURR_REGS->eax = 0;
+    return;
+  }
+
+  process_t *proc = &PROCESS(id);
+  proc->sched_class = child_class;
+  proc->vruntime = parent->vruntime;
+  proc->stdin  = dup(parent->stdin);
+  proc->stdout = dup(parent->stdout);
+  enqueue_process(id);
+
+  CURR_REGS->eax = 1;
+  CURR_REGS->ebx = id;
+}
+
 /**
  * @name resolve_exit_wait - Resolves an exit or wait syscall
- * @param parent           - The parent process, in waiting mode
+ * @param parent           - The parent process, waiting or calling wait
  * @param child            - The child process, in zombie mode
  * @return void
  */
 void resolve_exit_wait(pid parent, pid child)
 {
   kloug(100, "Resolve exit wait %d %d\n", parent, child);
-  process_t* parent_proc = &state->processes[parent];
-  process_t* child_proc  = &state->processes[child];
+  process_t* parent_proc = &PROCESS(parent);
+  process_t* child_proc  = &PROCESS(child);
   /* kloug(100, "Child ebx %d\n", child_proc->context.regs->ebx); */
   /* kloug(100, "%x %x\n", parent_proc->context.regs, child_proc->context.regs); */
+  /* A killed process may still be waiting for its deadline */
+  if (child_proc->state == Sleeping) {
+    cancel_sleep(child);
+  }
+  /* Or blocked on a wait queue or on channels */
+  leave_wait_queue(child);
+  channel_cancel(child);
+  close_channels(child);
+  close_std_fds(child_proc);
   /* Freeing the child from zombie state */
-  state->processes[child].state = Free;
+  remove_child(child);
+  free_pid(child);
 
   /* Goodbye cruel world: removes the child from the runqueue */
-  priority prio = child_proc->prio;
-  queue_t *q = state->runqueues[prio];
-  queue_t *temp = empty_queue();
-  while (!is_empty_queue(q)) {
-    pid pid = dequeue(q);
-    if (pid != child) {
-      enqueue(temp, pid);
-    }
-  }
-  state->runqueues[prio] = temp;
+  dequeue_process(child);
 
   /* Also free everything */
-  mem_free(child_proc->context.regs);
   free_page_dir(child_proc->context.page_dir);
 
   /* Notifies the parent */
-  parent_proc->state = Runnable;
+  if (parent_proc->state == Waiting) {
+    wake_up_one(&parent_proc->child_exit);
+  }
   parent_proc->context.regs->eax = 1;
   parent_proc->context.regs->ebx = child;
   parent_proc->context.regs->ecx = child_proc->context.regs->ebx;  /* Return value */
@@ -280,22 +574,26 @@ void syscall_exit()
 {
   kloug(100, "Syscall exit\n");
 
-  pid id = state->curr_pid;
-  state->processes[id].state = Zombie;
-
-  /* Notifies the child processes of the exiting one, and resolve also exits */
-  for (pid i = 0; i < NUM_PROCESSES; i++) {
-    if (state->processes[i].parent_id == id) {
-      state->processes[i].parent_id = 1;
-      if (state->processes[i].state == Zombie && state->processes[1].state == Waiting) {
-        resolve_exit_wait(1, i);
-      }
+  pid id = CURR_PID;
+  process_t *proc = &PROCESS(id);
+  proc->state = Zombie;
+  dequeue_process(id);  /* No longer counted in the load of its processor */
+  close_channels(id);
+  close_std_fds(proc);  /* The other side of the pipes sees the end */
+
+  /* The children of the exiting process are adopted by init, which resolves the zombie ones */
+  while (proc->first_child != NO_PID) {
+    pid child = proc->first_child;
+    remove_child(child);
+    add_child(INIT_PID, child);
+    if (PROCESS(child).state == Zombie && PROCESS(INIT_PID).state == Waiting) {
+      resolve_exit_wait(INIT_PID, child);
     }
   }
 
   /* Checks whether the parent was waiting for us to die (how cruel!) */
-  pid parent_id = state->processes[id].parent_id;
-  if (state->processes[parent_id].state == Waiting) {
+  pid parent_id = PROCESS(id).parent_id;
+  if (PROCESS(parent_id).state == Waiting) {
     resolve_exit_wait(parent_id, id);
   }
 }
@@ -304,145 +602,235 @@ void syscall_wait()
 {
   kloug(100, "Syscall wait\n");
 
-  CURR_PROC.state = Waiting;
-  pid parent_id = state->curr_pid;
-  bool has_children = FALSE;
-
-  for (pid id = 0; id < NUM_PROCESSES; id++) {
-    process_t proc = state->processes[id];
-    if (proc.parent_id == parent_id) {
-      has_children = TRUE;
-      if (proc.state== Zombie) {
-        resolve_exit_wait(parent_id, id);
-        return;
-      }
+  pid parent_id = CURR_PID;
+  process_t *parent = &CURR_PROC;
+
+  for (pid id = parent->first_child; id != NO_PID; id = PROCESS(id).next_sibling) {
+    if (PROCESS(id).state == Zombie) {
+      resolve_exit_wait(parent_id, id);
+      return;
     }
   }
 
-  if (!has_children) {
+  if (parent->first_child == NO_PID && parent_id != INIT_PID) {
     /* The process has no children, the call terminates instantly */
     CURR_REGS->eax = 0;
-    CURR_PROC.state = Runnable;
-  }
-}
-
-
-extern unsigned char utf8_c2[], utf8_c3[];  /* Defined in printer.c */
-extern color_t foreground, background;      /* Defined in printer.c */
-
-#define POP(type)                                                       \
-  type param = *(type *)(esp + 16 + 4*nb_args);                         \
-  nb_args++;
-
-
-void syscall_printf()
-{
-  context_t ctx = CURR_PROC.context;
-  u_int32 esp = ctx.regs->useresp;
-  string s = (string)ctx.regs->ebx;
-  switch_page_directory(ctx.page_dir);
-
-  /* kloug(100, "Format string %s\n", s); */
-
-  int read  = 0;
-  char buffer[17];
-  char c = s[0];
-  int nb_args = 0; /* To have the right offset */
-
-  while(c!='\0') {
-    if(c=='%') {
-      read++;
-      switch(s[read]) {
-
-      case 'd': { // Decimal (signed)
-        POP(int);
-        int_to_string(buffer, param, 10);
-        write_string(buffer); break; }
-      case 'u': { // Decimal (unsigned)
-        POP(unsigned int);
-        u_int_to_string(buffer, param, 10);
-        write_string(buffer); break; }
-      case 'x': { // Hexadecimal
-        POP(unsigned int);
-        u_int_to_string(buffer, param, 16);
-        write_string("0x"); write_string(buffer); break; }
-      case 'h': { // Hexadecimal (without "0x")
-        POP(unsigned int);
-        u_int_to_string(buffer, param, 16);
-        write_string(buffer); break; }
-      case 'c': { // Character
-        POP(char);
-        write_char(param); break; }
-      case 's': { // String
-        POP(string);
-        write_string(param); break; }
-      case 'f': { // Foreground color
-        POP(color_t);
-        foreground = param; break; }
-      case 'b': { // Background color
-        POP(color_t);
-        background = param; break; }
-      case '%': { // Writes a '%'
-        write_char('%'); break; }
-      default:  { // Emergency stop
-        throw("Invalid format string");
-      }
-      }
-    } else if(c==0xc2) {
-      read++;
-      write_char(utf8_c2[(unsigned int)(s[read]-0xa1)]);
-    }
-    else if(c==0xc3) {
-      read++;
-      write_char(utf8_c3[(unsigned int)(s[read]-0x80)]);
-    }
-    else
-      write_char(c);
-    read++;
-    c = s[read];
+    return;
+  }
+
+  /* Parked until a child exits. Init also waits for its future orphans. */
+  block_process(&parent->child_exit, parent_id, Waiting);
+}
+
+
+u_int8 out_buf[CONSOLE_WRITE_MAX];  /* Characters being written, in the kernel image */
+
+void syscall_console_write()
+{
+  u_int32 chars  = CURR_REGS->ebx;
+  u_int32 length = min(CURR_REGS->ecx, sizeof(out_buf));
+  if (!copy_from_user(CURR_DIR, out_buf, chars, length)) {
+    CURR_REGS->eax = 0;
+    return;
+  }
+
+  fd out = CURR_PROC.stdout;
+  if (!out) {
+    write_chars((char *)out_buf, length);
+    CURR_REGS->eax = length;
+    return;
+  }
+
+  /* The call is made again until every character is written, skipping what
+   * already was: the characters are unchanged meanwhile */
+  process_t *proc = &CURR_PROC;
+  u_int32 out_length = strip_escapes((char *)out_buf, length);
+  if (!out_length) {
+    CURR_REGS->eax = length;  /* Only colors */
+    return;
+  }
+  s_int32 done = pipe_write(fdt[*out].pipe, CURR_PID, out_buf + proc->out_done,
+                            out_length - proc->out_done, TRUE);  /* out_buf is in the kernel */
+  if (done == PIPE_BLOCKED) {
+    restart_syscall();
+    return;
+  }
+  proc->out_done += done;
+  if (done && proc->out_done < out_length) {
+    restart_syscall();  /* Blocks on the full pipe */
+  } else {
+    proc->out_done = 0;  /* Done, or no reader left */
+    CURR_REGS->eax = done ? length : 0;
+  }
+}
+
+
+void syscall_new_channel()
+{
+  CURR_REGS->eax = new_channel(CURR_PID);
+}
+
+void syscall_send()
+{
+  chanid  chan  = CURR_REGS->ebx;
+  u_int32 value = CURR_REGS->ecx;
+  CURR_REGS->eax = channel_send(CURR_PID, chan, value);
+}
+
+void syscall_receive()
+{
+  u_int32 user_chans = CURR_REGS->ebx;
+  u_int32 nb_chans   = CURR_REGS->ecx;
+  if (nb_chans > RECV_CHANNELS) {
+    nb_chans = RECV_CHANNELS;
+  }
+
+  chanid chans[RECV_CHANNELS];
+  if (!copy_from_user(CURR_DIR, chans, user_chans, nb_chans * sizeof(chanid))
+      || !channel_receive(CURR_PID, chans, nb_chans)) {
+    CURR_REGS->eax = 0;
+  }
+}
+
+void syscall_new_bulk()
+{
+  CURR_REGS->eax = new_bulk_channel(CURR_PID);
+}
+
+void syscall_bulk_send()
+{
+  s_int32 done = bulk_send(CURR_PID, CURR_REGS->ebx, (void *)CURR_REGS->ecx, CURR_REGS->edx);
+  if (done == BULK_BLOCKED) {
+    restart_syscall();
+  } else {
+    CURR_REGS->eax = done;
   }
+}
 
-  switch_page_directory(kernel_directory);
+void syscall_bulk_receive()
+{
+  s_int32 done = bulk_receive(CURR_PID, CURR_REGS->ebx, (void *)CURR_REGS->ecx, CURR_REGS->edx);
+  if (done == BULK_BLOCKED) {
+    restart_syscall();
+  } else {
+    CURR_REGS->eax = done;
+  }
 }
 
 
-extern bool in_kernel, should_cycle, run_executed;  /* From scheduler.c */
 void syscall_hlt()
 {
-  should_cycle = FALSE;
+  cpu_state_t *cpu = CPU_STATE;
 
-  for (;;) {
+  /* Until a process is queued on this processor (by run, a wake up, another processor...) */
+  while (!cpu->need_resched) {
+    /* The other processors may use the kernel meanwhile. sti only takes effect
+     * after hlt, so an interruption sent after the release still wakes us up */
+    unlock_kernel();
     asm volatile ("sti; hlt; cli");
-
-    if (!should_cycle || run_executed) {
-      /* The interruption was not a timer */
-      should_cycle = TRUE;  /* We want to change process, maybe someone has something to do */
-      run_executed = FALSE;
-      /* kloug(100, "Leaving hlt\n"); */
-      break;
-    } else {
-      /* We received a timer event */
-      /* kloug(100, "Timer event\n"); */
-      should_cycle = FALSE;
-    }
+    lock_kernel();
   }
+
+  /* kloug(100, "Leaving hlt\n"); */
+  cpu->should_cycle = TRUE;  /* We want to change process, maybe someone has something to do */
+  cpu->yielded = TRUE;
 }
 
 
 void kill_family(pid parent)
 {
-  process_t *proc = &state->processes[parent];
+  process_t *proc = &PROCESS(parent);
+
+  /* resolve_exit_wait removes each child from the list */
+  while (proc->first_child != NO_PID) {
+    pid child = proc->first_child;
+    kill_family(child);
+    if (proc->first_child == child) {
+      /* Exits later on its processor, init collects it then */
+      remove_child(child);
+      add_child(INIT_PID, child);
+    }
+  }
 
-  for (pid child = 0; child < NUM_PROCESSES; child++) {
-    if (state->processes[child].parent_id == parent) {
-      kill_family(child);
+  if (stack_in_use(parent)) {
+    /* Freeing it would pull its paging and its stack from under its processor,
+     * which makes it exit at its next kernel entry instead (see exit_killed) */
+    proc->killed = TRUE;
+    if (proc->cpu != cpu_id()) {
+      send_ipi(proc->cpu, IPI_TICK_VECTOR);
     }
+    return;
   }
 
   resolve_exit_wait(proc->parent_id, parent);
 }
 
 
+bool exit_killed(pid released, regs_t *regs)
+{
+  pid curr = CURR_PID;
+
+  if (released != curr && PROCESS(released).killed) {
+    /* The last interruption switched away from it, its stack is free now */
+    kill_family(released);
+  }
+
+  if (!PROCESS(curr).killed) {
+    return FALSE;
+  }
+  regs->ebx = -1;  /* Return value */
+  syscall_exit();
+  return TRUE;
+}
+
+
+void syscall_sleep()
+{
+  u_int32 ms = CURR_REGS->ebx;
+
+  if (ms) {
+    sleep_process(CURR_PID, ms);
+  } else {
+    CPU_STATE->should_cycle = TRUE;  /* Yields the processor */
+    CPU_STATE->yielded = TRUE;
+  }
+}
+
+void syscall_uptime()
+{
+  CURR_REGS->eax = timer_ticks;
+}
+
+
+void syscall_pstat()
+{
+  pid id = CURR_REGS->ebx;
+  u_int32 dest = CURR_REGS->ecx;
+
+  if (id >= state->nb_processes || PROCESS(id).state == Free) {
+    CURR_REGS->eax = 0;
+    return;
+  }
+
+  CURR_REGS->eax = copy_to_user(CURR_DIR, dest, &PROCESS(id).stats, sizeof(proc_stats_t));
+}
+
+extern histogram_t timer_hist, syscall_hist;  /* Defined in scheduler.c */
+void syscall_hstat()
+{
+  u_int32 dest = CURR_REGS->ecx;
+  histogram_t *src;
+
+  switch (CURR_REGS->ebx) {
+  case 0:  src = &timer_hist;   break;
+  case 1:  src = &syscall_hist; break;
+  default: CURR_REGS->eax = 0;  return;
+  }
+
+  CURR_REGS->eax = copy_to_user(CURR_DIR, dest, src, sizeof(histogram_t));
+}
+
+
 void syscall_invalid()
 {
   throw("Invalid syscall!");
@@ -458,7 +846,7 @@ void syscall_install()
   syscall_table[Exit]    = *syscall_exit;
   syscall_table[Wait]    = *syscall_wait;
   syscall_table[Fork]    = *syscall_fork;
-  syscall_table[Printf]  = *syscall_printf;
+  syscall_table[ConsoleWrite] = *syscall_console_write;
   syscall_table[Hlt]     = *syscall_hlt;
   syscall_table[Malloc]  = *syscall_malloc;
   syscall_table[MemFree] = *syscall_free;
@@ -468,15 +856,187 @@ void syscall_install()
   syscall_table[Write]   = *syscall_write;
   syscall_table[Lseek]   = *syscall_lseek;
   syscall_table[Fstat]   = *syscall_fstat;
+  syscall_table[Sleep]   = *syscall_sleep;
+  syscall_table[Uptime]  = *syscall_uptime;
+  syscall_table[Pstat]   = *syscall_pstat;
+  syscall_table[Hstat]   = *syscall_hstat;
+  syscall_table[NewChannel] = *syscall_new_channel;
+  syscall_table[Send]       = *syscall_send;
+  syscall_table[Receive]    = *syscall_receive;
+  syscall_table[NewBulk]    = *syscall_new_bulk;
+  syscall_table[BulkSend]   = *syscall_bulk_send;
+  syscall_table[BulkRecv]   = *syscall_bulk_receive;
+  syscall_table[Pipe]       = *syscall_pipe;
+  syscall_table[RingSetup]  = *syscall_ring_setup;
+  syscall_table[RingEnter]  = *syscall_ring_enter;
+  syscall_table[FastEntry]  = *syscall_fast_entry;
+  syscall_table[Readv]      = *syscall_readv;
+  syscall_table[Writev]     = *syscall_writev;
+  syscall_table[Pread]      = *syscall_pread;
+  syscall_table[Pwrite]     = *syscall_pwrite;
+  syscall_table[Exec]       = *syscall_exec;
+  syscall_table[Spawn]      = *syscall_spawn;
 
   idt_set_gate(SYSCALL_ISR, (u_int32)common_interrupt_handler, KERNEL_CODE_SEGMENT, 3);
+  sysenter_install();
 }
 
+/* The syscalls which can be queued in a ring: they neither end nor switch the
+ * process, and those which block (on pipes) are resumed later */
+#define RING_OPS ((1ULL << Malloc) | (1ULL << MemFree) | (1ULL << Open) | (1ULL << Close) | \
+                  (1ULL << Read) | (1ULL << Write) | (1ULL << Lseek) | (1ULL << Fstat) |    \
+                  (1ULL << Uptime) | (1ULL << Pstat) | (1ULL << Readv) | (1ULL << Writev) | \
+                  (1ULL << Pread) | (1ULL << Pwrite))
+
+/**
+ * @name run_syscall_ring - Performs the syscalls queued in the ring of the current process
+ * Each one runs as a normal syscall, on the registers of the process which are
+ * then restored. The batch stops before a syscall which blocks the process.
+ * @param from_tick       - Whether the process is being preempted, in which case
+ *                          it does not stay blocked
+ * @return u_int32        - The number of syscalls performed
+ */
+u_int32 run_syscall_ring(bool from_tick)
+{
+  process_t *proc = &CURR_PROC;
+  sys_ring_t *ring = proc->sys_ring;
+  if (!ring) {
+    return 0;
+  }
+
+  regs_t *regs = proc->context.regs;
+  regs_t saved = *regs;
+  u_int32 done = 0;
+
+  while (TRUE) {
+    /* The indices, then the submission, are copied as the process may change them */
+    u_int32 indices[4];  /* sq_head, sq_tail, cq_head, cq_tail */
+    sys_ring_sqe_t sqe;
+    page_directory_t *dir = proc->context.page_dir;
+    if (!copy_from_user(dir, indices, (u_int32)ring, sizeof(indices))) {
+      break;
+    }
+    u_int32 sq_head = indices[0], cq_tail = indices[3];
+    bool pending = sq_head != indices[1] && cq_tail - indices[2] < SYS_RING_ENTRIES;
+    if (!pending || !copy_from_user(dir, &sqe, (u_int32)&ring->sq[sq_head % SYS_RING_ENTRIES],
+                                    sizeof(sys_ring_sqe_t))) {
+      break;
+    }
+
+    u_int32 result = SYS_RING_INVALID;
+    if (sqe.op < NUM_SYSCALLS && (RING_OPS & (1ULL << sqe.op))) {
+      regs->eax = sqe.op;
+      regs->ebx = sqe.ebx;
+      regs->ecx = sqe.ecx;
+      regs->edx = sqe.edx;
+      regs->edi = sqe.edi;
+      syscall_table[sqe.op]();
+      result = regs->eax;
+      *regs = saved;
+    }
+
+    if (proc->state != Runnable) {
+      /* It blocked, and is performed again once the process is woken up */
+      if (from_tick) {
+        leave_wait_queue(CURR_PID);
+        make_runnable(CURR_PID);
+      }
+      break;
+    }
+
+    sys_ring_cqe_t cqe = { .user_data = sqe.user_data, .result = result };
+    sq_head++;
+    cq_tail++;
+    copy_to_user(dir, (u_int32)&ring->cq[(cq_tail - 1) % SYS_RING_ENTRIES], &cqe, sizeof(cqe));
+    copy_to_user(dir, (u_int32)&ring->cq_tail, &cq_tail, sizeof(u_int32));
+    copy_to_user(dir, (u_int32)&ring->sq_head, &sq_head, sizeof(u_int32));
+    done++;
+  }
+
+  return done;
+}
+
+bool read_stub_registers(regs_t *regs, page_directory_t *dir)
+{
+  u_int32 saved[2];  /* edx then ecx, as pushed by the stub */
+  if (!copy_from_user(dir, saved, regs->useresp, sizeof(saved))) {
+    return FALSE;
+  }
+  regs->edx = saved[0];
+  regs->ecx = saved[1];
+  return TRUE;
+}
+
+bool write_stub_registers(regs_t *regs, page_directory_t *dir)
+{
+  u_int32 saved[2] = { regs->edx, regs->ecx };
+  return copy_to_user(dir, regs->useresp, saved, sizeof(saved));
+}
+
+#define MSR_SYSENTER_CS  0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
+void sysenter_install()
+{
+  u_int32 eax = 1, ebx, ecx, edx;
+  asm volatile ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+  u_int32 family = (eax >> 8) & 0xF, model = (eax >> 4) & 0xF, stepping = eax & 0xF;
+  /* The first Pentium Pro claim to support it, but do not */
+  if (!((edx >> 11) & 1) || (family == 6 && model < 3 && stepping < 3)) {
+    sysenter_enabled = FALSE;
+    return;
+  }
+
+  /* The stack is read from the TSS at each entry, see syscall_asm.s */
+  u_int32 values[3] = { KERNEL_CODE_SEGMENT, (u_int32)&TSS_ENTRIES[cpu_id()].esp0,
+                        (u_int32)sysenter_entry };
+  for (u_int32 i = 0; i < 3; i++) {
+    asm volatile ("wrmsr" : : "c" (MSR_SYSENTER_CS + i), "a" (values[i]), "d" (0));
+  }
+  sysenter_enabled = TRUE;
+}
+
+void syscall_fast_entry()
+{
+  CURR_REGS->eax = sysenter_enabled;
+}
+
+void syscall_ring_setup()
+{
+  CURR_PROC.sys_ring = (void *)CURR_REGS->ebx;
+}
+
+void syscall_ring_enter()
+{
+  u_int32 done = run_syscall_ring(FALSE);
+  if (CURR_PROC.state != Runnable) {
+    restart_syscall();
+  } else {
+    CURR_REGS->eax = done;
+  }
+}
+
+void poll_syscall_ring()
+{
+  if (CURR_PROC.state == Runnable) {
+    run_syscall_ring(TRUE);
+  }
+}
+
+
 void syscall(syscall_t sc)
 {
   if (sc >= NUM_SYSCALLS) {
     syscall_invalid();
+  } else if (trace_mode == TraceOff) {
+    syscall_table[sc]();
   } else {
+    /* The params first, as the syscall may overwrite them with its results */
+    pid id = CURR_PID;
+    u_int32 args[4] = { CURR_REGS->ebx, CURR_REGS->ecx, CURR_REGS->edx, CURR_REGS->edi };
+    u_int32 tsc = read_tsc();
     syscall_table[sc]();
+    trace_syscall(id, sc, args, read_tsc() - tsc);
   }
 }
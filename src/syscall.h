@@ -5,12 +5,16 @@
 #include "fs_inter.h"
 
 #define SYSCALL_ISR 0x80
+#define SYSENTER_FRAME 0x81  /* Interruption number of the frames built by sysenter_entry */
+#define CONSOLE_WRITE_MAX 2048  /* Maximal number of characters of a ConsoleWrite */
+
+bool sysenter_enabled;  /* Whether the processors accept syscalls through sysenter */
 
 typedef enum syscall {
   Exit       =  0,    /* The process is finished and returns a value */
   Fork       =  1,    /* Creates a new child process, with the same context at first */
   Wait       =  2,    /* Waits for a child to return a value */
-  Printf     =  3,    /* Prints to the framebuffer */
+  ConsoleWrite = 3,   /* Writes characters to the framebuffer, or to stdout */
   Malloc     =  4,
   MemFree    =  5,
   Ls         =  6,
@@ -28,13 +32,63 @@ typedef enum syscall {
   Write      = 18,
   Lseek      = 19,
   Fstat      = 20,
+  Sleep      = 21,
+  Uptime     = 22,
+  Pstat      = 23,
+  Hstat      = 24,
+  NewBulk    = 25,    /* Creates a bulk channel */
+  BulkSend   = 26,
+  BulkRecv   = 27,
+  Pipe       = 28,    /* Creates a pipe, read and written as a file */
+  RingSetup  = 29,    /* Registers a syscall ring */
+  RingEnter  = 30,    /* Performs the syscalls queued in the ring */
+  FastEntry  = 31,    /* Whether sysenter can be used */
+  Readv      = 32,    /* Reads a file into several buffers */
+  Writev     = 33,    /* Writes several buffers to a file */
+  Pread      = 34,    /* Reads a file at a given position */
+  Pwrite     = 35,    /* Writes a file at a given position */
+  Exec       = 36,    /* Replaces the program of the process */
+  Spawn      = 37,    /* Creates a child process running a program */
   Invalid,       /* /!\ This need to be the last syscall */
 } syscall_t;
 
+
+/* Syscall ring: the process queues syscalls in the submission queue, and the
+ * kernel performs them in a batch, either on RingEnter or when it preempts the
+ * process, putting their results in the completion queue. Both queues live in
+ * the memory of the process. Their indices only grow, and are taken modulo
+ * SYS_RING_ENTRIES. */
+#define SYS_RING_ENTRIES 32
+#define SYS_RING_INVALID ((u_int32)-1)  /* Result of a syscall which cannot be queued */
+
+typedef struct sys_ring_sqe {
+  u_int32 op;         /* The syscall, among Malloc, MemFree, Open, Close, Read,
+                       * Write, Lseek, Fstat, Uptime, Pstat, Readv, Writev,
+                       * Pread and Pwrite */
+  u_int32 ebx, ecx, edx, edi;  /* Its params */
+  u_int32 user_data;  /* Copied in the completion */
+} sys_ring_sqe_t;
+
+typedef struct sys_ring_cqe {
+  u_int32 user_data;
+  u_int32 result;     /* The eax register set by the syscall */
+} sys_ring_cqe_t;
+
+typedef struct sys_ring {
+  u_int32 sq_head;    /* Advanced by the kernel */
+  u_int32 sq_tail;    /* Advanced by the process */
+  u_int32 cq_head;    /* Advanced by the process */
+  u_int32 cq_tail;    /* Advanced by the kernel */
+  sys_ring_sqe_t sq[SYS_RING_ENTRIES];
+  sys_ring_cqe_t cq[SYS_RING_ENTRIES];
+} sys_ring_t;
+
 /**
  * @name syscall_fork - Creates a new process with a new, copied context
  * This syscall has one param, in ebx: the priority to give to the child process,
  * which must be less than or equal to the priority of the current process.
+ * The child has the scheduling class of its parent, unless the SCHED_FAIR or
+ * SCHED_STRICT flag is also set in ebx.
  * If there's no free process, or if the child priority is higher than the priority
  * of the current process, the call terminates and places 0 in eax.
  * Otherwise, the parent process has 1 in eax and the pid of the child process in ebx,
@@ -42,6 +96,33 @@ typedef enum syscall {
  * @return void
  */
 void syscall_fork();
+/**
+ * @name syscall_exec - Replaces the program run by the process
+ * This syscall has two params: in ebx the name of the program (/progs/name.elf
+ * is loaded), and in ecx its arguments as a NULL-terminated array of strings,
+ * or NULL to only give it its name. They are passed to its main as argc and
+ * argv, at most EXEC_ARGC_MAX of them in EXEC_ARGS_MAX bytes.
+ * The user pages of the process are freed and new ones are mapped, but it keeps
+ * its pid, children, channels and pipe ends. The call only returns if the
+ * program does not exist or is not a valid executable, or if the arguments are
+ * invalid, placing 0 in eax. If the memory lacks once the old pages are freed,
+ * the process exits with -1.
+ * @return void
+ */
+void syscall_exec();
+/**
+ * @name syscall_spawn - Creates a child process running a program, without
+ * copying the current one
+ * This syscall has three params: the name of the program in ebx and its
+ * arguments in ecx, as for exec, and in edx the priority of the child, possibly
+ * or-ed with SCHED_FAIR or SCHED_STRICT as for fork. The child gets a fresh
+ * address space, and shares the pipe ends of its parent.
+ * If the program does not exist or cannot be loaded, the arguments are invalid,
+ * the priority is higher than the one of the current process or there is no
+ * free process, 0 is placed in eax. Otherwise eax is set to 1, and ebx to the pid of the child.
+ * @return void
+ */
+void syscall_spawn();
 /**
  * @name syscall_exit  - Terminates the process
  * This syscall has one param, in ebx: the return value of the exiting process.
@@ -62,21 +143,233 @@ void syscall_wait();
 void resolve_exit_wait(pid parent, pid child);
 
 /**
- * @name syscall_printf - Prints to the framebuffer (stdout)
- * The address of the format string is located in ebx, while the different
- * arguments are pushed on top of the stack (in reverse order, i.e. the one on
- * top is the leftmost).
+ * @name syscall_console_write - Writes characters to the framebuffer, or to the
+ * stdout pipe of the process
+ * This syscall has two params: the address of the characters in ebx, and their
+ * number in ecx, of which at most CONSOLE_WRITE_MAX are taken. They may contain
+ * the color escapes of write_chars, which are dropped on the way to a pipe. The
+ * number of characters taken is placed in eax, or 0 if the pipe has no reader.
+ * @return void
+ */
+void syscall_console_write();
+
+/**
+ * @name syscall_new_channel - Creates a channel (see channel.h)
+ * Its id is placed in eax, or -1 if there is no free channel. The channel is
+ * closed when the process exits.
+ * @return void
+ */
+void syscall_new_channel();
+
+/**
+ * @name syscall_send - Sends a value on a channel, synchronously
+ * This syscall has two params: in ebx the channel, and in ecx the value.
+ * The process blocks until the value is received, and the receiver of highest
+ * priority runs at once if there is one. eax is set to 0 if the channel is closed
+ * or already has a sender, or if it got closed in the meantime, and to 1 otherwise.
  * @return void
  */
-void syscall_printf();
+void syscall_send();
+
+/**
+ * @name syscall_receive - Receives a value from one of several channels
+ * This syscall has two params: in ebx the address of an array of channels, and
+ * in ecx their number (at most RECV_CHANNELS). The process blocks until a value
+ * is sent on one of them. Then 1 is placed in eax, the channel in ebx and the
+ * value in ecx. eax is set to 0 if none of the channels is open, or if the
+ * channel got closed in the meantime.
+ * @return void
+ */
+void syscall_receive();
+
+/**
+ * @name syscall_pipe - Creates a pipe (see pipe.h)
+ * If there's no free pipe, 0 is placed in eax. Otherwise eax is set to 1, ebx
+ * to the file descriptor of the read end and ecx to the one of the write end.
+ * Reading an empty pipe blocks until some bytes are written, or returns 0 once
+ * every write end is closed. Writing a full pipe blocks until some bytes are
+ * read, and writing without any read end left returns 0.
+ * @return void
+ */
+void syscall_pipe();
+
+/**
+ * @name syscall_readv - Reads a file into several buffers, in order
+ * This syscall has three params: the file descriptor in ebx, the address of an
+ * array of iovec_t in ecx, and their number (at most IOV_MAX) in edx. It stops
+ * at the end of the file, or at a buffer which is not writable by the process.
+ * The position of the file descriptor moves past the bytes read, whose number
+ * is placed in eax. Pipe ends are not accepted.
+ * @return void
+ */
+void syscall_readv();
+
+/**
+ * @name syscall_writev - Writes several buffers to a file, in order
+ * Same params and result as syscall_readv.
+ * @return void
+ */
+void syscall_writev();
+
+/**
+ * @name syscall_pread - Reads a file at a given position
+ * This syscall has four params: the file descriptor in ebx, the buffer in ecx,
+ * the number of bytes in edx and the position in the file in edi. The position
+ * of the file descriptor is unchanged. The number of bytes read is placed in
+ * eax. Pipe ends are not accepted.
+ * @return void
+ */
+void syscall_pread();
+
+/**
+ * @name syscall_pwrite - Writes a file at a given position
+ * Same params and result as syscall_pread. Nothing is written if the position
+ * is past the end of the file.
+ * @return void
+ */
+void syscall_pwrite();
+
+/**
+ * @name read_stub_registers - Sets the ecx and edx of a frame built by
+ * sysenter_entry, from the user stack where the stub of the process saved them
+ * @param regs                - The frame
+ * @param dir                 - The page directory of the process
+ * @return bool               - FALSE if the stack is not in the pages of the process
+ */
+bool read_stub_registers(regs_t *regs, page_directory_t *dir);
+
+/**
+ * @name write_stub_registers - Writes the ecx and edx of a frame built by
+ * sysenter_entry back on the user stack, where the stub of the process pops them
+ * @param regs                 - The frame
+ * @param dir                  - The page directory of the process
+ * @return bool                - FALSE if the stack is not in the writable pages
+ *                               of the process
+ */
+bool write_stub_registers(regs_t *regs, page_directory_t *dir);
+
+/**
+ * @name sysenter_install - Lets the current processor enter syscalls through sysenter
+ * Does nothing if it does not support sysenter. Must be called on every
+ * processor, once its TSS is loaded.
+ * @return void
+ */
+void sysenter_install();
+
+/**
+ * @name syscall_fast_entry - Tells whether the syscalls can go through sysenter
+ * 1 is placed in eax if they can, 0 if only int 0x80 works.
+ * @return void
+ */
+void syscall_fast_entry();
+
+/**
+ * @name syscall_ring_setup - Registers the syscall ring of the process
+ * This syscall has one param, in ebx: the address of a sys_ring_t in the memory
+ * of the process, or 0 to unregister it. The ring is kept by the children.
+ * @return void
+ */
+void syscall_ring_setup();
+
+/**
+ * @name syscall_ring_enter - Performs the syscalls queued in the ring
+ * They are performed in order, until the submission queue is empty or the
+ * completion queue is full. If one would block, the process blocks and the call
+ * resumes from it once the process is woken up. The number of syscalls
+ * performed by the last resumption is placed in eax.
+ * @return void
+ */
+void syscall_ring_enter();
+
+/**
+ * @name poll_syscall_ring - Performs the syscalls queued in the ring of the
+ * current process, when it is preempted
+ * They stop before one which would block, the process staying runnable.
+ * @return void
+ */
+void poll_syscall_ring();
+
+/**
+ * @name syscall_new_bulk - Creates a bulk channel (see channel.h)
+ * Its id is placed in eax, or -1 if there is no free bulk channel.
+ * @return void
+ */
+void syscall_new_bulk();
+
+/**
+ * @name syscall_bulk_send - Sends bytes on a bulk channel
+ * This syscall has three params: in ebx the channel, in ecx the address of the
+ * bytes and in edx their number. The process blocks while the ring buffer of
+ * the channel is full, then the number of bytes that fit is placed in eax. It
+ * is 0 if the channel is not open, and RING_FAULT if the bytes are not in the
+ * pages of the process.
+ * @return void
+ */
+void syscall_bulk_send();
+
+/**
+ * @name syscall_bulk_receive - Receives bytes from a bulk channel
+ * This syscall has three params: in ebx the channel, in ecx the address of the
+ * buffer and in edx its size. The process blocks while the ring buffer of the
+ * channel is empty, then the number of bytes received is placed in eax. It is
+ * 0 once the channel is closed and drained, and RING_FAULT if the buffer is not
+ * in the writable pages of the process.
+ * @return void
+ */
+void syscall_bulk_receive();
+
+/**
+ * @name syscall_sleep - Suspends the process for a given amount of time
+ * This syscall has one param, in ebx: the sleeping time in milliseconds.
+ * The process leaves the runqueues until the timer interruption wakes it up.
+ * A sleeping time of 0 only gives the processor to another process.
+ * @return void
+ */
+void syscall_sleep();
+
+/**
+ * @name syscall_uptime - Places in eax the number of milliseconds since boot
+ * @return void
+ */
+void syscall_uptime();
+
+/**
+ * @name syscall_pstat - Copies the statistics of a process (proc_stats_t)
+ * This syscall has two params: in ebx the pid of the process, and in ecx the
+ * address of the structure to fill. eax is set to 0 if there is no such process,
+ * and to 1 otherwise.
+ * @return void
+ */
+void syscall_pstat();
+
+/**
+ * @name syscall_hstat - Copies a histogram of the handler durations (histogram_t)
+ * This syscall has two params: in ebx 0 for timer_handler or 1 for syscall_handler,
+ * and in ecx the address of the structure to fill. eax is set to 0 if ebx is invalid,
+ * and to 1 otherwise.
+ * @return void
+ */
+void syscall_hstat();
 
 /**
  * @name kill_family - Kills the process and all its children recusively
+ * The ones a processor may still run are only marked, their processor makes
+ * them exit (see exit_killed), and init collects them.
  * @param parent     - The process to kill (should have been created by run)
  * @return void
  */
 void kill_family(pid parent);
 
+/**
+ * @name exit_killed - Ends the processes killed while the current processor used their stack
+ * Called when entering the kernel, once the stack of the last interruption is released.
+ * The current process exits with -1 if it was killed.
+ * @param released   - The process whose kernel stack the last interruption used
+ * @param regs       - Context of the current process
+ * @return bool      - Whether the current process exited
+ */
+bool exit_killed(pid released, regs_t *regs);
+
 
 void syscall_invalid();
 
@@ -9,4 +9,11 @@
  */
 void common_interrupt_handler();
 
+/**
+ * @name sysenter_entry - Entry point of sysenter, with the same frame as int 0x80
+ * This will also call syscall_handler, and returns through sysexit when possible.
+ * @return void
+ */
+void sysenter_entry();
+
 #endif
@@ -26,8 +26,94 @@ common_interrupt_handler:
   mov eax, syscall_handler
   call eax
 
-  pop eax
+  mov esp, eax                  ; Returns through the frame given by syscall_handler,
+                                ; which is on another kernel stack if the process changed
+  pop gs
+  pop fs
+  pop es
+  pop ds
+
+  popad
+
+  add esp, 8
+
+  iret
+
+
+; Fast entry of the syscalls, through sysenter (see sysenter_install)
+; The user stub (see progs/src/lib.s) pushes ecx then edx, and enters with the
+; stack pointer in ecx and its return address in edx. The frame built here is
+; the one of an int 0x80 from user mode, with SYSENTER_FRAME as interruption
+; number, so the scheduler handles both alike. The user stack is never read
+; here: syscall_handler reads the ecx and edx saved by the stub through the
+; checked copies of the kernel, and resume_frame writes them back likewise.
+
+SYSENTER_FRAME equ 0x81
+
+extern USER_CODE_SEGMENT
+extern USER_DATA_SEGMENT
+
+global sysenter_entry
+sysenter_entry:
+  mov esp, [esp]                ; SYSENTER_ESP points to the esp0 field of the TSS
+
+  push dword [USER_DATA_SEGMENT]  ; ss, as set by sysexit
+  push ecx                      ; useresp
+  pushfd
+  or dword [esp], 0x200         ; eflags, sysenter cleared the interruption flag
+  push dword [USER_CODE_SEGMENT]  ; cs
+  push edx                      ; eip
+  push dword 0                  ; Error code 0
+  push dword SYSENTER_FRAME     ; Interruption number
+
+  push eax                      ; Same order as pushad
+  push dword 0                  ; ecx, set by read_stub_registers
+  push dword 0                  ; edx, set by read_stub_registers
+  push ebx
+  push dword 0                  ; esp, ignored by popad
+  push ebp
+  push esi
+  push edi
+
+  push ds
+  push es
+  push fs
+  push gs
+
+  mov ax, 0x10
+  mov ds, ax
+  mov es, ax
+  mov fs, ax
+  mov gs, ax
+
+  mov eax, esp
+  push eax
+
+  mov eax, syscall_handler
+  call eax
+
+  mov esp, eax                  ; The frame given by syscall_handler
+  cmp dword [esp+48], SYSENTER_FRAME
+  jne .iret                     ; Another kind of frame, or a syscall to restart
+
+  pop gs
+  pop fs
+  pop es
+  pop ds
+
+  popad
+
+  add esp, 8
+
+  push dword [esp+8]            ; The flags of the process, without the interruption
+  and dword [esp], 0xFFFFFDFF   ; flag until sysexit
+  popfd
+  mov edx, [esp]                ; eip
+  mov ecx, [esp+12]             ; useresp
+  sti                           ; Only effective after sysexit
+  sysexit
 
+.iret:
   pop gs
   pop fs
   pop es
@@ -2,20 +2,104 @@
 
 /* Source : http://www.osdever.net/bkerndev/Docs/pit.htm */
 
+/* This will keep track of how many milliseconds the system
+ * has been running for */
+unsigned int timer_ticks = 0;
+
+bool    timer_periodic = FALSE;  /* Whether the PIT is in rate generator mode */
+bool    timer_armed    = FALSE;  /* Whether a one-shot count is still pending */
+u_int32 timer_period   = 0;      /* Number of PIT cycles programmed */
+u_int32 timer_residue  = 0;      /* PIT cycles not yet accounted in timer_ticks */
+unsigned int timer_deadline = 0;
+
+
+/**
+ * @name timer_account - Adds PIT cycles to the system clock
+ * @param cycles       - The number of elapsed PIT cycles
+ * @return void
+ */
+void timer_account(u_int32 cycles)
+{
+  timer_residue += cycles;
+  timer_ticks   += timer_residue / PIT_CYCLES_PER_MS;
+  timer_residue %= PIT_CYCLES_PER_MS;
+}
+
+/**
+ * @name timer_read - Reads the current count of the PIT channel 0
+ * @return u_int32
+ */
+u_int32 timer_read()
+{
+  outb(0x43, 0x00);             /* Latch command for channel 0 */
+  u_int32 low  = inb(0x40);
+  u_int32 high = inb(0x40);
+  return low | (high << 8);
+}
+
+/**
+ * @name timer_account_partial - Accounts the cycles elapsed in the current
+ * period, before the PIT gets reprogrammed
+ * @return void
+ */
+void timer_account_partial()
+{
+  if (timer_periodic || timer_armed) {
+    u_int32 count = timer_read();
+    if (count <= timer_period) {
+      timer_account(timer_period - count);
+    }
+  }
+}
+
 void timer_phase(int hz)
 {
-  int divisor = 1193180 / hz;   /* Calculate our divisor */
+  timer_account_partial();
+
+  int divisor = PIT_FREQ / hz;  /* Calculate our divisor */
   /* Bit:     | 7 6 | 5 4 | 3   1 | 0 |
    * Content: | CNTR|  RW  | Mode |BCD|
-   * Value:   | 0 0 | 1 1 | 0 1 1 | 0 |= 0x36 */
-  outb(0x43, 0x36);             /* Set our command byte 0x36 */
+   * Value:   | 0 0 | 1 1 | 0 1 0 | 0 |= 0x34
+   * Mode 2 (rate generator) rather than mode 3 (square wave), so that the
+   * latched count decreases linearly and can be used by timer_account_partial */
+  outb(0x43, 0x34);             /* Set our command byte 0x34 */
   outb(0x40, divisor & 0xFF);   /* Set low byte of divisor */
   outb(0x40, divisor >> 8);     /* Set high byte of divisor */
+
+  timer_periodic = TRUE;
+  timer_armed    = FALSE;
+  timer_period   = divisor;
 }
 
-/* This will keep track of how many ticks that the system
- * has been running for */
-unsigned int timer_ticks = 0;
+void timer_one_shot(u_int32 ms)
+{
+  timer_account_partial();
+
+  if (ms > TIMER_MAX_ONE_SHOT) {
+    ms = TIMER_MAX_ONE_SHOT;
+  } else if (!ms) {
+    ms = 1;
+  }
+  u_int32 count = ms * PIT_CYCLES_PER_MS;
+  /* Value:   | 0 0 | 1 1 | 0 0 0 | 0 |= 0x30
+   * Mode 0 (interrupt on terminal count): a single IRQ0 once count reaches 0 */
+  outb(0x43, 0x30);
+  outb(0x40, count & 0xFF);
+  outb(0x40, count >> 8);
+
+  timer_periodic = FALSE;
+  timer_armed    = TRUE;
+  timer_period   = count;
+  timer_deadline = timer_ticks + ms;
+}
+
+void timer_tick()
+{
+  if (timer_periodic || timer_armed) {
+    timer_account(timer_period);
+  }
+  timer_armed = FALSE;  /* A one-shot count only fires once */
+}
 
 /* Handles the timer. In this case, it's very simple: We
  * increment the 'timer_ticks' variable every time the
@@ -26,7 +110,7 @@ unsigned int timer_ticks = 0;
 void timer_handler_dummy(struct regs *r)
 {
   /* Increment our 'tick count' */
-  timer_ticks++;
+  timer_tick();
 }
 #pragma GCC diagnostic pop
 
@@ -41,6 +125,22 @@ void timer_install()
   kloug(100, "Timer installed\n");
 }
 
+void timer_delay(u_int32 ms)
+{
+  for (u_int32 i = 0; i < ms; i++) {
+    /* Channel 2 counts only while its gate (bit 0 of port 0x61) is high, and
+     * its output (bit 5) goes high at the end of the count. Bit 1 is the
+     * speaker, which stays off. */
+    u_int8 control = inb(0x61) & 0xFC;
+    outb(0x61, control);
+    outb(0x43, 0xB0);             /* Channel 2, mode 0 */
+    outb(0x42, PIT_CYCLES_PER_MS & 0xFF);
+    outb(0x42, PIT_CYCLES_PER_MS >> 8);
+    outb(0x61, control | 1);      /* Starts the count */
+    while (!(inb(0x61) & 0x20));
+  }
+}
+
 void timer_wait(unsigned int amount)
 {
   /* Stops the system for @param amount milliseconds*/
@@ -3,8 +3,46 @@
 
 #include "keyboard.h"
 
+#define PIT_FREQ           1193180  /* Frequency (in Hz) of the PIT oscillator */
+#define PIT_CYCLES_PER_MS     1193  /* PIT_FREQ / 1000 */
+#define TIMER_MAX_ONE_SHOT      54  /* Longest one-shot delay (in ms): 0xFFFF / PIT_CYCLES_PER_MS */
+
+unsigned int timer_ticks;  /* Milliseconds since the timer was first programmed */
+bool timer_periodic;       /* Whether the PIT currently fires periodically */
+bool timer_armed;          /* Whether a one-shot count is still pending */
+unsigned int timer_deadline;  /* Value of timer_ticks when the one-shot count expires */
+
 void timer_install();
 
+/**
+ * @name timer_phase - Programs the PIT to fire periodically
+ * @param hz         - The frequency of the interruptions
+ * @return void
+ */
+void timer_phase(int hz);
+
+/**
+ * @name timer_one_shot - Programs the PIT to fire once, after the given delay
+ * The delay is clamped to [1, TIMER_MAX_ONE_SHOT]
+ * @param ms            - The delay, in milliseconds
+ * @return void
+ */
+void timer_one_shot(u_int32 ms);
+
+/**
+ * @name timer_tick - Updates timer_ticks, must be called on every IRQ0
+ * @return void
+ */
+void timer_tick();
+
+/**
+ * @name timer_delay - Busy-waits on the PIT channel 2, without interruptions
+ * Unlike timer_wait, it works before the scheduler programs the channel 0.
+ * @param ms         - The delay, in milliseconds
+ * @return void
+ */
+void timer_delay(u_int32 ms);
+
 /**
  *  @name timer_wait - Stops the system for a given amount of time.
  *
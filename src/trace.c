@@ -0,0 +1,128 @@
+#include "trace.h"
+#include "malloc.h"
+#include "memory.h"
+#include "logging.h"
+#include "printer.h"
+
+extern scheduler_state_t *state;  /* Defined in scheduler.c */
+
+string syscall_names[Invalid] = {
+  [Exit]       = "exit",
+  [Fork]       = "fork",
+  [Wait]       = "wait",
+  [ConsoleWrite] = "console_write",
+  [Malloc]     = "malloc",
+  [MemFree]    = "free",
+  [Ls]         = "ls",
+  [Rm]         = "rm",
+  [Mkdir]      = "mkdir",
+  [Cat]        = "cat",
+  [Run]        = "run",
+  [Hlt]        = "hlt",
+  [NewChannel] = "new_channel",
+  [Send]       = "send",
+  [Receive]    = "receive",
+  [Open]       = "open",
+  [Close]      = "close",
+  [Read]       = "read",
+  [Write]      = "write",
+  [Lseek]      = "lseek",
+  [Fstat]      = "fstat",
+  [Sleep]      = "sleep",
+  [Uptime]     = "uptime",
+  [Pstat]      = "pstat",
+  [Hstat]      = "hstat",
+  [NewBulk]    = "new_bulk",
+  [BulkSend]   = "bulk_send",
+  [BulkRecv]   = "bulk_receive",
+  [Pipe]       = "pipe",
+  [RingSetup]  = "ring_setup",
+  [RingEnter]  = "ring_enter",
+  [FastEntry]  = "fast_entry",
+  [Readv]      = "readv",
+  [Writev]     = "writev",
+  [Pread]      = "pread",
+  [Pwrite]     = "pwrite",
+  [Exec]       = "exec",
+  [Spawn]      = "spawn",
+};
+
+
+void trace_syscall(pid id, u_int32 nr, u_int32 args[4], u_int32 cycles)
+{
+  syscall_prof_t *prof = &syscall_profs[nr];
+  prof->count++;
+  prof->total += cycles;
+  if (cycles > prof->max) {
+    prof->max = cycles;
+  }
+
+  if (trace_mode != TraceEvents) {
+    return;
+  }
+  process_t *proc = &PROCESS(id);
+  if (!proc->trace) {
+    proc->trace = mem_alloc(sizeof(trace_ring_t));
+    proc->trace->next = 0;
+  }
+  trace_event_t *event = &proc->trace->events[proc->trace->next++ % TRACE_EVENTS];
+  event->nr = nr;
+  for (u_int32 i = 0; i < 4; i++) {
+    event->args[i] = args[i];
+  }
+  event->cycles = cycles;
+}
+
+void trace_release(process_t *proc)
+{
+  if (proc->trace) {
+    mem_free(proc->trace);
+    proc->trace = NULL;
+  }
+}
+
+void trace_reset()
+{
+  mem_set(syscall_profs, 0, sizeof(syscall_profs));
+  for (pid id = 0; id < state->nb_processes; id++) {
+    trace_release(&PROCESS(id));
+  }
+}
+
+void print_trace()
+{
+  writef("syscall\tcount\tkcycles\tmax\n");
+  for (u_int32 nr = 0; nr < Invalid; nr++) {
+    syscall_prof_t *prof = &syscall_profs[nr];
+    if (prof->count) {
+      writef("%s\t%u\t%u\t%u\n", syscall_names[nr], prof->count, \
+             (u_int32)(prof->total >> 10), prof->max);
+    }
+  }
+}
+
+void dump_trace()
+{
+  kloug(100, "nr,name,count,total_kcycles,max_cycles\n");
+  for (u_int32 nr = 0; nr < Invalid; nr++) {
+    syscall_prof_t *prof = &syscall_profs[nr];
+    if (prof->count) {
+      kloug(100, "%u,%s,%u,%u,%u\n", nr, syscall_names[nr], prof->count, \
+            (u_int32)(prof->total >> 10), prof->max);
+    }
+  }
+
+  kloug(100, "pid,nr,name,ebx,ecx,edx,edi,cycles\n");
+  for (pid id = 0; id < state->nb_processes; id++) {
+    trace_ring_t *ring = PROCESS(id).trace;
+    if (!ring) {
+      continue;
+    }
+    u_int32 first = ring->next > TRACE_EVENTS ? ring->next - TRACE_EVENTS : 0;
+    for (u_int32 i = first; i < ring->next; i++) {
+      trace_event_t *event = &ring->events[i % TRACE_EVENTS];
+      kloug(150, "%u,%u,%s,%x,%x,%x,%x,%u\n", id, event->nr, syscall_names[event->nr], \
+            event->args[0], event->args[1], event->args[2], event->args[3], event->cycles);
+    }
+  }
+}
@@ -0,0 +1,85 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/* trace.h:
+ * Tracing of the syscalls: the number of calls and the cycles spent in each
+ * syscall and, optionally, the last syscalls of each process with their params.
+ * Toggled by the trace command of the shell, and dumped to the serial port.
+ */
+
+#include "types.h"
+#include "syscall.h"
+
+
+#define TRACE_EVENTS 32  /* Number of recent syscalls kept for each process */
+
+typedef enum trace_mode {
+  TraceOff = 0,
+  TraceCounts,  /* Only the statistics of each syscall */
+  TraceEvents,  /* Also the recent syscalls of each process */
+} trace_mode_t;
+
+/* The statistics of a syscall, in processor cycles */
+typedef struct syscall_prof {
+  u_int32 count;
+  u_int32 max;
+  u_int64 total;
+} syscall_prof_t;
+
+/* A syscall made by a process */
+typedef struct trace_event {
+  u_int32 nr;       /* The syscall */
+  u_int32 args[4];  /* Its params, in ebx, ecx, edx and edi */
+  u_int32 cycles;   /* Its duration */
+} trace_event_t;
+
+/* The recent syscalls of a process, allocated by its first traced syscall */
+typedef struct trace_ring {
+  u_int32 next;  /* Number of syscalls recorded, the last TRACE_EVENTS being kept */
+  trace_event_t events[TRACE_EVENTS];
+} trace_ring_t;
+
+trace_mode_t trace_mode;
+syscall_prof_t syscall_profs[Invalid];
+
+
+/**
+ * @name trace_syscall - Records a syscall, when the tracing is on
+ * @param id           - The process which made it
+ * @param nr           - The syscall
+ * @param args         - Its params, in ebx, ecx, edx and edi
+ * @param cycles       - Its duration
+ * @return void
+ */
+void trace_syscall(pid id, u_int32 nr, u_int32 args[4], u_int32 cycles);
+
+/**
+ * @name trace_release - Frees the recent syscalls of a process, when it is freed
+ * @param proc         - The process
+ * @return void
+ */
+void trace_release(process_t *proc);
+
+/**
+ * @name trace_reset - Forgets every statistic and recent syscall
+ * @return void
+ */
+void trace_reset();
+
+/**
+ * @name print_trace - Writes the statistics of the syscalls which were made
+ * @return void
+ */
+void print_trace();
+
+/**
+ * @name dump_trace - Sends the statistics, then the recent syscalls of every
+ * process, to the serial port as CSV
+ * The statistics are lines "nr,name,count,total_kcycles,max_cycles", a kcycle
+ * being 1024 cycles. The recent syscalls, oldest first, are lines
+ * "pid,nr,name,ebx,ecx,edx,edi,cycles".
+ * @return void
+ */
+void dump_trace();
+
+#endif
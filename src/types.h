@@ -12,6 +12,7 @@ typedef unsigned short u_int16;
 typedef   signed short s_int16;
 typedef unsigned char  u_int8;
 typedef   signed char  s_int8;
+typedef unsigned long long u_int64;
 
 typedef u_int32 size_t;  /* A type to hold a number of bytes */
 
@@ -5,3 +5,8 @@ unsigned int max(unsigned int a, unsigned int b)
 {
   return a > b ? a : b;
 }
+
+unsigned int min(unsigned int a, unsigned int b)
+{
+  return a < b ? a : b;
+}
@@ -2,5 +2,6 @@
 #define UTILS_H
 
 unsigned int max(unsigned int a, unsigned int b);
+unsigned int min(unsigned int a, unsigned int b);
 
 #endif